@@ -0,0 +1,100 @@
+#include <iostream>
+#include <streambuf>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../src/Crypto/CryptoAes128cbc.hpp"
+#include "../src/Crypto/CryptoAes128cbcNi.hpp"
+#include "../src/Crypto/CryptoMultiBuffer.hpp"
+
+/* Compares the throughput of the encrypted output path with the
+ * plaintext one, for small (a few TS packets) and large writes
+ */
+
+#define SIZE (256*1024*1024)
+
+class NullBuffer : public std::streambuf {
+protected:
+	virtual int overflow(int c) { return std::char_traits<char>::not_eof(c); }
+	virtual std::streamsize xsputn(const char *s, std::streamsize n) { return n; }
+};
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void bench(const char *name, std::ostream &out, const char *buf, size_t write_size) {
+	double start = now();
+	for( size_t done = 0; done + write_size <= SIZE; done += write_size ) {
+		out.write(buf, write_size);
+	}
+	out << std::flush;
+	double elapsed = now() - start;
+	std::cout << "output " << name << " write_size=" << write_size << " "
+	          << (SIZE / elapsed / 1e6) << " MB/s\n";
+}
+
+class KeySchedule : public CryptoAes128cbcNi {
+public:
+	KeySchedule(char key[16], char iv[16]) : CryptoAes128cbcNi(key, iv) {}
+	const unsigned char (*keys())[16] { return m_enc_key; }
+};
+
+static void bench_lanes(const char *buf, unsigned lanes) {
+	char key[16] = {0}, iv[CRYPTO_MB_MAX_LANES][16] = {{0}};
+	KeySchedule sched(key, iv[0]);
+	char *out = static_cast<char*>(malloc(lanes * 1024*1024));
+	CryptoMultiBuffer::Job job[CRYPTO_MB_MAX_LANES], *jobs[CRYPTO_MB_MAX_LANES];
+	for( unsigned l = 0; l < lanes; l++ ) {
+		job[l].key = sched.keys();
+		job[l].iv = reinterpret_cast<unsigned char*>(iv[l]);
+		job[l].in = buf;
+		job[l].out = out + l * 1024*1024;
+		job[l].length = 1024*1024;
+		jobs[l] = &job[l];
+	}
+
+	double start = now();
+	size_t done;
+	for( done = 0; done < SIZE; done += lanes * 1024*1024 ) {
+		CryptoMultiBuffer::encryptLanes(jobs, lanes);
+	}
+	double elapsed = now() - start;
+	std::cout << "aes-128-cbc/aesni-mb lanes=" << lanes << " "
+	          << (done / elapsed / 1e6) << " MB/s\n";
+	free(out);
+}
+
+int main(int argc, char *argv[]) {
+	static const size_t write_sizes[] = { 188, 7*188, 1024*1024 };
+	char *buf = static_cast<char*>(malloc(1024*1024));
+	for( size_t i = 0; i < 1024*1024; i++ ) buf[i] = rand();
+	char key[16] = {0}, iv[16] = {0};
+
+	for( unsigned i = 0; i < sizeof(write_sizes)/sizeof(*write_sizes); i++ ) {
+		NullBuffer null;
+		std::ostream plain(&null);
+		bench("plaintext", plain, buf, write_sizes[i]);
+
+		CryptoAes128cbc aes(key, iv);
+		CryptoProxy crypted(plain, &aes);
+		bench("aes-128-cbc/openssl", crypted, buf, write_sizes[i]);
+
+		if( CryptoAes128cbcNi::supported() ) {
+			CryptoAes128cbcNi aesni(key, iv);
+			CryptoProxy crypted_ni(plain, &aesni);
+			bench("aes-128-cbc/aesni", crypted_ni, buf, write_sizes[i]);
+		}
+	}
+
+	if( CryptoAes128cbcNi::supported() ) {
+		for( unsigned lanes = 1; lanes <= CRYPTO_MB_MAX_LANES; lanes *= 2 ) bench_lanes(buf, lanes);
+	}
+
+	free(buf);
+	return 0;
+}
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,40 @@
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+#include "Streams.hpp"
+
+/* Writes one of the synthetic streams of the benchmarks to stdout, to
+ * feed the segmenters by hand:
+ *   Generate ts [seconds [gop [seed]]]
+ *   Generate mpts [seconds [programs [gop [seed]]]]
+ *   Generate adts|mp3 [seconds [seed]]
+ */
+
+int main(int argc, char *argv[]) {
+	std::string kind = argc > 1 ? argv[1] : "";
+	unsigned seconds = argc > 2 ? strtoul(argv[2], NULL, 10) : 60;
+	unsigned long count;
+	std::string out;
+	if( kind == "ts" ) {
+		unsigned gop = argc > 3 ? strtoul(argv[3], NULL, 10) : 50;
+		out = stream_ts_h264(seconds, gop > 0 ? gop : 1, argc > 4 ? strtoul(argv[4], NULL, 10) : 1, count);
+	} else if( kind == "mpts" ) {
+		unsigned programs = argc > 3 ? strtoul(argv[3], NULL, 10) : 4;
+		unsigned gop = argc > 4 ? strtoul(argv[4], NULL, 10) : 50;
+		out = stream_mpts_h264(seconds, gop > 0 ? gop : 1, programs > 0 ? programs : 1, argc > 5 ? strtoul(argv[5], NULL, 10) : 1, count);
+	} else if( kind == "adts" ) {
+		out = stream_adts(seconds, argc > 3 ? strtoul(argv[3], NULL, 10) : 1, count);
+	} else if( kind == "mp3" ) {
+		out = stream_mp3(seconds, argc > 3 ? strtoul(argv[3], NULL, 10) : 1, count);
+	} else {
+		std::cerr << "Usage: " << argv[0] << " ts [seconds [gop [seed]]]\n"
+		          << "       " << argv[0] << " mpts [seconds [programs [gop [seed]]]]\n"
+		          << "       " << argv[0] << " adts|mp3 [seconds [seed]]\n";
+		return 1;
+	}
+	std::cout.write(out.data(), out.size());
+	return std::cout.good() ? 0 : 1;
+}
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,100 @@
+#include <iostream>
+#include <set>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* Measures the per-packet PID decision of MpegtsH264: the std::set of
+ * media PIDs plus comparisons it used to make, against the single lookup
+ * in a table indexed by PID it makes now.
+ *
+ * The PIDs follow a typical single program: mostly video, some audio, and
+ * a sprinkling of PSI, SI and null packets that get dropped
+ */
+
+#define PACKETS (16*1024*1024)
+#define ROUNDS 10
+
+#define PMT_PID 0x1000
+#define VIDEO_PID 0x100
+
+enum { PID_KEEP = 0x01, PID_PMT = 0x02, PID_VIDEO = 0x04 };
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static std::set<unsigned short> media_pids;
+
+static unsigned long filter_set(const unsigned short *pids, size_t count) {
+	unsigned long kept = 0;
+	for( size_t i = 0; i < count; i++ ) {
+		unsigned short pid = pids[i];
+		if( pid == VIDEO_PID ) kept += 2; // opens_gop() would look further
+		if( pid == 0 || pid == PMT_PID || media_pids.find(pid) != media_pids.end() ) kept++;
+	}
+	return kept;
+}
+
+static unsigned char action[0x2000];
+
+static unsigned long filter_table(const unsigned short *pids, size_t count) {
+	unsigned long kept = 0;
+	for( size_t i = 0; i < count; i++ ) {
+		unsigned char a = action[pids[i]];
+		if( a & PID_VIDEO ) kept += 2;
+		if( a & PID_KEEP ) kept++;
+	}
+	return kept;
+}
+
+static void bench(const char *name, unsigned long (*filter)(const unsigned short*, size_t),
+                  const unsigned short *pids, unsigned long expected) {
+	unsigned long kept = 0;
+	double start = now();
+	for( int i = 0; i < ROUNDS; i++ ) {
+		kept += filter(pids, PACKETS);
+	}
+	double elapsed = now() - start;
+	if( kept != ROUNDS * expected ) {
+		std::cerr << name << ": kept the wrong packets\n";
+		exit(1);
+	}
+	std::cout << "pid_filter " << name << " "
+	          << (static_cast<double>(PACKETS) * ROUNDS / elapsed / 1e6) << " Mpackets/s\n";
+}
+
+int main(int argc, char *argv[]) {
+	const unsigned short es[] = { VIDEO_PID, 0x101, 0x102, 0x103 }; // Video, two audio, subtitles
+	const unsigned short dropped[] = { 0x11, 0x12, 0x1fff }; // SDT, EIT, null
+	for( size_t i = 0; i < sizeof(es)/sizeof(es[0]); i++ ) {
+		media_pids.insert(es[i]);
+		action[es[i]] = PID_KEEP;
+	}
+	action[0] = PID_KEEP;
+	action[PMT_PID] = PID_KEEP | PID_PMT;
+	action[VIDEO_PID] |= PID_VIDEO;
+
+	unsigned short *pids = static_cast<unsigned short*>(malloc(PACKETS * sizeof(*pids)));
+	unsigned long expected = 0;
+	srand(1);
+	for( size_t i = 0; i < PACKETS; i++ ) {
+		int r = rand() % 100;
+		if( r < 80 ) pids[i] = VIDEO_PID;
+		else if( r < 94 ) pids[i] = es[1 + rand() % 3];
+		else if( r < 96 ) pids[i] = rand() % 2 ? 0 : PMT_PID;
+		else pids[i] = dropped[rand() % 3];
+		if( action[pids[i]] & PID_VIDEO ) expected += 2;
+		if( action[pids[i]] & PID_KEEP ) expected++;
+	}
+
+	bench("set", filter_set, pids, expected);
+	bench("table", filter_table, pids, expected);
+
+	free(pids);
+	return 0;
+}
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,181 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <new>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "Streams.hpp"
+#include "../src/Input/Memory.hpp"
+#include "../src/Input/Mmap.hpp"
+#include "../src/Input/Stream.hpp"
+#include "../src/Segmenter/MpegtsH264.hpp"
+#include "../src/Segmenter/ADTS.hpp"
+#include "../src/Segmenter/MP3.hpp"
+#include "../src/Crypto/CryptoAes128cbc.hpp"
+
+/* Runs each segmenter's copy_segment() over a synthetic stream, the way
+ * main does: from memory, from a file through a stream, and from a
+ * memory-mapped file; in plaintext and through CryptoAes128cbc.
+ * Output goes nowhere, so this measures parsing and copying only.
+ *
+ * Prints one line of key=value pairs per case, for scripts to compare:
+ *   segmenter= input= crypto= rounds= bytes= segments= seconds=
+ *   mb_per_s= packets_per_s= allocs_per_segment=
+ * Each case runs over the whole stream for at least MIN_SECONDS; packets
+ * are TS packets or audio frames.
+ *
+ * Usage: Segmenters [seconds of media, default 600]
+ */
+
+#define MIN_SECONDS 0.5
+
+static unsigned long long allocations = 0;
+
+void *operator new(size_t size) {
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	void *p = malloc(size ? size : 1);
+	if( p == NULL ) throw std::bad_alloc();
+	return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+void operator delete(void *p, size_t) throw() { free(p); }
+void operator delete[](void *p, size_t) throw() { free(p); }
+
+class NullBuffer : public std::streambuf {
+protected:
+	virtual int overflow(int c) { return std::char_traits<char>::not_eof(c); }
+	virtual std::streamsize xsputn(const char *s, std::streamsize n) { return n; }
+};
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct Stream {
+	const char *name;
+	std::string data;
+	unsigned long packets;
+	std::string filename; // The same data, on disk
+};
+
+struct Result {
+	unsigned long long bytes, segments, allocs;
+	double seconds;
+};
+
+template<class S>
+static void run(const Stream &s, const std::string &input, bool crypto, Result &r) {
+	NullBuffer null_buf;
+	std::ostream null(&null_buf);
+
+	std::ifstream file;
+	Input::Input *in;
+	if( input == "memory" ) {
+		in = new Input::Memory(s.data.data(), s.data.data() + s.data.size());
+	} else if( input == "mmap" ) {
+		in = new Input::Mmap(s.filename);
+	} else {
+		file.open(s.filename.c_str(), std::ios_base::in | std::ios_base::binary);
+		in = new Input::Stream(file);
+	}
+	S seg(10, "");
+
+	char key[16] = {0}, iv[16] = {0};
+	unsigned long segments = 0;
+	unsigned long long allocs_before = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+	double start = now();
+	while( 1 ) {
+		std::ostream *out = &null;
+		Crypto *module = NULL;
+		if( crypto ) {
+			iv[15] = segments;
+			module = new CryptoAes128cbc(key, iv);
+			out = new CryptoProxy(null, module);
+		}
+		float duration = seg.copy_segment(in, out);
+		*out << std::flush;
+		if( crypto ) {
+			delete out;
+			delete module;
+		}
+		segments++;
+		if( duration <= 0 ) break;
+	}
+	r.seconds += now() - start;
+	r.allocs += __atomic_load_n(&allocations, __ATOMIC_RELAXED) - allocs_before;
+	r.segments += segments;
+	if( in->offset() != s.data.size() ) {
+		std::cerr.rdbuf(std::cout.rdbuf());
+		std::cerr << s.name << " " << input << ": read " << in->offset() << " of " << s.data.size() << " bytes\n";
+		exit(1);
+	}
+	r.bytes += in->offset();
+	delete in;
+}
+
+template<class S>
+static void bench(const Stream &s, const char *input, bool crypto) {
+	NullBuffer null_buf;
+	std::streambuf *cerr_buf = std::cerr.rdbuf(&null_buf); // Segmenters log what they find
+	Result r = { 0, 0, 0, 0 };
+	unsigned rounds = 0;
+	do { // Long enough to time
+		run<S>(s, input, crypto, r);
+		rounds++;
+	} while( r.seconds < MIN_SECONDS );
+	std::cerr.rdbuf(cerr_buf);
+
+	std::cout << "segmenter=" << s.name << " input=" << input << " crypto=" << (crypto ? "aes-128-cbc" : "none")
+	          << " rounds=" << rounds << " bytes=" << r.bytes << " segments=" << r.segments << " seconds=" << r.seconds
+	          << " mb_per_s=" << (r.bytes / r.seconds / 1e6) << " packets_per_s=" << (s.packets * rounds / r.seconds)
+	          << " allocs_per_segment=" << (static_cast<double>(r.allocs) / r.segments) << "\n";
+}
+
+template<class S>
+static void bench_all(Stream &s) {
+	char filename[] = "segbench-XXXXXX";
+	int fd = mkstemp(filename);
+	if( fd < 0 || write(fd, s.data.data(), s.data.size()) != static_cast<ssize_t>(s.data.size()) ) {
+		std::cerr << "Could not write a temporary file\n";
+		exit(1);
+	}
+	close(fd);
+	s.filename = filename;
+
+	static const char *inputs[] = { "memory", "stream", "mmap" };
+	for( unsigned i = 0; i < sizeof(inputs)/sizeof(*inputs); i++ ) {
+		bench<S>(s, inputs[i], false);
+		bench<S>(s, inputs[i], true);
+	}
+	unlink(filename);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 600;
+	if( seconds == 0 ) {
+		std::cerr << "Usage: " << argv[0] << " [seconds of media]\n";
+		return 1;
+	}
+
+	Stream ts = { "MpegtsH264", "", 0, "" };
+	ts.data = stream_ts_h264(seconds, 50, 1, ts.packets);
+	bench_all<Segmenter::MpegtsH264>(ts);
+
+	Stream adts = { "ADTS", "", 0, "" };
+	adts.data = stream_adts(seconds, 1, adts.packets);
+	bench_all<Segmenter::ADTS>(adts);
+
+	Stream mp3 = { "MP3", "", 0, "" };
+	mp3.data = stream_mp3(seconds, 1, mp3.packets);
+	bench_all<Segmenter::MP3>(mp3);
+
+	return 0;
+}
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../src/Segmenter/Nal.hpp"
+#include "../src/Segmenter/Cpu.hpp"
+
+/* Measures how fast the H.264 start code scanners get through slice data:
+ * random bytes with plenty of zeros but no start code, one at the very end
+ */
+
+#define SIZE (64*1024*1024)
+#define ROUNDS 10
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void bench(const char *name, size_t (*scan)(const char*, size_t), const char *buf, size_t len) {
+	size_t found = 0;
+	double start = now();
+	for( int i = 0; i < ROUNDS; i++ ) {
+		found += scan(buf, len);
+	}
+	double elapsed = now() - start;
+	if( found != ROUNDS * (len - 3) ) {
+		std::cerr << name << ": found a start code at the wrong offset\n";
+		exit(1);
+	}
+	std::cout << "start_code_scan " << name << " "
+	          << (static_cast<double>(len) * ROUNDS / elapsed / 1e9) << " GB/s\n";
+}
+
+int main(int argc, char *argv[]) {
+	char *buf = static_cast<char*>(malloc(SIZE));
+	srand(1);
+	for( size_t i = 0; i < SIZE; i++ ) {
+		buf[i] = ( rand() % 4 == 0 ) ? 0x00 : rand();
+		if( i >= 2 && buf[i-2] == 0x00 && buf[i-1] == 0x00 && static_cast<unsigned char>(buf[i]) <= 0x03 ) {
+			buf[i] = 0x03; // Emulation prevention, like in the real thing
+		}
+	}
+	buf[SIZE-3] = 0x00;
+	buf[SIZE-2] = 0x00;
+	buf[SIZE-1] = 0x01;
+	if( buf[SIZE-4] == 0x00 ) buf[SIZE-4] = 0x42;
+
+	bench("scalar", Segmenter::start_code_scan_scalar, buf, SIZE);
+	bench("sse2", Segmenter::start_code_scan_sse2, buf, SIZE);
+	if( Segmenter::cpu_has_avx2() ) {
+		bench("avx2", Segmenter::start_code_scan_avx2, buf, SIZE);
+	}
+
+	free(buf);
+	return 0;
+}
+
+/* vim: set ts=4 sw=4: */
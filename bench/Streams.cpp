@@ -0,0 +1,229 @@
+#include "Streams.hpp"
+#include <string.h>
+#include <vector>
+
+#define TS_PACKET_SIZE 188
+#define PID_PMT 0x1000
+#define PID_VIDEO 0x100
+#define PID_NULL 0x1fff
+#define FPS 25
+
+class Random {
+public:
+	Random(unsigned seed) : m_state(seed * 2654435761u + 1) {}
+	unsigned next() { // xorshift32
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return m_state;
+	}
+	unsigned range(unsigned from, unsigned to) { return from + next() % (to - from); }
+	void fill(std::string &s, size_t n) {
+		for( size_t i = 0; i < n; i++ ) s += static_cast<char>(next() >> 24);
+	}
+private:
+	unsigned m_state;
+};
+
+static unsigned long crc32_mpeg(const std::string &s) {
+	unsigned long crc = 0xffffffff;
+	for( size_t i = 0; i < s.size(); i++ ) {
+		crc ^= static_cast<unsigned long>(static_cast<unsigned char>(s[i])) << 24;
+		for( int b = 0; b < 8; b++ ) {
+			crc = ( crc & 0x80000000 ) ? ((crc << 1) ^ 0x04c11db7) & 0xffffffff : (crc << 1) & 0xffffffff;
+		}
+	}
+	return crc;
+}
+
+class TsWriter {
+public:
+	std::string out;
+	unsigned long packets;
+
+	TsWriter() : packets(0) { memset(m_cc, 0, sizeof(m_cc)); }
+
+	void packet(unsigned pid, const std::string &payload, bool unit_start, long long pcr = -1) {
+		// payload must fit: up to 184 bytes, 176 with a PCR
+		size_t start = out.size();
+		out += static_cast<char>(0x47);
+		out += static_cast<char>((unit_start ? 0x40 : 0) | (pid >> 8));
+		out += static_cast<char>(pid & 0xff);
+		bool adaptation = pcr >= 0 || payload.size() < 184;
+		out += static_cast<char>((adaptation ? 0x30 : 0x10) | (m_cc[pid]++ & 0x0f));
+		if( adaptation ) {
+			size_t af_length = 183 - payload.size();
+			out += static_cast<char>(af_length);
+			if( af_length > 0 ) {
+				out += static_cast<char>(pcr >= 0 ? 0x10 : 0x00);
+				if( pcr >= 0 ) {
+					out += static_cast<char>(pcr >> 25);
+					out += static_cast<char>(pcr >> 17);
+					out += static_cast<char>(pcr >> 9);
+					out += static_cast<char>(pcr >> 1);
+					out += static_cast<char>(((pcr & 1) << 7) | 0x7e);
+					out += static_cast<char>(0x00);
+				}
+				out.append(start + TS_PACKET_SIZE - payload.size() - out.size(), static_cast<char>(0xff));
+			}
+		}
+		out += payload;
+		packets++;
+	}
+
+	void pes(unsigned pid, const std::string &pes, long long pcr = -1) {
+		size_t done = 0;
+		bool first = true;
+		while( done < pes.size() ) {
+			size_t room = ( first && pcr >= 0 ) ? 176 : 184;
+			std::string chunk = pes.substr(done, room);
+			packet(pid, chunk, first, first ? pcr : -1);
+			done += chunk.size();
+			first = false;
+		}
+	}
+
+	void section(unsigned pid, unsigned char table_id, const std::string &body) {
+		std::string s;
+		s += static_cast<char>(table_id);
+		s += static_cast<char>(0xb0 | ((body.size() + 4) >> 8));
+		s += static_cast<char>((body.size() + 4) & 0xff);
+		s += body;
+		unsigned long crc = crc32_mpeg(s);
+		for( int i = 3; i >= 0; i-- ) s += static_cast<char>(crc >> (8*i));
+		std::string payload(1, '\0'); // pointer field
+		payload += s;
+		payload.append(184 - payload.size(), static_cast<char>(0xff));
+		packet(pid, payload, true);
+	}
+
+private:
+	unsigned char m_cc[8192];
+};
+
+static std::string pes_header(unsigned char stream_id, long long pts) {
+	static const char start[] = { 0x00, 0x00, 0x01 };
+	std::string h(start, 3);
+	h += static_cast<char>(stream_id);
+	h += std::string("\x00\x00\x80\x80\x05", 5); // No length, PTS only
+	h += static_cast<char>(0x21 | ((pts >> 29) & 0x0e));
+	h += static_cast<char>(pts >> 22);
+	h += static_cast<char>(((pts >> 14) & 0xfe) | 1);
+	h += static_cast<char>(pts >> 7);
+	h += static_cast<char>(((pts << 1) & 0xfe) | 1);
+	return h;
+}
+
+std::string stream_ts_h264(unsigned seconds, unsigned gop, unsigned seed, unsigned long &packets) {
+	return stream_mpts_h264(seconds, gop, 1, seed, packets);
+}
+
+std::string stream_mpts_h264(unsigned seconds, unsigned gop, unsigned programs, unsigned seed, unsigned long &packets, int only) {
+	Random rnd(seed);
+	TsWriter ts;
+	ts.out.reserve(static_cast<size_t>(seconds) * FPS * 8 * TS_PACKET_SIZE * (only < 0 ? programs : 1));
+
+	std::string pat("\x00\x01\xc1\x00\x00", 5);
+	std::vector<std::string> pmt(programs);
+	for( unsigned p = 0; p < programs; p++ ) {
+		if( only < 0 || static_cast<unsigned>(only) == p ) {
+			pat += static_cast<char>(0x00);
+			pat += static_cast<char>(p + 1); // Program number
+			pat += static_cast<char>(0xe0 | ((PID_PMT + p) >> 8));
+			pat += static_cast<char>((PID_PMT + p) & 0xff);
+		}
+		unsigned video = PID_VIDEO + 0x10 * p;
+		pmt[p] = std::string("\x00", 1);
+		pmt[p] += static_cast<char>(p + 1);
+		pmt[p] += std::string("\xc1\x00\x00", 3);
+		pmt[p] += static_cast<char>(0xe0 | (video >> 8)); // PCR PID
+		pmt[p] += static_cast<char>(video & 0xff);
+		pmt[p] += std::string("\xf0\x00", 2); // No program info
+		pmt[p] += std::string("\x1b", 1); // H.264
+		pmt[p] += static_cast<char>(0xe0 | (video >> 8));
+		pmt[p] += static_cast<char>(video & 0xff);
+		pmt[p] += std::string("\xf0\x00\x0f", 3); // AAC
+		pmt[p] += static_cast<char>(0xe0 | ((video + 1) >> 8));
+		pmt[p] += static_cast<char>((video + 1) & 0xff);
+		pmt[p] += std::string("\xf0\x00", 2);
+	}
+
+	for( unsigned long f = 0; f < static_cast<unsigned long>(seconds) * FPS; f++ ) {
+		long long pcr = f * (90000 / FPS) + 1000;
+		long long pts = pcr + 9000;
+		if( f % FPS == 0 ) {
+			ts.section(0, 0x00, pat);
+			for( unsigned p = 0; p < programs; p++ ) {
+				if( only < 0 || static_cast<unsigned>(only) == p ) ts.section(PID_PMT + p, 0x02, pmt[p]);
+			}
+		}
+
+		for( unsigned p = 0; p < programs; p++ ) {
+			bool write = only < 0 || static_cast<unsigned>(only) == p;
+			unsigned video_pid = PID_VIDEO + 0x10 * p;
+			std::string video = pes_header(0xe0, pts);
+			video += std::string("\x00\x00\x00\x01\x09\xf0", 6); // AUD
+			if( (f + p) % gop == 0 ) { // Programs don't cut at the same time
+				video += std::string("\x00\x00\x00\x01\x67", 5); // SPS
+				rnd.fill(video, 10);
+				video += std::string("\x00\x00\x00\x01\x68\xce", 6); // PPS
+				video += std::string("\x00\x00\x01\x65", 4); // IDR slice
+			} else {
+				video += std::string("\x00\x00\x00\x01\x41", 5); // Non-IDR slice
+			}
+			rnd.fill(video, rnd.range(300, 2000));
+			if( write ) ts.pes(video_pid, video, pcr);
+
+			if( f % 2 == 0 ) {
+				std::string audio = pes_header(0xc0, pts);
+				rnd.fill(audio, 300);
+				if( write ) ts.pes(video_pid + 1, audio);
+			}
+		}
+		if( only < 0 ) ts.packet(PID_NULL, std::string(184, static_cast<char>(0xff)), false);
+	}
+	packets = ts.packets;
+	return ts.out;
+}
+
+std::string stream_adts(unsigned seconds, unsigned seed, unsigned long &frames) {
+	Random rnd(seed);
+	std::string out;
+	frames = static_cast<unsigned long>(seconds) * 44100 / 1024;
+	out.reserve(frames * 400);
+	for( unsigned long f = 0; f < frames; f++ ) {
+		size_t length = rnd.range(200, 400); // Header included
+		out += static_cast<char>(0xff);
+		out += static_cast<char>(0xf1); // MPEG-4, no CRC
+		out += static_cast<char>((1 << 6) | (4 << 2)); // AAC-LC, 44.1 kHz
+		out += static_cast<char>((2 << 6) | (length >> 11)); // Stereo
+		out += static_cast<char>((length >> 3) & 0xff);
+		out += static_cast<char>(((length & 0x07) << 5) | 0x1f);
+		out += static_cast<char>(0xfc); // One raw data block
+		rnd.fill(out, length - 7);
+	}
+	return out;
+}
+
+std::string stream_mp3(unsigned seconds, unsigned seed, unsigned long &frames) {
+	Random rnd(seed);
+	std::string out;
+	frames = static_cast<unsigned long>(seconds) * 44100 / 1152;
+	out.reserve(frames * 418);
+	unsigned long rest = 0;
+	for( unsigned long f = 0; f < frames; f++ ) {
+		// 144 * 128000 / 44100 bytes per frame; pad to keep the average right
+		rest += 144 * 128000 % 44100;
+		bool padding = rest >= 44100;
+		if( padding ) rest -= 44100;
+		size_t length = 144 * 128000 / 44100 + padding;
+		out += static_cast<char>(0xff);
+		out += static_cast<char>(0xfb); // MPEG-1 Layer III, no CRC
+		out += static_cast<char>(0x90 | (padding << 1)); // 128 kbit/s, 44.1 kHz
+		out += static_cast<char>(0x44); // Joint stereo
+		rnd.fill(out, length - 4);
+	}
+	return out;
+}
+
+// vim: set ts=4 sw=4:
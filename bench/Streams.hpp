@@ -0,0 +1,31 @@
+#ifndef __BENCH_STREAMS_H__
+#define __BENCH_STREAMS_H__
+
+#include <string>
+
+/* Synthetic input streams, just valid enough for the segmenters
+ *
+ * They're deterministic for a given seed, so runs can be compared. The
+ * last argument returns the number of TS packets or audio frames made.
+ */
+
+std::string stream_ts_h264(unsigned seconds, unsigned gop, unsigned seed, unsigned long &packets);
+/* 25 fps H.264 video plus an audio PID. A PAT and PMT every second, a PCR
+ * in the first packet of every picture, an SPS + IDR every `gop` pictures
+ * and a null packet after each picture
+ */
+
+std::string stream_mpts_h264(unsigned seconds, unsigned gop, unsigned programs, unsigned seed, unsigned long &packets, int only = -1);
+/* Like stream_ts_h264(), with `programs` programs numbered from 1, on PIDs
+ * 0x10 apart, taking turns picture by picture. With only >= 0: what
+ * demultiplexing program number only+1 out of that should give
+ */
+
+std::string stream_adts(unsigned seconds, unsigned seed, unsigned long &frames);
+/* AAC-LC, 44.1 kHz stereo, frames of random length */
+
+std::string stream_mp3(unsigned seconds, unsigned seed, unsigned long &frames);
+/* MPEG-1 Layer III, 128 kbit/s at 44.1 kHz, with a padded frame now and then */
+
+#endif
+// vim: set ts=4 sw=4:
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../src/Segmenter/SyncWord.hpp"
+#include "../src/Segmenter/Cpu.hpp"
+
+/* Measures how fast the ADTS/MPEG audio syncword scanners skip over
+ * corrupted input: random bytes without a syncword, one at the very end
+ */
+
+#define SIZE (64*1024*1024)
+#define ROUNDS 10
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void bench(const char *name, size_t (*scan)(const char*, size_t, unsigned char), const char *buf, size_t len) {
+	size_t found = 0;
+	double start = now();
+	for( int i = 0; i < ROUNDS; i++ ) {
+		found += scan(buf, len, SYNCWORD_MASK_ADTS);
+	}
+	double elapsed = now() - start;
+	if( found != ROUNDS * (len - 2) ) {
+		std::cerr << name << ": found syncword at the wrong offset\n";
+		exit(1);
+	}
+	std::cout << "syncword_scan " << name << " "
+	          << (static_cast<double>(len) * ROUNDS / elapsed / 1e9) << " GB/s\n";
+}
+
+int main(int argc, char *argv[]) {
+	char *buf = static_cast<char*>(malloc(SIZE));
+	srand(1);
+	for( size_t i = 0; i < SIZE; i++ ) {
+		buf[i] = rand();
+		if( i > 0 && static_cast<unsigned char>(buf[i-1]) == 0xff ) buf[i] &= 0x7f; // No syncword
+	}
+	buf[SIZE-2] = 0xff;
+	buf[SIZE-1] = 0xf1;
+
+	bench("scalar", Segmenter::syncword_scan_scalar, buf, SIZE);
+	bench("sse2", Segmenter::syncword_scan_sse2, buf, SIZE);
+	if( Segmenter::cpu_has_avx2() ) {
+		bench("avx2", Segmenter::syncword_scan_avx2, buf, SIZE);
+	}
+
+	free(buf);
+	return 0;
+}
+
+/* vim: set ts=4 sw=4: */
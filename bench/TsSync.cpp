@@ -0,0 +1,63 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../src/Segmenter/TsSync.hpp"
+#include "../src/Segmenter/Cpu.hpp"
+
+/* Measures how fast the TS sync scanners skip over corrupted input:
+ * random bytes (so about 1 in 256 is a false sync candidate),
+ * with a valid run of packets at the very end
+ */
+
+#define SIZE (64*1024*1024)
+#define ROUNDS 10
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void bench(const char *name, size_t (*scan)(const char*, size_t, unsigned), const char *buf, size_t len) {
+	size_t found = 0;
+	double start = now();
+	for( int i = 0; i < ROUNDS; i++ ) {
+		found += scan(buf, len, TS_SYNC_PACKETS);
+	}
+	double elapsed = now() - start;
+	if( found != ROUNDS * (len - TS_SYNC_PACKETS*188) ) {
+		std::cerr << name << ": found sync at the wrong offset\n";
+		exit(1);
+	}
+	std::cout << "ts_sync_scan " << name << " "
+	          << (static_cast<double>(len) * ROUNDS / elapsed / 1e9) << " GB/s\n";
+}
+
+int main(int argc, char *argv[]) {
+	char *buf = static_cast<char*>(malloc(SIZE));
+	srand(1);
+	for( size_t i = 0; i < SIZE; i++ ) buf[i] = rand();
+
+	// Make sure the random data never matches, then append a valid run
+	size_t start = SIZE - TS_SYNC_PACKETS*188;
+	for( size_t i = 0; i < start; i += 188 ) {
+		for( size_t j = i; j < i+188 && j < start; j++ ) {
+			if( buf[j] == 0x47 && j + 188 < start && buf[j+188] == 0x47 ) buf[j+188] = 0x46;
+		}
+	}
+	memset(buf + start, 0, SIZE - start);
+	for( size_t i = start; i < SIZE; i += 188 ) buf[i] = 0x47;
+
+	bench("scalar", Segmenter::ts_sync_scan_scalar, buf, SIZE);
+	bench("sse2", Segmenter::ts_sync_scan_sse2, buf, SIZE);
+	if( Segmenter::cpu_has_avx2() ) {
+		bench("avx2", Segmenter::ts_sync_scan_avx2, buf, SIZE);
+	}
+
+	free(buf);
+	return 0;
+}
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,15 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <time.h>
+
+static inline unsigned long long monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* For measuring how long things take; not the time of day
+ */
+
+#endif
+// vim: set ts=4 sw=4:
@@ -1,37 +1,114 @@
 #include "Crypto.hpp"
+#include "../Clock.hpp"
 #include <iostream>
 #include <stdexcept>
+#include <string.h>
 
-CryptoProxyBuffer::CryptoProxyBuffer( std::ostream& output, Crypto *module ) :
+void Crypto::encryptBlocks(const char *in, char *out, size_t length) {
+	for( size_t i = 0; i < length; i += blockSize() ) {
+		encrypt(in + i, out + i);
+	}
+}
+
+CryptoProxyBuffer::CryptoProxyBuffer( std::ostream& output, Crypto *module, size_t buffer_size ) :
 	m_output( output ),
 	m_module( module ),
-	m_nbuf( 0 ) {
-	m_buf = new char[ m_module->blockSize() ];
+	m_block( module->blockSize() ),
+	m_encrypt_ns( NULL ),
+	m_live( NULL ) {
+	m_size = buffer_size - buffer_size % m_block;
+	if( m_size < m_block ) m_size = m_block;
+	m_buf = new char[ m_size ];
+	m_crypt_buf = new char[ m_size ];
+	setp(m_buf, m_buf + m_size);
 }
 
 CryptoProxyBuffer::~CryptoProxyBuffer() {
-	delete m_buf;
+	delete[] m_buf;
+	delete[] m_crypt_buf;
 }
 
-int CryptoProxyBuffer::overflow(int c) {
-	m_buf[ m_nbuf++ ] = static_cast<char>(c);
-
-	if( m_nbuf == m_module->blockSize() ) {
-		m_nbuf = 0;
-		char *crypt_buf = new char[ m_module->blockSize() ];
-		m_module->encrypt(m_buf, crypt_buf);
-		m_output.write(crypt_buf, m_module->blockSize() );
+void CryptoProxyBuffer::encrypt(const char *in, size_t length) {
+	if( m_encrypt_ns || m_live ) {
+		unsigned long long start = monotonic_ns();
+		m_module->encryptBlocks(in, m_crypt_buf, length);
+		unsigned long long ns = monotonic_ns() - start;
+		if( m_encrypt_ns ) *m_encrypt_ns += ns;
+		if( m_live ) {
+			Monitor::bump(&m_live->encrypt_bytes, length);
+			Monitor::bump(&m_live->encrypt_ns, ns);
+		}
+	} else {
+		m_module->encryptBlocks(in, m_crypt_buf, length);
 	}
+	m_output.write(m_crypt_buf, length);
+}
+
+void CryptoProxyBuffer::flushBlocks() {
+	size_t pending = pptr() - pbase();
+	size_t whole = pending - pending % m_block;
+	encrypt(m_buf, whole);
 
+	// Keep the partial block
+	memmove(m_buf, m_buf + whole, pending - whole);
+	setp(m_buf, m_buf + m_size);
+	pbump(pending - whole);
+}
+
+int CryptoProxyBuffer::overflow(int c) {
+	flushBlocks();
+	if( ! std::char_traits<char>::eq_int_type(c, std::char_traits<char>::eof()) ) {
+		*pptr() = static_cast<char>(c);
+		pbump(1);
+	}
 	return std::char_traits<char>::not_eof(c);
 }
 
+std::streamsize CryptoProxyBuffer::xsputn(const char *s, std::streamsize n) {
+	std::streamsize done = 0;
+	while( done < n ) {
+		size_t left = n - done;
+		size_t pending = pptr() - pbase();
+
+		if( left >= m_size ) { // Large write
+			if( pending == 0 ) {
+				// Encrypt straight from the caller's buffer
+				encrypt(s + done, m_size);
+				done += m_size;
+			} else {
+				// Complete the partial block, so we can go direct from here on
+				size_t chunk = (m_block - pending % m_block) % m_block;
+				memcpy(pptr(), s + done, chunk);
+				pbump(chunk);
+				done += chunk;
+				flushBlocks();
+			}
+			continue;
+		}
+
+		size_t room = epptr() - pptr();
+		if( room == 0 ) {
+			flushBlocks();
+			continue;
+		}
+		size_t chunk = left < room ? left : room;
+		memcpy(pptr(), s + done, chunk);
+		pbump(chunk);
+		done += chunk;
+	}
+	return done;
+}
+
 int CryptoProxyBuffer::sync() {
+	flushBlocks();
+
 	// add PKCS7 padding
-	unsigned char pad = m_module->blockSize() - m_nbuf;
-	for( unsigned char i = 0; i < pad; i++ ) {
-		overflow(pad);
-	}
+	size_t pending = pptr() - pbase();
+	unsigned char pad = m_block - pending;
+	memset(pptr(), pad, pad);
+	encrypt(m_buf, m_block);
+	setp(m_buf, m_buf + m_size);
+
 	m_output << std::flush;
 	return 0;
 }
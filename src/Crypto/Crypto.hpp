@@ -3,6 +3,7 @@
 
 #include <ostream>
 #include <sstream>
+#include "../Monitor.hpp"
 
 class Crypto {
 protected:
@@ -13,22 +14,45 @@ public:
 	virtual std::string method() = 0; // Method value
 	virtual void encrypt(const char *in, char *out) = 0; // encrypts 1 block from in to out
 	virtual void decrypt(const char *in, char *out) = 0;
+	virtual void encryptBlocks(const char *in, char *out, size_t length);
+	/* encrypts length bytes (a multiple of blockSize()) from in to out
+	 * Override this if the module can do better than 1 block at a time
+	 */
 };
 
 class CryptoProxyBuffer : public std::basic_streambuf<char, std::char_traits<char> > {
 public:
-	CryptoProxyBuffer( std::ostream& output, Crypto *module );
+	CryptoProxyBuffer( std::ostream& output, Crypto *module, size_t buffer_size = 64*1024 );
+	/* Collects up to buffer_size bytes before encrypting them in one go
+	 */
 	~CryptoProxyBuffer();
 
+	void countTime(unsigned long long *ns) { m_encrypt_ns = ns; }
+	/* Add the time spent encrypting to *ns; NULL stops that */
+	void monitor(Monitor::Counters *live) { m_live = live; }
+	/* Add what's encrypted, and how long that took, to live's counters */
+
 protected:
 	virtual int overflow(int c);
+	virtual std::streamsize xsputn(const char *s, std::streamsize n);
 	virtual int sync();
 
 private:
 	std::ostream& m_output;
 	Crypto *m_module;
-	char *m_buf;
-	unsigned long m_nbuf;
+	unsigned long m_block;
+	size_t m_size;
+	char *m_buf; // plaintext, used as the put area
+	char *m_crypt_buf; // ciphertext, reused for every write
+	unsigned long long *m_encrypt_ns;
+	Monitor::Counters *m_live;
+
+	void encrypt(const char *in, size_t length);
+	/* Encrypts and writes out length bytes (whole blocks)
+	 */
+	void flushBlocks();
+	/* Encrypts and writes out all whole blocks in the put area
+	 */
 };
 
 class CryptoProxy : public std::basic_ostream<char, std::char_traits<char> > {
@@ -39,6 +63,9 @@ public:
 		std::basic_ostream<char, std::char_traits<char> >( &m_buf ),
 		m_buf( output, module )
 		{}
+
+	void countTime(unsigned long long *ns) { m_buf.countTime(ns); }
+	void monitor(Monitor::Counters *live) { m_buf.monitor(live); }
 };
 
 #endif
@@ -4,6 +4,7 @@
 CryptoAes128cbc::CryptoAes128cbc(char key[16], char iv[16]) {
 	memcpy(m_iv, iv, 16);
 	AES_set_encrypt_key( reinterpret_cast<unsigned char*>(key), 16*8, &m_key);
+	AES_set_decrypt_key( reinterpret_cast<unsigned char*>(key), 16*8, &m_dec_key);
 }
 
 CryptoAes128cbc::~CryptoAes128cbc() {
@@ -18,11 +19,20 @@ void CryptoAes128cbc::encrypt(const char *in, char *out) {
 	                 AES_ENCRYPT);
 }
 
+void CryptoAes128cbc::encryptBlocks(const char *in, char *out, size_t length) {
+	AES_cbc_encrypt( reinterpret_cast<const unsigned char*>(in),
+	                 reinterpret_cast<unsigned char*>(out),
+	                 length,
+	                 &m_key,
+	                 m_iv,
+	                 AES_ENCRYPT);
+}
+
 void CryptoAes128cbc::decrypt(const char *in, char *out) {
 	AES_cbc_encrypt( reinterpret_cast<const unsigned char*>(in),
 	                 reinterpret_cast<unsigned char*>(out),
 	                 this->blockSize(),
-	                 &m_key,
+	                 &m_dec_key,
 	                 m_iv,
 	                 AES_DECRYPT);
 }
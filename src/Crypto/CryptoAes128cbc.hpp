@@ -6,7 +6,7 @@
 
 class CryptoAes128cbc: public Crypto {
 	unsigned char m_iv[16];
-	AES_KEY m_key;
+	AES_KEY m_key, m_dec_key;
 public:
 	CryptoAes128cbc(char key[16], char iv[16]);
 	virtual ~CryptoAes128cbc();
@@ -14,6 +14,7 @@ public:
 	virtual std::string method() { return "AES-128"; }
 	virtual void encrypt(const char *in, char *out); // encrypts 1 block from in to out
 	virtual void decrypt(const char *in, char *out);
+	virtual void encryptBlocks(const char *in, char *out, size_t length);
 };
 
 #endif
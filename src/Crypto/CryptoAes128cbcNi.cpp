@@ -0,0 +1,113 @@
+#include "CryptoAes128cbcNi.hpp"
+#include <stdexcept>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <wmmintrin.h>
+
+#define AESNI __attribute__((target("aes,sse2")))
+
+AESNI static inline __m128i expand_step(__m128i key, __m128i keygened) {
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3,3,3,3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+#define EXPAND(k, rcon) expand_step(k, _mm_aeskeygenassist_si128(k, rcon))
+
+AESNI static void expand_key(const char *key, unsigned char enc[11][16], unsigned char dec[11][16]) {
+	__m128i k[11];
+	k[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+	k[1] = EXPAND(k[0], 0x01);
+	k[2] = EXPAND(k[1], 0x02);
+	k[3] = EXPAND(k[2], 0x04);
+	k[4] = EXPAND(k[3], 0x08);
+	k[5] = EXPAND(k[4], 0x10);
+	k[6] = EXPAND(k[5], 0x20);
+	k[7] = EXPAND(k[6], 0x40);
+	k[8] = EXPAND(k[7], 0x80);
+	k[9] = EXPAND(k[8], 0x1b);
+	k[10] = EXPAND(k[9], 0x36);
+
+	for( int i = 0; i < 11; i++ ) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(enc[i]), k[i]);
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dec[0]), k[10]);
+	for( int i = 1; i < 10; i++ ) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dec[i]), _mm_aesimc_si128(k[10-i]));
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dec[10]), k[0]);
+}
+
+AESNI static void cbc_encrypt(const unsigned char key[11][16], unsigned char iv[16],
+                              const char *in, char *out, size_t length) {
+	__m128i k[11];
+	for( int i = 0; i < 11; i++ ) k[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key[i]));
+
+	__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+	for( size_t pos = 0; pos < length; pos += 16 ) {
+		b = _mm_xor_si128(b, _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos)));
+		b = _mm_xor_si128(b, k[0]);
+		for( int r = 1; r < 10; r++ ) b = _mm_aesenc_si128(b, k[r]);
+		b = _mm_aesenclast_si128(b, k[10]);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + pos), b);
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(iv), b);
+}
+
+AESNI static void cbc_decrypt(const unsigned char key[11][16], unsigned char iv[16],
+                              const char *in, char *out) {
+	__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+	__m128i b = _mm_xor_si128(c, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key[0])));
+	for( int r = 1; r < 10; r++ ) {
+		b = _mm_aesdec_si128(b, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key[r])));
+	}
+	b = _mm_aesdeclast_si128(b, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key[10])));
+	b = _mm_xor_si128(b, _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), b);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(iv), c);
+}
+
+bool CryptoAes128cbcNi::supported() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("aes");
+}
+
+#else // x86
+
+static void expand_key(const char *key, unsigned char enc[11][16], unsigned char dec[11][16]) {
+	throw std::logic_error("AES-NI is not available on this platform");
+}
+static void cbc_encrypt(const unsigned char key[11][16], unsigned char iv[16],
+                        const char *in, char *out, size_t length) {}
+static void cbc_decrypt(const unsigned char key[11][16], unsigned char iv[16],
+                        const char *in, char *out) {}
+
+bool CryptoAes128cbcNi::supported() {
+	return false;
+}
+
+#endif // x86
+
+CryptoAes128cbcNi::CryptoAes128cbcNi(char key[16], char iv[16]) {
+	memcpy(m_iv, iv, 16);
+	expand_key(key, m_enc_key, m_dec_key);
+}
+
+CryptoAes128cbcNi::~CryptoAes128cbcNi() {
+}
+
+void CryptoAes128cbcNi::encrypt(const char *in, char *out) {
+	cbc_encrypt(m_enc_key, m_iv, in, out, 16);
+}
+
+void CryptoAes128cbcNi::encryptBlocks(const char *in, char *out, size_t length) {
+	cbc_encrypt(m_enc_key, m_iv, in, out, length);
+}
+
+void CryptoAes128cbcNi::decrypt(const char *in, char *out) {
+	cbc_decrypt(m_dec_key, m_iv, in, out);
+}
@@ -0,0 +1,25 @@
+#ifndef __CRYPTAES128CBCNI_H__
+#define __CRYPTAES128CBCNI_H__
+
+#include "Crypto.hpp"
+
+/* AES-128-CBC using the AES-NI instructions
+ * Only construct this if supported() says the CPU has them
+ */
+class CryptoAes128cbcNi: public Crypto {
+protected:
+	unsigned char m_iv[16];
+	unsigned char m_enc_key[11][16]; // Round keys
+	unsigned char m_dec_key[11][16]; // Round keys for the equivalent inverse cipher
+public:
+	CryptoAes128cbcNi(char key[16], char iv[16]);
+	virtual ~CryptoAes128cbcNi();
+	static bool supported();
+	virtual unsigned long blockSize() { return 16; } // Block size in bytes
+	virtual std::string method() { return "AES-128"; }
+	virtual void encrypt(const char *in, char *out); // encrypts 1 block from in to out
+	virtual void decrypt(const char *in, char *out);
+	virtual void encryptBlocks(const char *in, char *out, size_t length);
+};
+
+#endif
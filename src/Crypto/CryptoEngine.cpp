@@ -0,0 +1,34 @@
+#include "CryptoEngine.hpp"
+#include "CryptoAes128cbc.hpp"
+#include "CryptoAes128cbcNi.hpp"
+#include "CryptoMultiBuffer.hpp"
+#include <stdexcept>
+
+Crypto *newCryptoAes128cbc(const std::string &engine, char key[16], char iv[16]) {
+	if( engine == "openssl" ) return new CryptoAes128cbc(key, iv);
+	if( engine == "aesni" ) {
+		if( ! CryptoAes128cbcNi::supported() ) {
+			throw std::invalid_argument("This CPU doesn't support AES-NI");
+		}
+		return new CryptoAes128cbcNi(key, iv);
+	}
+	if( engine == "aesni-mb" ) {
+		if( ! CryptoAes128cbcNi::supported() ) {
+			throw std::invalid_argument("This CPU doesn't support AES-NI");
+		}
+		return new CryptoAes128cbcMb(key, iv);
+	}
+	if( engine == "auto" ) {
+		static const bool aesni = CryptoAes128cbcNi::supported();
+		if( aesni ) return new CryptoAes128cbcNi(key, iv);
+		return new CryptoAes128cbc(key, iv);
+	}
+	throw std::invalid_argument("Unknown crypto engine \"" + engine + "\"");
+}
+
+bool validCryptoEngine(const std::string &engine) {
+	return engine == "auto" || engine == "openssl"
+	    || ((engine == "aesni" || engine == "aesni-mb") && CryptoAes128cbcNi::supported());
+}
+
+// vim: set ts=4 sw=4:
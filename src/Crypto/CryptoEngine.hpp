@@ -0,0 +1,21 @@
+#ifndef __CRYPTOENGINE_H__
+#define __CRYPTOENGINE_H__
+
+#include "Crypto.hpp"
+#include <string>
+
+Crypto *newCryptoAes128cbc(const std::string &engine, char key[16], char iv[16]);
+/* Creates an AES-128-CBC module
+ * engine is one of:
+ *   "auto"     AES-NI if the CPU has it, OpenSSL otherwise
+ *   "aesni"    AES-NI; throws std::invalid_argument if the CPU lacks it
+ *   "aesni-mb" AES-NI, with the bulk work of all modules interleaved on
+ *              the process-wide CryptoMultiBuffer. Only pays off when
+ *              several threads encrypt at the same time
+ *   "openssl"  OpenSSL's portable implementation
+ */
+
+bool validCryptoEngine(const std::string &engine);
+
+#endif
+// vim: set ts=4 sw=4:
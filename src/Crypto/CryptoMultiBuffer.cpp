@@ -0,0 +1,164 @@
+#include "CryptoMultiBuffer.hpp"
+
+CryptoMultiBuffer::CryptoMultiBuffer() :
+	m_head(NULL),
+	m_tail(NULL) {
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_done, NULL);
+}
+
+CryptoMultiBuffer::~CryptoMultiBuffer() {
+	pthread_cond_destroy(&m_done);
+	pthread_mutex_destroy(&m_lock);
+}
+
+CryptoMultiBuffer &CryptoMultiBuffer::shared() {
+	static CryptoMultiBuffer engine;
+	return engine;
+}
+
+void CryptoMultiBuffer::run(Job *job) {
+	job->done = false;
+	job->queued = true;
+	job->next = NULL;
+	pthread_mutex_lock(&m_lock);
+	if( m_tail ) m_tail->next = job;
+	else m_head = job;
+	m_tail = job;
+
+	while( ! job->done ) {
+		if( ! job->queued ) { // Another thread is encrypting it
+			pthread_cond_wait(&m_done, &m_lock);
+			continue;
+		}
+
+		// Take the oldest jobs, up to CRYPTO_MB_LANES. Ours is among them
+		// unless more were queued before it; they all get taken before it
+		// by some thread, so it is never passed over
+		Job *lanes[CRYPTO_MB_LANES];
+		unsigned n = 0;
+		while( m_head != NULL && n < CRYPTO_MB_LANES ) {
+			m_head->queued = false;
+			lanes[n++] = m_head;
+			m_head = m_head->next;
+		}
+		if( m_head == NULL ) m_tail = NULL;
+		pthread_mutex_unlock(&m_lock);
+
+		encryptLanes(lanes, n);
+
+		pthread_mutex_lock(&m_lock);
+		for( unsigned i = 0; i < n; i++ ) lanes[i]->done = true;
+		pthread_cond_broadcast(&m_done);
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <wmmintrin.h>
+
+template<unsigned N>
+__attribute__((target("aes,sse2"), always_inline))
+static inline void encrypt_steps(CryptoMultiBuffer::Job *lane[], __m128i state[], const size_t pos[], size_t steps) {
+	// N is a constant, so the lanes stay in registers
+	__m128i s[N];
+	for( unsigned l = 0; l < N; l++ ) s[l] = state[l];
+
+	for( size_t i = 0; i < steps; i += 16 ) {
+#pragma GCC unroll 8
+		for( unsigned l = 0; l < N; l++ ) {
+			__m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane[l]->in + pos[l] + i));
+			__m128i k0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane[l]->key[0]));
+			s[l] = _mm_xor_si128(_mm_xor_si128(s[l], in), k0);
+		}
+#pragma GCC unroll 9
+		for( int r = 1; r < 10; r++ ) {
+			// Independent lanes: these aesenc's don't wait on each other
+#pragma GCC unroll 8
+			for( unsigned l = 0; l < N; l++ ) {
+				s[l] = _mm_aesenc_si128(s[l], _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane[l]->key[r])));
+			}
+		}
+#pragma GCC unroll 8
+		for( unsigned l = 0; l < N; l++ ) {
+			s[l] = _mm_aesenclast_si128(s[l], _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane[l]->key[10])));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lane[l]->out + pos[l] + i), s[l]);
+		}
+	}
+
+	for( unsigned l = 0; l < N; l++ ) state[l] = s[l];
+}
+
+__attribute__((target("aes,sse2")))
+void CryptoMultiBuffer::encryptLanes(Job *jobs[], unsigned n) {
+	Job *lane[CRYPTO_MB_MAX_LANES];
+	__m128i state[CRYPTO_MB_MAX_LANES];
+	size_t pos[CRYPTO_MB_MAX_LANES];
+	for( unsigned l = 0; l < n; l++ ) {
+		lane[l] = jobs[l];
+		state[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(jobs[l]->iv));
+		pos[l] = 0;
+	}
+
+	while( n > 0 ) {
+		// Run all lanes in lock-step for as long as the shortest one lasts
+		size_t steps = lane[0]->length - pos[0];
+		for( unsigned l = 1; l < n; l++ ) {
+			if( lane[l]->length - pos[l] < steps ) steps = lane[l]->length - pos[l];
+		}
+
+		switch( n ) {
+		case 1: encrypt_steps<1>(lane, state, pos, steps); break;
+		case 2: encrypt_steps<2>(lane, state, pos, steps); break;
+		case 3: encrypt_steps<3>(lane, state, pos, steps); break;
+		case 4: encrypt_steps<4>(lane, state, pos, steps); break;
+		case 5: encrypt_steps<5>(lane, state, pos, steps); break;
+		case 6: encrypt_steps<6>(lane, state, pos, steps); break;
+		case 7: encrypt_steps<7>(lane, state, pos, steps); break;
+		default: encrypt_steps<8>(lane, state, pos, steps); break;
+		}
+
+		// Retire the lanes that are done
+		unsigned kept = 0;
+		for( unsigned l = 0; l < n; l++ ) {
+			pos[l] += steps;
+			if( pos[l] == lane[l]->length ) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(lane[l]->iv), state[l]);
+			} else {
+				lane[kept] = lane[l];
+				state[kept] = state[l];
+				pos[kept] = pos[l];
+				kept++;
+			}
+		}
+		n = kept;
+	}
+}
+
+#else // x86
+
+#include <stdexcept>
+
+void CryptoMultiBuffer::encryptLanes(Job *jobs[], unsigned n) {
+	throw std::logic_error("AES-NI is not available on this platform");
+}
+
+#endif // x86
+
+CryptoAes128cbcMb::CryptoAes128cbcMb(char key[16], char iv[16], CryptoMultiBuffer &engine) :
+	CryptoAes128cbcNi(key, iv),
+	m_engine(engine) {
+}
+
+void CryptoAes128cbcMb::encryptBlocks(const char *in, char *out, size_t length) {
+	CryptoMultiBuffer::Job job;
+	job.key = m_enc_key;
+	job.iv = m_iv;
+	job.in = in;
+	job.out = out;
+	job.length = length;
+	m_engine.run(&job);
+}
+
+// vim: set ts=4 sw=4:
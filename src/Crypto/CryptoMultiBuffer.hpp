@@ -0,0 +1,68 @@
+#ifndef __CRYPTOMULTIBUFFER_H__
+#define __CRYPTOMULTIBUFFER_H__
+
+#include "CryptoAes128cbcNi.hpp"
+#include <pthread.h>
+
+#define CRYPTO_MB_MAX_LANES 8 // What encryptLanes() can interleave
+#define CRYPTO_MB_LANES 4 // What run() batches; 8 lanes are slower than 4 in bench/Crypto
+
+/* Encrypts several independent AES-128-CBC streams at once
+ *
+ * CBC is serial within a stream: every block has to wait for the previous
+ * one to leave the AES pipeline. Interleaving a few streams (each with its
+ * own key and IV) keeps the pipeline full.
+ *
+ * Threads hand their work to run(), which queues it in order. A thread
+ * whose job is still queued takes the oldest CRYPTO_MB_LANES jobs and
+ * encrypts them in one interleaved pass, on behalf of their threads; it
+ * goes on until its own job is done. Several threads can be doing this
+ * at once, on different jobs, so the engine scales over cores; jobs only
+ * get batched when they queue up faster than that.
+ */
+class CryptoMultiBuffer {
+public:
+	struct Job {
+		const unsigned char (*key)[16]; // 11 round keys
+		unsigned char *iv; // updated when done
+		const char *in;
+		char *out;
+		size_t length; // multiple of 16
+		bool queued; // Not taken by any thread yet
+		bool done;
+		Job *next;
+	};
+
+	CryptoMultiBuffer();
+	~CryptoMultiBuffer();
+
+	void run(Job *job);
+	/* Encrypts job, possibly together with jobs of other threads
+	 * Returns when job is done
+	 */
+
+	static void encryptLanes(Job *jobs[], unsigned n);
+	/* Encrypts n (up to CRYPTO_MB_MAX_LANES) jobs interleaved, right now
+	 */
+
+	static CryptoMultiBuffer &shared();
+	/* One engine for the whole process
+	 */
+
+private:
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_done;
+	Job *m_head, *m_tail; // Oldest and newest queued job
+};
+
+/* AES-128-CBC module that does its bulk work on a (shared) CryptoMultiBuffer
+ */
+class CryptoAes128cbcMb: public CryptoAes128cbcNi {
+	CryptoMultiBuffer &m_engine;
+public:
+	CryptoAes128cbcMb(char key[16], char iv[16], CryptoMultiBuffer &engine = CryptoMultiBuffer::shared());
+	virtual void encryptBlocks(const char *in, char *out, size_t length);
+};
+
+#endif
+// vim: set ts=4 sw=4:
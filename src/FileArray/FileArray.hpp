@@ -1,6 +1,8 @@
 #ifndef __FILEARRAY_HPP__
 #define __FILEARRAY_HPP__
 
+#include <string>
+
 namespace FileArray {
 
 class FileArray {
@@ -8,6 +10,8 @@ protected:
 	FileArray() {}
 
 public:
+	virtual ~FileArray() {}
+
 	virtual void init(std::string pattern, char wildcard) =0;
 	virtual std::string Filename(unsigned long seq) =0;
 };
@@ -22,9 +22,10 @@ void Timestamp::init(std::string pattern, char wildcard) {
 
 std::string Timestamp::Filename(unsigned long seq) {
 	time_t now_secs = time(NULL);
-	struct tm *now = localtime( &now_secs );
+	struct tm now;
+	localtime_r( &now_secs, &now );
 	char date[22]; // enouch to fit 2^64
-	int length = strftime(date, sizeof(date), "%s", now);
+	int length = strftime(date, sizeof(date), "%s", &now);
 	std::string timestamp(date, length);
 
 	std::string ret = m_prefix;
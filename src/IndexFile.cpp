@@ -1,4 +1,5 @@
 #include "IndexFile.hpp"
+#include <sstream>
 
 IndexFile::IndexFile(std::string filename, unsigned long target_duration) :
 	m_filename(filename),
@@ -7,7 +8,8 @@ IndexFile::IndexFile(std::string filename, unsigned long target_duration) :
 	m_uri_suffix(""),
 	m_key_prefix(""),
 	m_key_suffix(""),
-	m_sequence(1) {
+	m_sequence(1),
+	m_byterange(false) {
 	m_out.exceptions( std::ifstream::failbit | std::ifstream::badbit );
 }
 
@@ -21,43 +23,65 @@ void IndexFile::End() {
 	m_out.close();
 }
 
-void IndexFile::WriteHeader(unsigned long first_sequence) {
-	m_out << "#EXTM3U\n"
-	      << "#EXT-X-TARGETDURATION:" << m_target_duration << "\n"
-	      << "#EXT-X-MEDIA-SEQUENCE:" << first_sequence << "\n";
-	m_prev_crypto = "#EXT-X-KEY:METHOD=NONE"; // Default
+std::string IndexFile::RenderHeader(unsigned long first_sequence) {
+	std::ostringstream out;
+	out << "#EXTM3U\n";
+	if( m_byterange ) out << "#EXT-X-VERSION:4\n";
+	out << "#EXT-X-TARGETDURATION:" << m_target_duration << "\n"
+	    << "#EXT-X-MEDIA-SEQUENCE:" << first_sequence << "\n";
+	return out.str();
 }
 
-void IndexFile::WriteSegment(struct segment &seg) {
+std::string IndexFile::RenderKey(const struct segment &seg) {
 	std::string crypto = "#EXT-X-KEY:METHOD=" + seg.crypto_method;
 	if( seg.key_uri != "") crypto += ",URI=\"" 
 		+ m_key_prefix + seg.key_uri + m_key_suffix + "\"";
+	return crypto + "\n";
+}
+
+std::string IndexFile::RenderSegment(const struct segment &seg) {
+	std::ostringstream out;
+	out << "#EXT-X-PROGRAM-DATE-TIME:" << seg.timestamp << "\n"
+	    << "#EXTINF:" << seg.duration << ",\n";
+	if( m_byterange ) {
+		out << "#EXT-X-BYTERANGE:" << seg.byterange_length << "@" << seg.byterange_offset << "\n";
+	}
+	out << m_uri_prefix << seg.uri << m_uri_suffix << "\n";
+	return out.str();
+}
 
+void IndexFile::WriteHeader(unsigned long first_sequence) {
+	m_out << RenderHeader(first_sequence);
+	m_prev_crypto = "#EXT-X-KEY:METHOD=NONE\n"; // Default
+}
+
+void IndexFile::WriteSegment(struct segment &seg) {
+	std::string crypto = RenderKey(seg);
 	if( crypto != m_prev_crypto ) {
 		m_prev_crypto = crypto;
-		m_out << crypto << "\n";
+		m_out << crypto;
 	}
 
-	m_out << "#EXT-X-PROGRAM-DATE-TIME:" << seg.timestamp << "\n"
-	      << "#EXTINF:" << seg.duration << ",\n" 
-	      << m_uri_prefix << seg.uri << m_uri_suffix << "\n";
+	m_out << RenderSegment(seg);
 }
 
 void IndexFile::WriteEnd() {
 	m_out << "#EXT-X-ENDLIST\n";
 }
 
-void IndexFile::AddSegment(unsigned long duration, std::string uri, std::string crypto_method, std::string key_uri) {
+void IndexFile::AddSegment(unsigned long duration, std::string uri, std::string crypto_method, std::string key_uri,
+                           unsigned long long byterange_offset, unsigned long long byterange_length) {
 	m_sequence++;
 
 	time_t now_secs = time(NULL);
-	struct tm *now = localtime( &now_secs );
+	struct tm now;
+	localtime_r( &now_secs, &now ); // Renditions add segments from several threads
 	
 	char date[25];
-	int length = strftime(date, sizeof(date), "%Y%m%dT%H%M%S%z", now);
+	int length = strftime(date, sizeof(date), "%Y%m%dT%H%M%S%z", &now);
 	std::string timestamp(date, length);
 
-	struct segment s = { duration, uri, crypto_method, key_uri, timestamp };
+	struct segment s = { duration, uri, crypto_method, key_uri, timestamp, byterange_offset, byterange_length };
 	WriteSegment(s);
 	m_out.flush();
 }
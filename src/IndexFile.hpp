@@ -11,15 +11,26 @@ protected:
 	std::string m_uri_prefix, m_uri_suffix;
 	std::string m_key_prefix, m_key_suffix;
 	unsigned long m_sequence;
+	bool m_byterange;
 	struct segment {
 		unsigned long duration;
 		std::string uri;
 		std::string crypto_method;
 		std::string key_uri;
 		std::string timestamp;
+		unsigned long long byterange_offset;
+		unsigned long long byterange_length;
 	};
 	std::string m_prev_crypto;
 
+	std::string RenderHeader(unsigned long first_sequence = 1);
+	std::string RenderKey(const struct segment &seg);
+	/* The EXT-X-KEY line that applies to seg, including newline
+	 */
+	std::string RenderSegment(const struct segment &seg);
+	/* The lines of seg, without the EXT-X-KEY line
+	 */
+
 	void WriteHeader(unsigned long first_sequence = 1);
 	void WriteSegment(struct segment &seg);
 	void WriteEnd();
@@ -46,11 +57,19 @@ public:
 	void setKeySuffix(std::string suffix) { m_key_suffix = suffix; }
 	std::string KeySuffix() { return m_key_suffix; }
 	
+	void setByteRange(bool byterange) { m_byterange = byterange; }
+	bool ByteRange() { return m_byterange; }
+	/* Segments are byte ranges of a file; needs protocol version 4 */
+
 	unsigned long Sequence() { return m_sequence; }
 	/* Starts at 1 */
 
 	virtual void Begin(); /* Openes file and writes header */
-	virtual void AddSegment(unsigned long duration, std::string uri, std::string crypto_method = "NONE", std::string key_uri = "");
+	virtual void AddSegment(unsigned long duration, std::string uri, std::string crypto_method = "NONE", std::string key_uri = "",
+	                        unsigned long long byterange_offset = 0, unsigned long long byterange_length = 0);
+	/* In ByteRange() mode, the segment is byterange_length bytes
+	 * of uri, starting at byterange_offset
+	 */
 	virtual void End(); /* Writes END tag and closes file */
 };
 
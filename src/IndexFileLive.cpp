@@ -1,49 +1,149 @@
 #include "IndexFileLive.hpp"
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <vector>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 IndexFileLive::IndexFileLive(std::string filename, unsigned long target_duration, unsigned long num_segments, bool unlink) :
 	IndexFile(filename, target_duration),
 	m_num_segments(num_segments),
-	m_unlink(unlink) {
+	m_unlink(unlink),
+	m_ring(NULL),
+	m_writing(false),
+	m_rewrite(false) {
 	m_temp_filename = filename + ".tmp";
+	m_written.index = this;
 }
 
 void IndexFileLive::Begin() {
 	/* Empty */
 }
 
-void IndexFileLive::AddSegment(unsigned long duration, std::string uri, std::string crypto_method, std::string key_uri) {
+void IndexFileLive::AddSegment(unsigned long duration, std::string uri, std::string crypto_method, std::string key_uri,
+                               unsigned long long byterange_offset, unsigned long long byterange_length) {
+	if( ! m_ring_error.empty() ) throw std::ios_base::failure(m_ring_error);
 	m_sequence++;
 	time_t now_secs = time(NULL);
-	struct tm *now = localtime( &now_secs );
+	struct tm now;
+	localtime_r( &now_secs, &now );
 	
 	char date[25];
-	int length = strftime(date, sizeof(date), "%Y%m%dT%H%M%S%z", now);
+	int length = strftime(date, sizeof(date), "%Y%m%dT%H%M%S%z", &now);
 	std::string timestamp(date, length);
 
-	struct segment s = { duration, uri, crypto_method, key_uri, timestamp };
+	struct segment s = { duration, uri, crypto_method, key_uri, timestamp, byterange_offset, byterange_length };
+
+	struct entry e;
+	e.uri = uri;
+	e.key = RenderKey(s);
+	e.key_changed = m_window.empty() || e.key != m_window.back().key;
+	e.lines = RenderSegment(s);
+	m_window.push_back(e);
+
+	while( m_window.size() > m_num_segments ) {
+		if( m_unlink && ! m_byterange ) { // Byte ranges share their file
+			if( m_ring ) {
+				m_ring->removeFile( m_window.front().uri );
+			} else {
+				unlink( m_window.front().uri.c_str() );
+			}
+		}
+		m_window.pop_front();
+	}
+
+	WritePlaylist();
+}
+
+void IndexFileLive::WritePlaylist() {
+	std::string header = RenderHeader(m_sequence - m_window.size());
+	static const std::string no_key = "#EXT-X-KEY:METHOD=NONE\n"; // Default
 
-	m_segments.push_back(s);
-	while( m_segments.size() > m_num_segments ) {
-		if( m_unlink ) {
-			unlink( m_segments.begin()->uri.c_str() );
+	std::vector<struct iovec> iov;
+	iov.reserve(1 + 2 * m_window.size());
+	struct iovec v;
+	v.iov_base = const_cast<char*>(header.data());
+	v.iov_len = header.size();
+	iov.push_back(v);
+	for( typeof(m_window.begin()) i = m_window.begin(); i != m_window.end(); i++ ) {
+		bool key = ( i == m_window.begin() ) ? i->key != no_key : i->key_changed;
+		if( key ) {
+			v.iov_base = const_cast<char*>(i->key.data());
+			v.iov_len = i->key.size();
+			iov.push_back(v);
 		}
-		m_segments.pop_front();
+		v.iov_base = const_cast<char*>(i->lines.data());
+		v.iov_len = i->lines.size();
+		iov.push_back(v);
 	}
 
-	m_out.open( m_temp_filename.c_str() );
+	if( m_ring ) {
+		std::string playlist;
+		for( size_t i = 0; i < iov.size(); i++ ) playlist.append(static_cast<char*>(iov[i].iov_base), iov[i].iov_len);
+		if( m_writing ) {
+			m_next.swap(playlist);
+			m_rewrite = true;
+		} else {
+			m_writing = true;
+			m_ring->writeFile(m_temp_filename, playlist, m_filename, &m_written);
+		}
+		return;
+	}
 
-	WriteHeader(m_sequence - m_segments.size());
-	for( typeof(m_segments.begin()) i = m_segments.begin(); i != m_segments.end(); i++ ) {
-		WriteSegment(*i);
+	int fd = open(m_temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if( fd == -1 ) {
+		throw std::ios_base::failure("Could not open temporary Index file");
+	}
+	size_t done = 0;
+	while( done < iov.size() ) {
+		int count = iov.size() - done < IOV_MAX ? iov.size() - done : IOV_MAX;
+		ssize_t written = writev(fd, &iov[done], count);
+		if( written < 0 ) {
+			close(fd);
+			throw std::ios_base::failure("Could not write Index file");
+		}
+		// Skip what was written; a short write leaves us halfway an iovec
+		while( done < iov.size() && static_cast<size_t>(written) >= iov[done].iov_len ) {
+			written -= iov[done].iov_len;
+			done++;
+		}
+		if( written > 0 ) {
+			iov[done].iov_base = static_cast<char*>(iov[done].iov_base) + written;
+			iov[done].iov_len -= written;
+		}
+	}
+	if( close(fd) ) {
+		throw std::ios_base::failure("Could not write Index file");
 	}
 
-	m_out.close();
 	if( rename(m_temp_filename.c_str(), m_filename.c_str() ) ) {
 		throw std::ios_base::failure("Could not rename Index file");
 	}
 }
 
+void IndexFileLive::PlaylistWritten(int result) {
+	m_writing = false;
+	if( result < 0 && m_ring_error.empty() ) {
+		m_ring_error = std::string("Could not write Index file: ") + strerror(-result);
+	}
+	if( m_rewrite ) {
+		m_rewrite = false;
+		m_writing = true;
+		m_ring->writeFile(m_temp_filename, m_next, m_filename, &m_written);
+	}
+}
+
 void IndexFileLive::End() {
+	if( m_ring ) {
+		while( m_writing ) m_ring->reap(1000);
+		if( ! m_ring_error.empty() ) throw std::ios_base::failure(m_ring_error);
+	}
 	m_out.open(m_filename.c_str(), std::ios_base::app | std::ios_base::out);
 
 	IndexFile::End();
@@ -2,22 +2,59 @@
 #define __INDEXFILELIVE_H__
 
 #include "IndexFile.hpp"
-#include <list>
+#include "Uring.hpp"
+#include <deque>
 
 class IndexFileLive: public IndexFile {
 protected:
 	unsigned long m_num_segments;
 	bool m_unlink;
-	std::list<struct segment> m_segments;
+	struct entry {
+		std::string uri;
+		std::string key; // Rendered EXT-X-KEY line
+		bool key_changed; // key differs from the one of the previous segment
+		std::string lines; // All other rendered lines
+	};
+	std::deque<struct entry> m_window;
+	/* Every segment is rendered once, when it's added. Writing the playlist
+	 * only gathers these strings, without copying them
+	 */
 	std::string m_temp_filename;
 
+	void WritePlaylist();
+	/* Writes the window to the temp file with writev(), and renames it in place
+	 */
+
+	Uring *m_ring;
+	class Written : public Uring::Op {
+	public:
+		IndexFileLive *index;
+		virtual void done(int result) { index->PlaylistWritten(result); }
+	} m_written;
+	bool m_writing; // A playlist update is on the ring
+	bool m_rewrite; // and m_next has to follow it
+	std::string m_next;
+	std::string m_ring_error;
+	void PlaylistWritten(int result);
+	/* On the ring, one update is written at a time; the ones that come in
+	 * meanwhile only replace m_next. A reader never sees a stale playlist
+	 * for longer than one write
+	 */
+
 public:
 	IndexFileLive(std::string filename, unsigned long target_duration, unsigned long num_segments, bool unlink = false);
 	//virtual ~IndexFileLive() {}
 
 	virtual void Begin();
-	virtual void AddSegment(unsigned long duration, std::string uri, std::string crypto_method = "NONE", std::string key_uri = "");
+	virtual void AddSegment(unsigned long duration, std::string uri, std::string crypto_method = "NONE", std::string key_uri = "",
+	                        unsigned long long byterange_offset = 0, unsigned long long byterange_length = 0);
 	virtual void End();
+
+	void setUring(Uring *ring) { m_ring = ring; }
+	/* Write the playlist and unlink old segments through ring, without
+	 * waiting for them. Only for the thread that reaps ring; errors show up
+	 * on a later call. NULL goes back to plain system calls
+	 */
 };
 
 #endif
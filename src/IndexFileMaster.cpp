@@ -0,0 +1,56 @@
+#include "IndexFileMaster.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+
+IndexFileMaster::IndexFileMaster(std::string filename) :
+	m_filename(filename),
+	m_pending(0) {
+}
+
+unsigned long IndexFileMaster::AddVariant(std::string uri) {
+	struct variant v = { uri, 0, false };
+	m_variants.push_back(v);
+	m_pending++;
+	return m_variants.size() - 1;
+}
+
+void IndexFileMaster::Report(unsigned long variant, unsigned long bandwidth) {
+	struct variant &v = m_variants.at(variant);
+	unsigned long peak = __atomic_load_n(&v.bandwidth, __ATOMIC_RELAXED);
+	while( bandwidth > peak &&
+	       ! __atomic_compare_exchange_n(&v.bandwidth, &peak, bandwidth, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+		/* peak is reloaded */
+	}
+
+	if( ! __atomic_exchange_n(&v.reported, true, __ATOMIC_ACQ_REL) ) {
+		// Whoever reports last writes the first version
+		if( __atomic_sub_fetch(&m_pending, 1, __ATOMIC_ACQ_REL) == 0 ) Write();
+	}
+}
+
+void IndexFileMaster::End() {
+	Write();
+}
+
+void IndexFileMaster::Write() {
+	std::ostringstream out;
+	out << "#EXTM3U\n";
+	for( typeof(m_variants.begin()) i = m_variants.begin(); i != m_variants.end(); i++ ) {
+		unsigned long bandwidth = __atomic_load_n(&i->bandwidth, __ATOMIC_RELAXED);
+		out << "#EXT-X-STREAM-INF:PROGRAM-ID=1,BANDWIDTH=" << bandwidth << "\n"
+		    << i->uri << "\n";
+	}
+
+	std::string temp_filename = m_filename + ".tmp";
+	std::ofstream file;
+	file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+	file.open(temp_filename.c_str());
+	file << out.str();
+	file.close();
+	if( rename(temp_filename.c_str(), m_filename.c_str()) ) {
+		throw std::ios_base::failure("Could not rename master Index file");
+	}
+}
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,43 @@
+#ifndef __INDEXFILEMASTER_H__
+#define __INDEXFILEMASTER_H__
+
+#include <string>
+#include <vector>
+
+/* Master playlist, listing the index file of every rendition
+ *
+ * Renditions report their peak bitrate from their own threads; this is done
+ * with atomics, not a lock. The playlist is written as soon as every
+ * rendition has reported once, and again (with the final peaks) by End().
+ */
+class IndexFileMaster {
+protected:
+	std::string m_filename;
+	struct variant {
+		std::string uri;
+		unsigned long bandwidth; // Peak, in bits per second
+		bool reported;
+	};
+	std::vector<struct variant> m_variants;
+	unsigned long m_pending; // Variants that have not reported yet
+
+	void Write();
+
+public:
+	IndexFileMaster(std::string filename);
+
+	std::string Filename() { return m_filename; }
+
+	unsigned long AddVariant(std::string uri);
+	/* Call for every rendition before any of them reports
+	 * Returns the number to report under
+	 */
+
+	void Report(unsigned long variant, unsigned long bandwidth);
+	/* Thread-safe; bandwidth is the peak bitrate seen so far */
+
+	void End();
+};
+
+#endif
+// vim: set ts=4 sw=4:
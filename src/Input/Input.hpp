@@ -0,0 +1,65 @@
+#ifndef __INPUT_HPP__
+#define __INPUT_HPP__
+
+#include <stddef.h>
+#include "../Clock.hpp"
+
+namespace Input {
+
+/* abstract */ class Input {
+protected:
+	const char *m_cur, *m_end;
+	/* [m_cur, m_end) is the data that is buffered, but not yet consumed
+	 */
+	unsigned long long m_offset;
+	/* Offset of m_cur in the stream
+	 */
+	unsigned long long m_stall_ns;
+
+	Input() : m_cur(NULL), m_end(NULL), m_offset(0), m_stall_ns(0) {}
+
+	virtual bool refill(size_t want) = 0;
+	/* Make at least `want` bytes available starting at m_cur.
+	 * May move the buffered data around, invalidating every pointer
+	 * previously returned by data().
+	 * Returns false if the stream ended before `want` bytes were available;
+	 * whatever is left is still available.
+	 */
+
+public:
+	virtual ~Input() {}
+
+	const char *data() const { return m_cur; }
+	size_t available() const { return m_end - m_cur; }
+	unsigned long long offset() const { return m_offset; }
+
+	virtual bool complete() const { return false; }
+	/* Is all of the stream available already? refill() won't add anything
+	 */
+
+	bool fill(size_t want) {
+		if( available() >= want ) return true;
+		unsigned long long start = monotonic_ns();
+		bool more = refill(want);
+		m_stall_ns += monotonic_ns() - start;
+		return more;
+	}
+	/* Make sure at least `want` bytes are available at data()
+	 * Returns false on end of stream
+	 */
+
+	unsigned long long stall_ns() const { return m_stall_ns; }
+	/* Total time spent waiting for data in fill() */
+
+	void consume(size_t n) {
+		m_cur += n;
+		m_offset += n;
+	}
+	/* Mark n bytes as used. Their memory stays valid until the next fill()
+	 */
+};
+
+} // namespace
+
+#endif // __INPUT_HPP__
+/* vim: set ts=4 sw=4: */
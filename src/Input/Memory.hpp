@@ -0,0 +1,32 @@
+#ifndef __INPUT_MEMORY_HPP__
+#define __INPUT_MEMORY_HPP__
+
+#include "Input.hpp"
+
+namespace Input {
+
+class Memory : public Input {
+protected:
+	virtual bool refill(size_t want) { return false; }
+
+public:
+	Memory(const char *begin, const char *end, unsigned long long offset = 0) {
+		m_cur = begin;
+		m_end = end;
+		m_offset = offset;
+	}
+	/* Reads [begin, end), which must stay valid; offset is the offset of
+	 * begin in the stream
+	 */
+
+	virtual bool complete() const { return true; }
+
+	bool fill(size_t want) const { return available() >= want; }
+	/* Hides Input::fill(), so loops over a Memory don't call refill()
+	 */
+};
+
+} // namespace
+
+#endif // __INPUT_MEMORY_HPP__
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,53 @@
+#include "Mmap.hpp"
+#include <ios>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace Input {
+
+Mmap::Mmap(const std::string &filename) :
+	m_map(NULL),
+	m_size(0) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if( fd == -1 ) {
+		throw std::ios_base::failure("Could not open \"" + filename + "\": " + strerror(errno));
+	}
+
+	struct stat st;
+	if( fstat(fd, &st) == -1 ) {
+		int err = errno;
+		close(fd);
+		throw std::ios_base::failure("Could not stat \"" + filename + "\": " + strerror(err));
+	}
+	m_size = st.st_size;
+
+	if( m_size > 0 ) { // Can't map an empty file
+		m_map = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if( m_map == MAP_FAILED ) {
+			int err = errno;
+			close(fd);
+			throw std::ios_base::failure("Could not mmap \"" + filename + "\": " + strerror(err));
+		}
+		madvise(m_map, m_size, MADV_SEQUENTIAL); // Only a hint; failure is harmless
+	}
+	close(fd); // The mapping stays valid
+
+	m_cur = static_cast<const char*>(m_map);
+	m_end = m_cur + m_size;
+}
+
+Mmap::~Mmap() {
+	if( m_map != NULL ) munmap(m_map, m_size);
+}
+
+bool Mmap::refill(size_t want) {
+	return false; // Everything is mapped already
+}
+
+} // namespace
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,29 @@
+#ifndef __INPUT_MMAP_HPP__
+#define __INPUT_MMAP_HPP__
+
+#include "Input.hpp"
+#include <string>
+
+namespace Input {
+
+class Mmap : public Input {
+protected:
+	void *m_map;
+	size_t m_size;
+
+	virtual bool refill(size_t want);
+
+public:
+	Mmap(const std::string &filename);
+	/* Maps the complete (regular) file `filename` read-only
+	 * Throws std::ios_base::failure if the file can't be opened or mapped
+	 */
+	virtual ~Mmap();
+
+	virtual bool complete() const { return true; }
+};
+
+} // namespace
+
+#endif // __INPUT_MMAP_HPP__
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,102 @@
+#include "Push.hpp"
+#include <string.h>
+
+namespace Input {
+
+Push::Push() :
+	m_span(NULL),
+	m_span_end(NULL),
+	m_waiting(false),
+	m_ended(false),
+	m_closed(false) {
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_moved, NULL);
+}
+
+Push::~Push() {
+	pthread_cond_destroy(&m_moved);
+	pthread_mutex_destroy(&m_lock);
+}
+
+bool Push::refill(size_t want) {
+	size_t left = available();
+
+	// Whatever is left has to come along, in one piece with what follows.
+	// It may be in the caller's span, which is about to go away
+	if( m_carry.size() < want ) { // m_cur may point into m_carry
+		std::vector<char> bigger(want);
+		if( left ) memcpy(&bigger[0], m_cur, left);
+		m_carry.swap(bigger);
+	} else if( left ) {
+		memmove(&m_carry[0], m_cur, left);
+	}
+	m_cur = &m_carry[0];
+	m_end = m_cur + left;
+
+	pthread_mutex_lock(&m_lock);
+	while( 1 ) {
+		if( m_span != m_span_end ) {
+			if( left == 0 && static_cast<size_t>(m_span_end - m_span) >= want ) {
+				// Read the span itself
+				m_cur = m_span;
+				m_end = m_span_end;
+				m_span = m_span_end = NULL;
+				break;
+			}
+			// Piece together no more than asked for, then back to the span
+			size_t take = want - left;
+			if( take > static_cast<size_t>(m_span_end - m_span) ) take = m_span_end - m_span;
+			memcpy(&m_carry[left], m_span, take);
+			m_span += take;
+			left += take;
+			m_end = m_cur + left;
+			if( left >= want ) break;
+			continue;
+		}
+		if( m_ended ) break;
+
+		m_waiting = true;
+		pthread_cond_broadcast(&m_moved); // feed() can return
+		while( m_span == m_span_end && ! m_ended ) pthread_cond_wait(&m_moved, &m_lock);
+		m_waiting = false;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return available() >= want;
+}
+
+bool Push::feed(const char *data, size_t length) {
+	pthread_mutex_lock(&m_lock);
+	if( length == 0 ) {
+		bool open = ! m_closed;
+		pthread_mutex_unlock(&m_lock);
+		return open;
+	}
+	m_span = data;
+	m_span_end = data + length;
+	pthread_cond_broadcast(&m_moved);
+	// Done once the reader asks for more, with nothing of ours left
+	while( ! m_closed && ! ( m_waiting && m_span == m_span_end ) ) pthread_cond_wait(&m_moved, &m_lock);
+	bool open = ! m_closed;
+	m_span = m_span_end = NULL;
+	pthread_mutex_unlock(&m_lock);
+	return open;
+}
+
+void Push::end() {
+	pthread_mutex_lock(&m_lock);
+	m_ended = true;
+	pthread_cond_broadcast(&m_moved);
+	pthread_mutex_unlock(&m_lock);
+}
+
+void Push::close() {
+	pthread_mutex_lock(&m_lock);
+	m_closed = true;
+	pthread_cond_broadcast(&m_moved);
+	pthread_mutex_unlock(&m_lock);
+}
+
+} // namespace
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,48 @@
+#ifndef __INPUT_PUSH_HPP__
+#define __INPUT_PUSH_HPP__
+
+#include "Input.hpp"
+#include <vector>
+#include <pthread.h>
+
+namespace Input {
+
+/* Input that someone else pushes spans of data into, from another thread
+ *
+ * The reader gets the spans themselves, not copies: feed() waits until the
+ * reader is done with its span. Only what the reader needs in one piece
+ * across the end of a span (a packet, a frame header) is copied, into a
+ * buffer of our own, and the reader goes back to the next span right after.
+ */
+class Push : public Input {
+protected:
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_moved;
+	const char *m_span, *m_span_end; // Fed, but not yet handed to the reader
+	bool m_waiting; // The reader is in refill(), done with every span it got
+	bool m_ended; // No more spans will come
+	bool m_closed; // The reader is gone
+	std::vector<char> m_carry;
+
+	virtual bool refill(size_t want);
+
+public:
+	Push();
+	virtual ~Push();
+
+	bool feed(const char *data, size_t length);
+	/* Hands [data, data+length) to the reader, and waits until it's done
+	 * with it. Returns false if the reader closed
+	 */
+	void end();
+	/* Marks the end of the stream: the reader sees it after the last span */
+
+	void close();
+	/* Called by the reader when it stops reading, to release feed()
+	 */
+};
+
+} // namespace
+
+#endif // __INPUT_PUSH_HPP__
+/* vim: set ts=4 sw=4: */
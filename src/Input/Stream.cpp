@@ -0,0 +1,59 @@
+#include "Stream.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+namespace Input {
+
+Stream::Stream(std::istream &in, size_t block) :
+	m_in(in),
+	m_size(block),
+	m_eof(false) {
+	if( (m_buf = static_cast<char*>(malloc(m_size))) == NULL )
+		throw std::bad_alloc();
+	m_cur = m_end = m_buf;
+}
+
+Stream::~Stream() {
+	free(m_buf);
+}
+
+bool Stream::refill(size_t want) {
+	size_t left = available();
+
+	if( want > m_size ) {
+		char *tmp = static_cast<char*>(realloc(m_buf, want));
+		if( tmp == NULL ) throw std::bad_alloc();
+		m_cur = tmp + (m_cur - m_buf);
+		m_buf = tmp;
+		m_size = want;
+	}
+
+	// Move the unconsumed tail to the front; usually less than a packet
+	memmove(m_buf, m_cur, left);
+	m_cur = m_buf;
+	m_end = m_buf + left;
+
+	if( m_eof ) return false;
+
+	try {
+		// Block until we have what was asked for...
+		if( left < want ) {
+			m_in.read(m_buf + left, want - left);
+			m_end += m_in.gcount();
+		}
+		// ...and take whatever else is already waiting, without blocking
+		m_end += m_in.readsome(const_cast<char*>(m_end), m_buf + m_size - m_end);
+	} catch( std::ios_base::failure &e ) {
+		// We handle EOF ourself; throw the rest
+		if( ! m_in.eof() ) throw;
+		m_end += m_in.gcount();
+		m_eof = true;
+	}
+
+	return available() >= want;
+}
+
+} // namespace
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,28 @@
+#ifndef __INPUT_STREAM_HPP__
+#define __INPUT_STREAM_HPP__
+
+#include "Input.hpp"
+#include <istream>
+
+namespace Input {
+
+class Stream : public Input {
+protected:
+	std::istream &m_in;
+	char *m_buf;
+	size_t m_size;
+	bool m_eof;
+
+	virtual bool refill(size_t want);
+
+public:
+	Stream(std::istream &in, size_t block = 1024*1024);
+	/* Reads `in` in blocks of (up to) `block` bytes
+	 */
+	virtual ~Stream();
+};
+
+} // namespace
+
+#endif // __INPUT_STREAM_HPP__
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,117 @@
+#include "KeyStore.hpp"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <sched.h>
+#include <openssl/evp.h>
+
+#define KEYSTORE_SPINS 100 // Yields before sleeping, while someone else writes a key file
+
+KeyStore::KeyStore(FileArray::FileArray &filenames, unsigned long period, Random::Random &rnd) :
+	m_filenames(filenames),
+	m_period(period > 0 ? period : 1) {
+	rnd.Bytes(reinterpret_cast<char*>(m_master), 16);
+	memset(m_slot, 0, sizeof(m_slot));
+	pthread_mutex_init(&m_wait_lock, NULL);
+	pthread_cond_init(&m_slot_changed, NULL);
+}
+
+KeyStore::~KeyStore() {
+	memset(m_master, 0, sizeof(m_master));
+	pthread_cond_destroy(&m_slot_changed);
+	pthread_mutex_destroy(&m_wait_lock);
+}
+
+void KeyStore::Derive(unsigned long sequence, char key[16]) const {
+	unsigned long long period = (sequence - 1) / m_period;
+
+	unsigned char block[16];
+	memset(block, 0, sizeof(block));
+	for(unsigned char i=0; i < 8; i++ ) block[15-i] = period >> (8*i);
+
+	// One block of AES-128-ECB. A context of its own, as renditions derive keys concurrently
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int length = 0;
+	bool ok = ctx != NULL
+	       && EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, m_master, NULL) == 1
+	       && EVP_CIPHER_CTX_set_padding(ctx, 0) == 1
+	       && EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char*>(key), &length, block, 16) == 1
+	       && length == 16;
+	EVP_CIPHER_CTX_free(ctx);
+	if( ! ok ) throw std::runtime_error("Can't derive the key of a period");
+}
+
+bool KeyStore::Claim(unsigned long sequence, char key[16], std::string &filename) {
+	unsigned long long period = (sequence - 1) / m_period;
+	Derive(sequence, key);
+
+	filename = m_filenames.Filename( period * m_period + 1 );
+
+	unsigned long long *slot = &m_slot[period % KEYSTORE_SLOTS];
+	unsigned long long writing = 2*period + 1, written = 2*period + 2;
+	unsigned long long cur = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	unsigned spins = 0;
+	while( cur < written ) {
+		/* Anyone asking for this period has asked for all previous ones,
+		 * so the slot is either free (holds an older period) or this one
+		 */
+		if( cur != writing ) {
+			if( ! __atomic_compare_exchange_n(slot, &cur, writing, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+				continue; // Someone else got it; cur is reloaded
+			}
+			std::ostringstream msg;
+			msg << "New crypto file \"" << filename << "\"\n";
+			std::cerr << msg.str();
+			return true;
+		}
+		if( ++spins < KEYSTORE_SPINS ) {
+			sched_yield(); // Usually just a 16 byte write
+		} else {
+			pthread_mutex_lock(&m_wait_lock);
+			while( __atomic_load_n(slot, __ATOMIC_ACQUIRE) == writing ) pthread_cond_wait(&m_slot_changed, &m_wait_lock);
+			pthread_mutex_unlock(&m_wait_lock);
+		}
+		cur = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	}
+	return false;
+}
+
+void KeyStore::release(unsigned long long *slot, unsigned long long value) {
+	__atomic_store_n(slot, value, __ATOMIC_RELEASE);
+	// Under the lock, so a waiter is either before its check or asleep
+	pthread_mutex_lock(&m_wait_lock);
+	pthread_cond_broadcast(&m_slot_changed);
+	pthread_mutex_unlock(&m_wait_lock);
+}
+
+void KeyStore::Written(unsigned long sequence) {
+	unsigned long long period = (sequence - 1) / m_period;
+	release(&m_slot[period % KEYSTORE_SLOTS], 2*period + 2);
+}
+
+void KeyStore::Abandon(unsigned long sequence) {
+	unsigned long long period = (sequence - 1) / m_period;
+	release(&m_slot[period % KEYSTORE_SLOTS], 2*period); // Let the next one try
+}
+
+std::string KeyStore::Key(unsigned long sequence, char key[16]) {
+	std::string filename;
+	if( Claim(sequence, key, filename) ) {
+		try {
+			std::ofstream key_file;
+			key_file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+			key_file.open( filename.c_str() );
+			key_file.write(key, 16);
+			key_file.close();
+		} catch( ... ) {
+			Abandon(sequence);
+			throw;
+		}
+		Written(sequence);
+	}
+	return filename;
+}
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,63 @@
+#ifndef __KEYSTORE_H__
+#define __KEYSTORE_H__
+
+#include <string>
+#include <pthread.h>
+#include "FileArray/FileArray.hpp"
+#include "Random/Random.hpp"
+
+#define KEYSTORE_SLOTS 64
+
+/* Hands out the encryption keys, shared by all renditions
+ *
+ * Keys change every `period` segments. Renditions that are segmented in
+ * parallel reach a key change at different moments; they all get the same
+ * key, and its key file is written once, by whichever gets there first.
+ *
+ * There is no lock: a key is derived from a secret master key and the
+ * number of its period, so any thread can compute it on its own. Only
+ * writing the key file needs coordination, which happens per period with
+ * an atomic compare-and-swap on one of KEYSTORE_SLOTS slots. Renditions
+ * that wait for another one to write it spin briefly, then sleep until
+ * it's done, so a slow disk doesn't cost a core per waiting rendition.
+ */
+class KeyStore {
+public:
+	KeyStore(FileArray::FileArray &filenames, unsigned long period, Random::Random &rnd);
+	~KeyStore();
+
+	std::string Key(unsigned long sequence, char key[16]);
+	/* Fills in the key for segment `sequence` (starting at 1) and returns
+	 * the name of its key file, which exists by the time this returns
+	 * Every caller must ask for its segments in order
+	 */
+
+	void Derive(unsigned long sequence, char key[16]) const;
+	/* Only fills in the key; doesn't touch the key file
+	 */
+
+	bool Claim(unsigned long sequence, char key[16], std::string &filename);
+	void Written(unsigned long sequence);
+	void Abandon(unsigned long sequence);
+	/* Key() in parts, for callers that write the key file themselves:
+	 * if Claim() returns true, the caller has to write it and then call
+	 * Written(), or Abandon() if that failed. Others wait in Claim() until then
+	 */
+
+private:
+	FileArray::FileArray &m_filenames;
+	unsigned long m_period;
+	unsigned char m_master[16]; // AES-128 key that the period numbers are encrypted with
+	unsigned long long m_slot[KEYSTORE_SLOTS];
+	/* Slot p % KEYSTORE_SLOTS tracks the key file of period p:
+	 * 2p+1 while it's being written, 2p+2 once it's there
+	 */
+	pthread_mutex_t m_wait_lock;
+	pthread_cond_t m_slot_changed; // Only for sleeping in Claim()
+
+	void release(unsigned long long *slot, unsigned long long value);
+	/* Stores value in slot, and wakes up whoever waits for it */
+};
+
+#endif
+// vim: set ts=4 sw=4:
@@ -0,0 +1,87 @@
+#include "Monitor.hpp"
+#include "Clock.hpp"
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace Monitor {
+
+Monitor::Monitor(const std::string &channel) :
+	m_shm_name( std::string("/") + SHM_PREFIX + channel ),
+	m_region(NULL) {
+	if( channel.empty() || channel.find('/') != std::string::npos || channel.size() >= sizeof(m_region->channel) ) {
+		throw std::runtime_error("Invalid monitor channel name \"" + channel + "\"");
+	}
+
+	int fd = shm_open(m_shm_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if( fd == -1 ) {
+		throw std::runtime_error("Could not create " + m_shm_name + ": " + strerror(errno));
+	}
+	if( ftruncate(fd, sizeof(Region)) != 0 ) {
+		int err = errno;
+		close(fd);
+		shm_unlink(m_shm_name.c_str());
+		throw std::runtime_error("Could not size " + m_shm_name + ": " + strerror(err));
+	}
+	void *p = mmap(NULL, sizeof(Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if( p == MAP_FAILED ) {
+		shm_unlink(m_shm_name.c_str());
+		throw std::runtime_error("Could not map " + m_shm_name + ": " + strerror(errno));
+	}
+
+	m_region = static_cast<Region*>(p); // Zeroed by ftruncate()
+	m_region->version = VERSION;
+	m_region->pid = getpid();
+	strncpy(m_region->channel, channel.c_str(), sizeof(m_region->channel) - 1);
+	m_region->started_ns = monotonic_ns();
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(m_region->magic, MAGIC, sizeof(MAGIC)); // Readers ignore the region until this is there
+}
+
+Monitor::~Monitor() {
+	munmap(m_region, sizeof(Region));
+	shm_unlink(m_shm_name.c_str());
+}
+
+Counters *Monitor::Add(const std::string &rendition) {
+	uint32_t n = m_region->renditions;
+	if( n >= MAX_RENDITIONS ) throw std::length_error("Too many renditions to monitor");
+	Counters *c = &m_region->rendition[n];
+	strncpy(c->name, rendition.c_str(), sizeof(c->name) - 1);
+	__atomic_store_n(&m_region->renditions, n + 1, __ATOMIC_RELEASE);
+	return c;
+}
+
+const Region *Monitor::Attach(const std::string &path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if( fd == -1 ) return NULL;
+	struct stat st;
+	if( fstat(fd, &st) != 0 || st.st_size != sizeof(Region) ) {
+		close(fd);
+		return NULL;
+	}
+	void *p = mmap(NULL, sizeof(Region), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if( p == MAP_FAILED ) return NULL;
+
+	const Region *region = static_cast<const Region*>(p);
+	if( memcmp(region->magic, MAGIC, sizeof(MAGIC)) != 0 || region->version != VERSION ) {
+		Detach(region);
+		return NULL;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return region;
+}
+
+void Monitor::Detach(const Region *region) {
+	munmap(const_cast<Region*>(region), sizeof(Region));
+}
+
+} // namespace
+
+// vim: set ts=4 sw=4:
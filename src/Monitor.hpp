@@ -0,0 +1,79 @@
+#ifndef __MONITOR_H__
+#define __MONITOR_H__
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Live counters in shared memory, for segtop
+ *
+ * A channel publishes a Region as /dev/shm/segmenter.<channel>, and
+ * removes it again when done. Every counter has exactly one thread writing
+ * it, so a relaxed load and store does; readers may see a counter a moment
+ * late, but never torn. No system call or lock is involved on either side.
+ */
+namespace Monitor {
+
+static const char MAGIC[8] = { 's', 'e', 'g', 'm', 'o', 'n', '\0', '\0' };
+static const uint32_t VERSION = 1;
+static const unsigned MAX_RENDITIONS = 32;
+static const char SHM_PREFIX[] = "segmenter.";
+
+struct Counters {
+	char name[32]; // Rendition name, may be empty
+	unsigned long long bytes_in; // Consumed from the input; by the segmenter
+	unsigned long long resyncs; // by the segmenter
+	unsigned long long segment_start_ns; // monotonic_ns() the current segment started at
+	unsigned long long segments, sequence, bytes_out; // Of finished segments
+	unsigned long long encrypt_bytes, encrypt_ns; // by the encrypting thread
+	unsigned long long crypto_queue, write_queue; // Messages waiting in the pipeline
+	unsigned long long pad[2]; // 128 bytes, so renditions don't share cache lines
+};
+
+struct Region {
+	char magic[8];
+	uint32_t version;
+	uint32_t renditions;
+	int64_t pid;
+	char channel[64];
+	unsigned long long started_ns; // monotonic_ns()
+	unsigned long long pad[4]; // 128 bytes too
+	Counters rendition[MAX_RENDITIONS];
+};
+
+static inline unsigned long long peek(const unsigned long long *counter) {
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+static inline void publish(unsigned long long *counter, unsigned long long value) {
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+static inline void bump(unsigned long long *counter, unsigned long long n) {
+	publish(counter, peek(counter) + n);
+}
+/* Only for the one thread that owns the counter; no locked instructions */
+
+class Monitor {
+public:
+	Monitor(const std::string &channel);
+	/* Creates the region; throws std::runtime_error if that fails */
+	~Monitor();
+	/* Removes it */
+
+	Counters *Add(const std::string &rendition);
+	/* Counters for the next rendition; throws std::length_error after
+	 * MAX_RENDITIONS. Call before starting the renditions
+	 */
+
+	static const Region *Attach(const std::string &path);
+	/* Maps the region in path read-only; NULL if it isn't one */
+	static void Detach(const Region *region);
+
+private:
+	std::string m_shm_name;
+	Region *m_region;
+};
+
+} // namespace
+
+#endif
+// vim: set ts=4 sw=4:
@@ -0,0 +1,138 @@
+#ifndef __PIPELINE_QUEUE_HPP__
+#define __PIPELINE_QUEUE_HPP__
+
+#include <pthread.h>
+#include <sched.h>
+#include "../Clock.hpp"
+
+namespace Pipeline {
+
+struct QueueStats {
+	unsigned long long pushed;
+	unsigned long long max_depth;
+	unsigned long long full; // Times the producer found the queue full
+	unsigned long long stall_ns; // and how long it waited in total
+	unsigned long long idle_ns; // Time the consumer waited for work
+};
+
+/* Bounded queue between exactly one producer and one consumer thread
+ *
+ * Both ends work with atomic loads and stores on their own index; no lock
+ * is taken while there is room, or work. A side that has to wait spins
+ * for a moment, then sleeps on a condition variable until the other side
+ * moves.
+ */
+template <class T>
+class Queue {
+public:
+	Queue(size_t depth) :
+		m_depth(depth > 0 ? depth : 1),
+		m_head(0),
+		m_tail(0),
+		m_sleeping(0) {
+		m_slot = new T[m_depth];
+		pthread_mutex_init(&m_lock, NULL);
+		pthread_cond_init(&m_moved, NULL);
+		QueueStats zero = { 0, 0, 0, 0, 0 };
+		m_stats = zero;
+	}
+
+	~Queue() {
+		pthread_cond_destroy(&m_moved);
+		pthread_mutex_destroy(&m_lock);
+		delete[] m_slot;
+	}
+
+	void push(const T &item) {
+		unsigned long long tail = m_tail;
+		if( tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) >= m_depth ) {
+			unsigned long long start = monotonic_ns();
+			wait(&m_head, tail - m_depth);
+			m_stats.full++;
+			m_stats.stall_ns += monotonic_ns() - start;
+		}
+		m_slot[tail % m_depth] = item;
+		__atomic_store_n(&m_tail, tail + 1, __ATOMIC_SEQ_CST);
+		wake();
+
+		unsigned long long depth = tail + 1 - __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+		if( depth > m_stats.max_depth ) m_stats.max_depth = depth;
+		m_stats.pushed++;
+	}
+	/* Blocks while the queue is full */
+
+	T pop() {
+		unsigned long long head = m_head;
+		if( __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) == head ) {
+			unsigned long long start = monotonic_ns();
+			wait(&m_tail, head);
+			m_stats.idle_ns += monotonic_ns() - start;
+		}
+		T item = m_slot[head % m_depth];
+		__atomic_store_n(&m_head, head + 1, __ATOMIC_SEQ_CST);
+		wake();
+		return item;
+	}
+	/* Blocks while the queue is empty */
+
+	bool try_pop(T &item) {
+		unsigned long long head = m_head;
+		if( __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) == head ) return false;
+		item = m_slot[head % m_depth];
+		__atomic_store_n(&m_head, head + 1, __ATOMIC_SEQ_CST);
+		wake();
+		return true;
+	}
+
+	size_t depth() const { return m_depth; }
+
+	size_t size() const {
+		return __atomic_load_n(&m_tail, __ATOMIC_RELAXED) - __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+	}
+	/* Items waiting; a snapshot, from either side */
+
+	QueueStats stats() const {
+		QueueStats s = m_stats;
+		return s;
+	}
+	/* Producer-side numbers are only exact from the producer's thread,
+	 * and idle_ns from the consumer's; from elsewhere they're estimates
+	 */
+
+private:
+	T *m_slot;
+	size_t m_depth;
+	unsigned long long m_head __attribute__((aligned(64))); // Written by the consumer only
+	unsigned long long m_tail __attribute__((aligned(64))); // Written by the producer only
+	int m_sleeping __attribute__((aligned(64)));
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_moved;
+	QueueStats m_stats;
+
+	void wait(const unsigned long long *index, unsigned long long stuck) {
+		/* Wait until *index moves past stuck */
+		for( int i = 0; i < 100; i++ ) {
+			if( __atomic_load_n(index, __ATOMIC_ACQUIRE) != stuck ) return;
+			sched_yield();
+		}
+		pthread_mutex_lock(&m_lock);
+		__atomic_add_fetch(&m_sleeping, 1, __ATOMIC_SEQ_CST);
+		while( __atomic_load_n(index, __ATOMIC_SEQ_CST) == stuck ) {
+			pthread_cond_wait(&m_moved, &m_lock);
+		}
+		__atomic_sub_fetch(&m_sleeping, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&m_lock);
+	}
+
+	void wake() {
+		if( __atomic_load_n(&m_sleeping, __ATOMIC_SEQ_CST) == 0 ) return;
+		pthread_mutex_lock(&m_lock);
+		pthread_cond_broadcast(&m_moved);
+		pthread_mutex_unlock(&m_lock);
+	}
+};
+
+} // namespace
+
+#endif // __PIPELINE_QUEUE_HPP__
+/* vim: set ts=4 sw=4: */
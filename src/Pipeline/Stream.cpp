@@ -0,0 +1,71 @@
+#include "Stream.hpp"
+#include <string.h>
+
+namespace Pipeline {
+
+StreamBuffer::StreamBuffer(Queue<Message> &queue, Queue<char*> &returns, size_t buffer_size) :
+	m_queue(queue),
+	m_returns(returns),
+	m_size(buffer_size),
+	m_buf(NULL) {
+}
+
+StreamBuffer::~StreamBuffer() {
+	for( size_t i = 0; i < m_all.size(); i++ ) delete[] m_all[i];
+}
+
+void StreamBuffer::next() {
+	// Take a buffer the consumer is done with, or make a new one
+	if( ! m_returns.try_pop(m_buf) ) {
+		m_buf = new char[m_size];
+		m_all.push_back(m_buf);
+	}
+	setp(m_buf, m_buf + m_size);
+}
+
+int StreamBuffer::sync() {
+	if( m_buf != NULL && pptr() > pbase() ) {
+		Message m = { Message::DATA, m_buf, static_cast<size_t>(pptr() - pbase()), NULL };
+		m_queue.push(m);
+		m_buf = NULL;
+		setp(NULL, NULL);
+	}
+	return 0;
+}
+
+int StreamBuffer::overflow(int c) {
+	sync();
+	next();
+	if( ! std::char_traits<char>::eq_int_type(c, std::char_traits<char>::eof()) ) {
+		*pptr() = static_cast<char>(c);
+		pbump(1);
+	}
+	return std::char_traits<char>::not_eof(c);
+}
+
+std::streamsize StreamBuffer::xsputn(const char *s, std::streamsize n) {
+	std::streamsize done = 0;
+	while( done < n ) {
+		size_t room = epptr() - pptr();
+		if( room == 0 ) {
+			sync();
+			next();
+			continue;
+		}
+		size_t chunk = static_cast<size_t>(n - done) < room ? n - done : room;
+		memcpy(pptr(), s + done, chunk);
+		pbump(chunk);
+		done += chunk;
+	}
+	return n;
+}
+
+void StreamBuffer::send(Message::Type type, void *tag) {
+	sync();
+	Message m = { type, NULL, 0, tag };
+	m_queue.push(m);
+}
+
+} // namespace
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,68 @@
+#ifndef __PIPELINE_STREAM_HPP__
+#define __PIPELINE_STREAM_HPP__
+
+#include "Queue.hpp"
+#include <ostream>
+#include <vector>
+
+namespace Pipeline {
+
+struct Message {
+	enum Type {
+		DATA, // length bytes at data; hand data back when done with it
+		OPEN, // Start of a segment, described by tag
+		CLOSE, // End of the segment tag
+		END // No more messages
+	} type;
+	char *data;
+	size_t length;
+	void *tag;
+};
+
+/* Output stream that sends what's written to it down a Queue, in DATA
+ * messages of up to `buffer_size` bytes
+ *
+ * The consumer returns the buffers on `returns` when it's done with them;
+ * they're reused from there. At most queue.depth() + 2 buffers are in use,
+ * returns must have room for that many. Control messages go through send(), after
+ * whatever was written before.
+ */
+class StreamBuffer : public std::basic_streambuf<char, std::char_traits<char> > {
+public:
+	StreamBuffer(Queue<Message> &queue, Queue<char*> &returns, size_t buffer_size = 256*1024);
+	~StreamBuffer();
+	/* Only destroy this after the consumer has seen END */
+
+	void send(Message::Type type, void *tag);
+
+protected:
+	virtual int overflow(int c);
+	virtual std::streamsize xsputn(const char *s, std::streamsize n);
+	virtual int sync();
+
+private:
+	Queue<Message> &m_queue;
+	Queue<char*> &m_returns;
+	size_t m_size;
+	char *m_buf;
+	std::vector<char*> m_all; // Every buffer ever handed out, to free them at the end
+
+	void next();
+};
+
+class Stream : public std::basic_ostream<char, std::char_traits<char> > {
+private:
+	StreamBuffer m_buf;
+public:
+	Stream(Queue<Message> &queue, Queue<char*> &returns, size_t buffer_size = 256*1024) :
+		std::basic_ostream<char, std::char_traits<char> >( &m_buf ),
+		m_buf( queue, returns, buffer_size )
+		{}
+
+	void send(Message::Type type, void *tag = NULL) { m_buf.send(type, tag); }
+};
+
+} // namespace
+
+#endif // __PIPELINE_STREAM_HPP__
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,83 @@
+#include "Pool.hpp"
+#include <stdexcept>
+#include <vector>
+
+Pool::Pool(unsigned threads) :
+	m_threads(threads > 0 ? threads : 1),
+	m_remaining(0),
+	m_failed(false) {
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_ready, NULL);
+}
+
+Pool::~Pool() {
+	pthread_cond_destroy(&m_ready);
+	pthread_mutex_destroy(&m_lock);
+}
+
+void Pool::Add(Task *task) {
+	pthread_mutex_lock(&m_lock);
+	m_queue.push_back(task);
+	m_remaining++;
+	pthread_mutex_unlock(&m_lock);
+}
+
+void *Pool::worker(void *pool) {
+	static_cast<Pool*>(pool)->work();
+	return NULL;
+}
+
+void Pool::work() {
+	pthread_mutex_lock(&m_lock);
+	for(;;) {
+		while( m_queue.empty() && m_remaining > 0 && ! m_failed ) {
+			pthread_cond_wait(&m_ready, &m_lock);
+		}
+		if( m_remaining == 0 || m_failed ) break;
+
+		Task *task = m_queue.front();
+		m_queue.pop_front();
+		pthread_mutex_unlock(&m_lock);
+
+		bool more = false;
+		std::string error;
+		try {
+			more = task->Step();
+		} catch( std::exception &e ) {
+			error = e.what();
+			if( error.empty() ) error = "Unknown error";
+		}
+
+		pthread_mutex_lock(&m_lock);
+		if( ! error.empty() ) {
+			if( ! m_failed ) m_error = error;
+			m_failed = true;
+			pthread_cond_broadcast(&m_ready);
+		} else if( more ) {
+			m_queue.push_back(task);
+			pthread_cond_signal(&m_ready);
+		} else if( --m_remaining == 0 ) {
+			pthread_cond_broadcast(&m_ready);
+		}
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+void Pool::Run() {
+	unsigned threads = m_threads < m_remaining ? m_threads : m_remaining;
+	std::vector<pthread_t> thread(threads > 1 ? threads - 1 : 0);
+	for( size_t i = 0; i < thread.size(); i++ ) {
+		if( pthread_create(&thread[i], NULL, worker, this) ) {
+			thread.resize(i); // Make do with what we have
+			break;
+		}
+	}
+	work(); // The calling thread is a worker as well
+	for( size_t i = 0; i < thread.size(); i++ ) {
+		pthread_join(thread[i], NULL);
+	}
+
+	if( m_failed ) throw std::runtime_error(m_error);
+}
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,52 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+
+/* Runs a set of tasks on a fixed number of threads
+ *
+ * A task is done in steps. A thread takes the task at the head of the queue,
+ * does one step and puts it back at the tail, so every task gets its turn
+ * regardless of how many threads there are. A task is never stepped by two
+ * threads at the same time.
+ */
+class Pool {
+public:
+	class Task {
+	public:
+		virtual ~Task() {}
+		virtual bool Step() = 0;
+		/* Does the next piece of work
+		 * Returns false when the task is finished
+		 */
+	};
+
+	Pool(unsigned threads);
+	~Pool();
+
+	void Add(Task *task);
+	/* Queue task; call before Run() */
+
+	void Run();
+	/* Returns when all tasks are finished
+	 * If a task throws, the remaining tasks are abandoned and a
+	 * std::runtime_error with the same message is thrown here
+	 */
+
+private:
+	unsigned m_threads;
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_ready;
+	std::deque<Task*> m_queue;
+	unsigned long m_remaining; // Tasks that are not finished
+	bool m_failed;
+	std::string m_error;
+
+	static void *worker(void *pool);
+	void work();
+};
+
+#endif
+// vim: set ts=4 sw=4:
@@ -0,0 +1,147 @@
+#include "PushSegmenter.hpp"
+#include "Crypto/CryptoEngine.hpp"
+#include <stdexcept>
+#include <math.h>
+
+class SinkStreamBuffer : public std::basic_streambuf<char, std::char_traits<char> > {
+public:
+	SinkStreamBuffer(PushSegmenter::Sink *sink) : m_sink(sink) {}
+
+protected:
+	virtual int overflow(int c) {
+		if( c == traits_type::eof() ) return traits_type::not_eof(c);
+		char ch = c;
+		m_sink->SegmentData(&ch, 1);
+		return c;
+	}
+	virtual std::streamsize xsputn(const char *s, std::streamsize n) {
+		m_sink->SegmentData(s, n); // The segmenters write straight out of the input
+		return n;
+	}
+
+private:
+	PushSegmenter::Sink *m_sink;
+};
+
+class SinkStream : public std::basic_ostream<char, std::char_traits<char> > {
+private:
+	SinkStreamBuffer m_buf;
+public:
+	SinkStream(PushSegmenter::Sink *sink) :
+		std::basic_ostream<char, std::char_traits<char> >( &m_buf ),
+		m_buf( sink )
+		{}
+};
+/* Unbuffered: hands every write to the sink as is
+ */
+
+PushSegmenter::PushSegmenter(Segmenter::Segmenter *seg, Sink *sink) :
+	m_seg(seg),
+	m_sink(sink),
+	m_index(NULL),
+	m_uris(NULL),
+	m_keys(NULL),
+	m_duration_acc_error(0),
+	m_started(false),
+	m_joined(false),
+	m_failed(false) {
+}
+
+PushSegmenter::~PushSegmenter() {
+	if( m_started && ! m_joined ) {
+		m_in.end();
+		join();
+	}
+	delete m_seg;
+}
+
+void PushSegmenter::setIndex(IndexFile *index, FileArray::FileArray *uris) {
+	m_index = index;
+	m_uris = uris;
+}
+
+void PushSegmenter::setCrypto(KeyStore *keys, std::string engine) {
+	m_keys = keys;
+	m_crypto_engine = engine;
+}
+
+void PushSegmenter::start() {
+	if( m_started ) return;
+	if( pthread_create(&m_thread, NULL, run, this) ) {
+		throw std::runtime_error("Could not start segmenter thread");
+	}
+	m_started = true;
+}
+
+void PushSegmenter::join() {
+	pthread_join(m_thread, NULL);
+	m_joined = true;
+}
+
+void PushSegmenter::Feed(const char *data, size_t length) {
+	start();
+	if( ! m_in.feed(data, length) ) { // The thread stopped
+		if( __atomic_load_n(&m_failed, __ATOMIC_ACQUIRE) ) throw std::runtime_error(m_error);
+		throw std::runtime_error("Segmenting already ended");
+	}
+}
+
+void PushSegmenter::End() {
+	start();
+	m_in.end();
+	if( ! m_joined ) join();
+	if( m_failed ) throw std::runtime_error(m_error);
+}
+
+void *PushSegmenter::run(void *push) {
+	PushSegmenter *p = static_cast<PushSegmenter*>(push);
+	try {
+		p->segment();
+	} catch( std::exception &e ) {
+		p->m_error = e.what();
+		__atomic_store_n(&p->m_failed, true, __ATOMIC_RELEASE);
+	}
+	p->m_in.close();
+	return NULL;
+}
+
+void PushSegmenter::segment() {
+	if( m_index ) m_index->Begin();
+	SinkStream sink(m_sink);
+	for( unsigned long sequence = 1; ; sequence++ ) {
+		m_sink->SegmentStart(sequence);
+
+		std::ostream *out = &sink;
+		Crypto *crypto_module = NULL;
+		std::string crypto_method = "NONE", key_filename;
+		if( m_keys ) {
+			char key[16];
+			key_filename = m_keys->Key(sequence, key);
+			char iv[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+			for(unsigned char i=0; i < 4; i++ ) iv[15-i] = sequence >> (8*i);
+			crypto_module = newCryptoAes128cbc(m_crypto_engine, key, iv);
+			crypto_method = crypto_module->method();
+			out = new CryptoProxy(sink, crypto_module);
+		}
+
+		float duration = m_seg->copy_segment(&m_in, out);
+		if( m_keys ) {
+			*out << std::flush; // Pads the last block
+			delete out;
+			delete crypto_module;
+		}
+
+		m_sink->SegmentEnd(sequence, duration);
+
+		if( m_index ) { // Rounded like Rendition does
+			int rounded_duration = round(fabs(duration) + m_duration_acc_error);
+			m_duration_acc_error += duration - rounded_duration;
+			if( duration <= 0 ) rounded_duration += 1; // Workaround bug in Safari plugin
+			m_index->AddSegment(rounded_duration, m_uris->Filename(sequence), crypto_method, key_filename);
+		}
+		if( duration <= 0 ) break;
+	}
+	if( m_index ) m_index->End();
+}
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,83 @@
+#ifndef __PUSHSEGMENTER_H__
+#define __PUSHSEGMENTER_H__
+
+#include <string>
+#include <ostream>
+#include <pthread.h>
+#include "Segmenter/Segmenter.hpp"
+#include "Input/Push.hpp"
+#include "IndexFile.hpp"
+#include "KeyStore.hpp"
+#include "FileArray/FileArray.hpp"
+
+/* Segmenting inside another program, without files or pipes in between
+ *
+ * The program pushes its input in spans of any size into Feed(), and gets
+ * the segments back through a Sink. Segment data comes as spans that point
+ * straight into the fed buffers; only the odd packet or frame that
+ * straddles two Feed()s is pieced together in a buffer of our own first.
+ * With encryption, the data comes from the cipher's buffer instead.
+ *
+ * The segmenter runs on a thread of its own, which is where the Sink is
+ * called from. Feed() returns once it's done with the span, so the Sink
+ * never runs at the same time as the caller's own code, and the span may
+ * be reused right away.
+ *
+ * Link with libsegmenter.a, -lcrypto and -lpthread.
+ */
+class PushSegmenter {
+public:
+	class Sink {
+	public:
+		virtual ~Sink() {}
+		virtual void SegmentStart(unsigned long sequence) = 0;
+		/* sequence starts at 1, like in the index */
+		virtual void SegmentData(const char *data, size_t length) = 0;
+		/* The next piece of the segment; data is only valid during the call */
+		virtual void SegmentEnd(unsigned long sequence, float duration) = 0;
+		/* duration like copy_segment() returns it: <= 0 for the last one,
+		 * which may be empty
+		 */
+	};
+
+	PushSegmenter(Segmenter::Segmenter *seg, Sink *sink);
+	/* Takes ownership of seg, but not of sink */
+	~PushSegmenter();
+
+	void setIndex(IndexFile *index, FileArray::FileArray *uris);
+	/* Also keep a playlist, listing segment n as uris->Filename(n) */
+	void setCrypto(KeyStore *keys, std::string engine);
+	/* Encrypt the segments with AES-128-CBC; keys writes the key files */
+	/* Neither is taken over. Set them before the first Feed() */
+
+	void Feed(const char *data, size_t length);
+	/* Segments [data, data+length); calls the Sink for every segment that
+	 * completes in it
+	 */
+	void End();
+	/* The input ended: finishes the last segment, and the index */
+	/* Both throw std::runtime_error if segmenting failed */
+
+private:
+	Segmenter::Segmenter *m_seg;
+	Sink *m_sink;
+	Input::Push m_in;
+	IndexFile *m_index;
+	FileArray::FileArray *m_uris;
+	KeyStore *m_keys;
+	std::string m_crypto_engine;
+	float m_duration_acc_error;
+
+	pthread_t m_thread;
+	bool m_started, m_joined;
+	bool m_failed; // Set once m_error is, before the thread closes m_in
+	std::string m_error;
+
+	void start();
+	void join();
+	static void *run(void *push);
+	void segment();
+};
+
+#endif
+// vim: set ts=4 sw=4:
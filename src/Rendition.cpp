@@ -0,0 +1,869 @@
+#include "Rendition.hpp"
+#include "Crypto/CryptoEngine.hpp"
+#include "Input/Mmap.hpp"
+#include "FileArray/Timestamp.hpp"
+#include "IndexFileLive.hpp"
+#include "Clock.hpp"
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <math.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+Rendition::Rendition(std::string name, Input::Input *in, Segmenter::Segmenter *seg, IndexFile *index, FileArray::FileArray *out_filenames) :
+	m_name(name),
+	m_in(in),
+	m_seg(seg),
+	m_index(index),
+	m_out_filenames(out_filenames),
+	m_keys(NULL),
+	m_master(NULL),
+	m_variant(0),
+	m_peak_bandwidth(0),
+	m_duration_acc_error(0),
+	m_stats_log(NULL),
+	m_live(NULL),
+	m_pipeline(0),
+	m_uring(false),
+	m_next_sequence(0),
+	m_crypto_queue(NULL),
+	m_write_queue(NULL),
+	m_crypto_returns(NULL),
+	m_write_returns(NULL),
+	m_parsed(NULL),
+	m_encrypted(NULL),
+	m_failed(false),
+	m_error_claimed(false) {
+}
+
+Rendition::~Rendition() {
+	delete m_parsed;
+	delete m_encrypted;
+	delete m_crypto_queue;
+	delete m_write_queue;
+	delete m_crypto_returns;
+	delete m_write_returns;
+	delete m_out_filenames;
+	delete m_index;
+	delete m_seg;
+	delete m_in;
+}
+
+void Rendition::Begin() {
+	m_index->Begin();
+	if( ! m_byterange_filename.empty() && ! ( m_pipeline && m_uring ) ) { // Else the ring opens it
+		m_byterange_file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+		m_byterange_file.open(m_byterange_filename.c_str());
+	}
+}
+
+bool Rendition::Step() {
+	if( m_pipeline ) return stepPipelined();
+
+	std::ostringstream log; // One write per segment, so renditions don't mix their lines
+	if( ! m_name.empty() ) log << "[" << m_name << "] ";
+
+	std::ofstream segment_file;
+	std::ofstream *out_file = &segment_file;
+	std::string out_filename;
+	unsigned long long range_start = 0;
+	if( ! m_in_filename.empty() ) { // Only find the cut points
+		out_file = NULL;
+		out_filename = m_in_filename;
+		range_start = m_in->offset();
+		log << "Segment at offset " << range_start << " of \"" << out_filename << "\"  ";
+	} else if( ! m_byterange_filename.empty() ) {
+		out_file = &m_byterange_file;
+		out_filename = m_byterange_filename;
+		range_start = m_byterange_file.tellp();
+		log << "Segment at offset " << range_start << " of \"" << out_filename << "\"  ";
+	} else {
+		segment_file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+		out_filename = m_out_filenames->Filename( m_index->Sequence() );
+		segment_file.open(out_filename.c_str());
+		log << "Switching to file \"" << out_filename << "\"  ";
+	}
+
+	if( m_live ) Monitor::publish(&m_live->segment_start_ns, monotonic_ns());
+	StatsLog::Record stats;
+	unsigned long long start = 0, stall = 0, bytes_in = 0;
+	TimedStream *timed = NULL; // Measures the writes
+	if( m_stats_log ) {
+		m_seg->setStats(&stats.stream);
+		start = monotonic_ns();
+		stall = m_in->stall_ns();
+		bytes_in = m_in->offset();
+		if( out_file ) timed = new TimedStream(*out_file, &stats.write_ns);
+	}
+
+	std::ostream *out = out_file;
+	if( timed ) out = timed;
+	Crypto *crypto_module = NULL;
+	std::string key_filename;
+	if( m_keys ) {
+		char key[16];
+		key_filename = m_keys->Key(m_index->Sequence(), key);
+		char iv[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+		for(unsigned char i=0; i < 4; i++ ) iv[15-i] = m_index->Sequence() >> (8*i);
+		crypto_module = newCryptoAes128cbc(m_crypto_engine, key, iv);
+		CryptoProxy *proxy = new CryptoProxy(*out, crypto_module);
+		if( m_stats_log ) proxy->countTime(&stats.encrypt_ns);
+		if( m_live ) proxy->monitor(m_live);
+		out = proxy;
+	}
+
+	float duration = m_seg->copy_segment(m_in, out);
+
+	unsigned long long range_length = 0;
+	if( out != NULL ) {
+		*out << std::flush;
+		range_length = static_cast<unsigned long long>(out_file->tellp()) - range_start;
+		if( out_file == &segment_file ) {
+			unsigned long long close_start = m_stats_log ? monotonic_ns() : 0;
+			segment_file.close();
+			if( m_stats_log ) stats.write_ns += monotonic_ns() - close_start;
+		}
+	} else {
+		range_length = m_in->offset() - range_start;
+	}
+	log << duration << "secs\n";
+	std::cerr << log.str();
+
+	std::string crypto_method = "NONE";
+	if( m_keys ) {
+		crypto_method = crypto_module->method();
+		delete out;
+		delete crypto_module;
+	}
+	delete timed;
+	if( m_stats_log ) {
+		m_seg->setStats(NULL);
+		stats.stall_ns = m_in->stall_ns() - stall;
+		stats.bytes_in = m_in->offset() - bytes_in;
+		stats.parse_ns = monotonic_ns() - start - stats.stall_ns - stats.encrypt_ns - stats.write_ns;
+	}
+	addSegment(duration, out_filename, crypto_method, key_filename, range_start, range_length, m_stats_log ? &stats : NULL);
+
+	if( duration > 0 ) return true;
+
+	if( m_byterange_file.is_open() ) m_byterange_file.close();
+	m_index->End();
+	return false;
+}
+
+void Rendition::addSegment(float duration, const std::string &out_filename, const std::string &crypto_method, const std::string &key_filename,
+                           unsigned long long range_start, unsigned long long range_length, StatsLog::Record *stats) {
+	if( stats && m_stats_log ) {
+		stats->rendition = m_name;
+		stats->sequence = m_index->Sequence();
+		stats->filename = out_filename;
+		stats->duration = fabs(duration);
+		stats->bytes_out = range_length;
+		m_stats_log->Add(*stats);
+	}
+	if( m_live ) {
+		Monitor::bump(&m_live->segments, 1);
+		Monitor::publish(&m_live->sequence, m_index->Sequence());
+		Monitor::bump(&m_live->bytes_out, range_length);
+	}
+
+	int rounded_duration = round(fabs(duration) + m_duration_acc_error);
+	m_duration_acc_error += duration - rounded_duration;
+	if( duration <= 0 ) rounded_duration += 1; // Workaround bug in Safari plugin
+
+	m_index->AddSegment(rounded_duration, out_filename, crypto_method, key_filename, range_start, range_length);
+
+	if( m_master ) {
+		if( fabs(duration) > 0 ) {
+			unsigned long bandwidth = ceil(range_length * 8 / fabs(duration));
+			if( bandwidth > m_peak_bandwidth ) m_peak_bandwidth = bandwidth;
+		}
+		m_master->Report(m_variant, m_peak_bandwidth);
+	}
+}
+
+class Rendition::SpanTask : public Pool::Task {
+public:
+	Segmenter::Segmenter *seg;
+	const char *data;
+	size_t length;
+	const std::vector<Segmenter::Span> *spans;
+	size_t n;
+	std::string filename;
+	Crypto *crypto_module; // NULL for plain output
+	unsigned long long bytes; // Written
+	StatsLog::Record *stats; // NULL if not wanted
+
+	virtual bool Step() {
+		unsigned long long start = stats ? monotonic_ns() : 0;
+		std::ofstream file;
+		file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+		file.open(filename.c_str());
+		TimedStream *timed = stats ? new TimedStream(file, &stats->write_ns) : NULL;
+		std::ostream *out = &file;
+		if( timed ) out = timed;
+		if( crypto_module ) {
+			CryptoProxy *proxy = new CryptoProxy(*out, crypto_module);
+			if( stats ) proxy->countTime(&stats->encrypt_ns);
+			out = proxy;
+		}
+		seg->copy_span(data, length, *spans, n, out);
+		*out << std::flush;
+		bytes = file.tellp();
+		file.close();
+		if( crypto_module ) {
+			delete out;
+			delete crypto_module;
+		}
+		delete timed;
+		if( stats ) {
+			stats->bytes_in = (*spans)[n].end - (*spans)[n].begin;
+			stats->parse_ns = monotonic_ns() - start - stats->encrypt_ns - stats->write_ns;
+		}
+		return false;
+	}
+};
+
+bool Rendition::Parallel(unsigned threads) {
+	if( ! m_in_filename.empty() || ! m_byterange_filename.empty() ) return false; // Separate segment files only
+	if( dynamic_cast<FileArray::Timestamp*>(m_out_filenames) ) return false; // Would all get the same name
+	if( dynamic_cast<Input::Mmap*>(m_in) == NULL || m_in->offset() != 0 ) return false;
+
+	const char *data = m_in->data();
+	size_t length = m_in->available();
+	std::vector<Segmenter::Span> spans;
+	if( ! m_seg->split(data, length, threads, spans) ) return false;
+
+	std::vector<SpanTask> tasks(spans.size());
+	std::vector<std::string> key_filenames(spans.size());
+	std::vector<StatsLog::Record> stats(m_stats_log ? spans.size() : 0);
+	std::string crypto_method = "NONE";
+	Pool pool(threads);
+	for( size_t i = 0; i < spans.size(); i++ ) {
+		unsigned long sequence = m_index->Sequence() + i;
+		SpanTask &t = tasks[i];
+		t.seg = m_seg;
+		t.data = data;
+		t.length = length;
+		t.spans = &spans;
+		t.n = i;
+		t.filename = m_out_filenames->Filename(sequence);
+		t.crypto_module = NULL;
+		t.bytes = 0;
+		t.stats = m_stats_log ? &stats[i] : NULL;
+		if( m_keys ) { // Ask for the keys in order, see KeyStore::Key()
+			char key[16];
+			key_filenames[i] = m_keys->Key(sequence, key);
+			char iv[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+			for(unsigned char j=0; j < 4; j++ ) iv[15-j] = sequence >> (8*j);
+			t.crypto_module = newCryptoAes128cbc(m_crypto_engine, key, iv);
+			crypto_method = t.crypto_module->method();
+		}
+		pool.Add(&t);
+	}
+	pool.Run();
+
+	for( size_t i = 0; i < spans.size(); i++ ) {
+		std::ostringstream log;
+		if( ! m_name.empty() ) log << "[" << m_name << "] ";
+		log << "Switching to file \"" << tasks[i].filename << "\"  " << spans[i].duration << "secs\n";
+		std::cerr << log.str();
+		addSegment(spans[i].duration, tasks[i].filename, crypto_method, key_filenames[i], 0, tasks[i].bytes, tasks[i].stats);
+	}
+	m_in->consume(length);
+	if( m_live ) Monitor::publish(&m_live->bytes_in, m_in->offset()); // copy_span() doesn't publish it
+
+	m_index->End();
+	return true;
+}
+
+struct Rendition::Job {
+	unsigned long sequence;
+	std::string out_filename;
+	Crypto *crypto_module; // NULL for plain output; the crypto stage deletes it
+	std::string crypto_method;
+	float duration;
+	unsigned long long range_start, range_length; // Filled in by the write stage, except for byterange-input
+	StatsLog::Record stats; // Every stage adds its own times
+};
+
+bool Rendition::stepPipelined() {
+	if( m_parsed == NULL ) { // Set up on first use
+		m_next_sequence = m_index->Sequence();
+		m_write_queue = new Pipeline::Queue<Pipeline::Message>(m_pipeline);
+		// The io_uring writer holds on to up to m_pipeline buffers itself
+		m_write_returns = new Pipeline::Queue<char*>(m_uring ? 2*m_pipeline + 2 : m_pipeline + 2);
+		if( m_keys ) {
+			m_crypto_queue = new Pipeline::Queue<Pipeline::Message>(m_pipeline);
+			m_crypto_returns = new Pipeline::Queue<char*>(m_pipeline + 2);
+			m_parsed = new Pipeline::Stream(*m_crypto_queue, *m_crypto_returns);
+			m_encrypted = new Pipeline::Stream(*m_write_queue, *m_write_returns);
+			if( pthread_create(&m_crypto_thread, NULL, cryptoStage, this) ) {
+				throw std::runtime_error("Could not start crypto thread");
+			}
+		} else { // Straight to the writer
+			m_parsed = new Pipeline::Stream(*m_write_queue, *m_write_returns);
+		}
+		if( pthread_create(&m_write_thread, NULL, m_uring ? uringWriteStage : writeStage, this) ) {
+			throw std::runtime_error("Could not start write thread");
+		}
+	}
+
+	Job *job = new Job;
+	job->sequence = m_next_sequence++;
+	job->crypto_module = NULL;
+	job->crypto_method = "NONE";
+	job->duration = 0;
+	job->range_start = job->range_length = 0;
+
+	std::ostream *out = m_parsed;
+	if( ! m_in_filename.empty() ) { // Only find the cut points
+		out = NULL;
+		job->out_filename = m_in_filename;
+		job->range_start = m_in->offset();
+	} else if( ! m_byterange_filename.empty() ) {
+		job->out_filename = m_byterange_filename;
+	} else {
+		job->out_filename = m_out_filenames->Filename( job->sequence );
+	}
+
+	if( m_keys ) {
+		char key[16];
+		m_keys->Derive(job->sequence, key); // The write stage takes care of the key file
+		char iv[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+		for(unsigned char i=0; i < 4; i++ ) iv[15-i] = job->sequence >> (8*i);
+		job->crypto_module = newCryptoAes128cbc(m_crypto_engine, key, iv);
+		job->crypto_method = job->crypto_module->method();
+	}
+
+	if( m_live ) Monitor::publish(&m_live->segment_start_ns, monotonic_ns());
+	m_parsed->send(Pipeline::Message::OPEN, job);
+	Pipeline::Queue<Pipeline::Message> *queue = m_keys ? m_crypto_queue : m_write_queue;
+	unsigned long long start = 0, stall = 0, queue_stall = 0, bytes_in = 0;
+	if( m_stats_log ) {
+		m_seg->setStats(&job->stats.stream);
+		start = monotonic_ns();
+		stall = m_in->stall_ns();
+		queue_stall = queue->stats().stall_ns;
+		bytes_in = m_in->offset();
+	}
+	float duration = m_seg->copy_segment(m_in, out);
+	job->duration = duration;
+	if( out == NULL ) job->range_length = m_in->offset() - job->range_start;
+	if( m_stats_log ) { // Waiting for the next stage isn't parsing either
+		m_seg->setStats(NULL);
+		job->stats.stall_ns = m_in->stall_ns() - stall;
+		job->stats.bytes_in = m_in->offset() - bytes_in;
+		job->stats.parse_ns = monotonic_ns() - start - job->stats.stall_ns - (queue->stats().stall_ns - queue_stall);
+	}
+	m_parsed->send(Pipeline::Message::CLOSE, job); // Hands job over
+
+	if( duration <= 0 ) {
+		m_parsed->send(Pipeline::Message::END);
+		if( m_keys ) pthread_join(m_crypto_thread, NULL);
+		pthread_join(m_write_thread, NULL);
+		logPipelineStats();
+	}
+
+	if( __atomic_load_n(&m_failed, __ATOMIC_ACQUIRE) ) {
+		throw std::runtime_error(m_error);
+	}
+	return duration > 0;
+}
+
+void Rendition::fail(const std::exception &e) {
+	if( __atomic_exchange_n(&m_error_claimed, true, __ATOMIC_ACQ_REL) ) return; // Keep the first one
+	m_error = e.what();
+	__atomic_store_n(&m_failed, true, __ATOMIC_RELEASE);
+}
+
+void *Rendition::cryptoStage(void *rendition) {
+	Rendition *r = static_cast<Rendition*>(rendition);
+	CryptoProxy *proxy = NULL;
+	Job *job = NULL;
+	while( 1 ) {
+		Pipeline::Message m = r->m_crypto_queue->pop();
+		if( r->m_live ) Monitor::publish(&r->m_live->crypto_queue, r->m_crypto_queue->size());
+		try {
+			switch( m.type ) {
+			case Pipeline::Message::OPEN:
+				job = static_cast<Job*>(m.tag);
+				proxy = new CryptoProxy(*r->m_encrypted, job->crypto_module);
+				if( r->m_stats_log ) proxy->countTime(&job->stats.encrypt_ns);
+				if( r->m_live ) proxy->monitor(r->m_live);
+				r->m_encrypted->send(m.type, m.tag);
+				break;
+			case Pipeline::Message::DATA:
+				if( proxy ) proxy->write(m.data, m.length);
+				r->m_crypto_returns->push(m.data);
+				break;
+			case Pipeline::Message::CLOSE:
+				if( proxy ) *proxy << std::flush; // Pads the last block
+				delete proxy;
+				proxy = NULL;
+				delete job->crypto_module;
+				job->crypto_module = NULL;
+				r->m_encrypted->send(m.type, m.tag);
+				break;
+			case Pipeline::Message::END:
+				r->m_encrypted->send(m.type, m.tag);
+				return NULL;
+			}
+		} catch( std::exception &e ) {
+			r->fail(e);
+			if( m.type == Pipeline::Message::END ) return NULL; // Should not happen, send() doesn't throw
+		}
+	}
+}
+
+void *Rendition::writeStage(void *rendition) {
+	Rendition *r = static_cast<Rendition*>(rendition);
+	std::ofstream segment_file;
+	std::ofstream *out_file = NULL;
+	std::string key_filename;
+	unsigned long long write_ns = 0; // For the current segment
+	while( 1 ) {
+		Pipeline::Message m = r->m_write_queue->pop();
+		if( r->m_live ) Monitor::publish(&r->m_live->write_queue, r->m_write_queue->size());
+		if( __atomic_load_n(&r->m_failed, __ATOMIC_ACQUIRE) ) { // Drain, doing nothing
+			if( m.type == Pipeline::Message::DATA ) r->m_write_returns->push(m.data);
+			if( m.type == Pipeline::Message::CLOSE ) delete static_cast<Job*>(m.tag);
+			if( m.type == Pipeline::Message::END ) return NULL;
+			continue;
+		}
+
+		try {
+			Job *job = static_cast<Job*>(m.tag);
+			unsigned long long start = monotonic_ns();
+			switch( m.type ) {
+			case Pipeline::Message::OPEN:
+				write_ns = 0;
+				if( r->m_keys ) {
+					char key[16];
+					key_filename = r->m_keys->Key(job->sequence, key);
+				}
+				if( ! r->m_in_filename.empty() ) {
+					out_file = NULL;
+				} else if( ! r->m_byterange_filename.empty() ) {
+					out_file = &r->m_byterange_file;
+					job->range_start = r->m_byterange_file.tellp();
+				} else {
+					segment_file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+					segment_file.open(job->out_filename.c_str());
+					out_file = &segment_file;
+				}
+				write_ns += monotonic_ns() - start;
+				break;
+
+			case Pipeline::Message::DATA:
+				if( out_file ) out_file->write(m.data, m.length);
+				r->m_write_returns->push(m.data);
+				write_ns += monotonic_ns() - start;
+				break;
+
+			case Pipeline::Message::CLOSE: {
+				std::ostringstream log;
+				if( ! r->m_name.empty() ) log << "[" << r->m_name << "] ";
+				if( out_file == &segment_file ) {
+					segment_file.flush();
+					job->range_length = segment_file.tellp();
+					segment_file.close();
+					log << "Switching to file \"" << job->out_filename << "\"  ";
+				} else {
+					if( out_file ) {
+						out_file->flush();
+						job->range_length = static_cast<unsigned long long>(out_file->tellp()) - job->range_start;
+					}
+					log << "Segment at offset " << job->range_start << " of \"" << job->out_filename << "\"  ";
+				}
+				out_file = NULL;
+				log << job->duration << "secs\n";
+				std::cerr << log.str();
+				job->stats.write_ns = write_ns + (monotonic_ns() - start);
+
+				r->addSegment(job->duration, job->out_filename, job->crypto_method, r->m_keys ? key_filename : "",
+				              job->range_start, job->range_length, &job->stats);
+				delete job;
+				break;
+			}
+
+			case Pipeline::Message::END:
+				if( r->m_byterange_file.is_open() ) r->m_byterange_file.close();
+				r->m_index->End();
+				return NULL;
+			}
+		} catch( std::exception &e ) {
+			r->fail(e);
+			if( m.type == Pipeline::Message::CLOSE ) delete static_cast<Job*>(m.tag);
+			if( m.type == Pipeline::Message::DATA ) r->m_write_returns->push(m.data);
+			if( m.type == Pipeline::Message::END ) return NULL;
+		}
+	}
+}
+
+/* The write stage on io_uring
+ *
+ * Every DATA buffer becomes a write at a known offset, so the writes of a
+ * segment don't wait for each other, nor for the next segment's. Segment
+ * files open into slots of the ring's file table; data that arrives before
+ * its open completed waits in File::held. Key files and the live playlist
+ * go out as linked open/write/close(/rename) chains.
+ *
+ * Segments are added to the index in order, once all their operations
+ * completed, so the playlist never lists a file that isn't completely there.
+ */
+class Rendition::UringWriter {
+public:
+	UringWriter(Rendition *r, Uring &ring, unsigned max_buffers);
+	void run();
+
+private:
+	struct File;
+	struct Seg;
+	class Op : public Uring::Op {
+	public:
+		enum Kind { OPEN, WRITE, CLOSE, KEY } kind;
+		UringWriter *w;
+		File *file;
+		Seg *seg; // NULL for the close of the byterange file
+		char *data;
+		size_t length;
+		size_t written;
+		unsigned long long offset;
+		virtual void done(int result) { w->completed(this, result); }
+	};
+	struct File {
+		std::string name;
+		unsigned slot;
+		bool opened; // Writes can go out
+		bool closing; // No more writes coming
+		bool close_queued;
+		unsigned writes; // In flight
+		unsigned long long size; // Queued so far
+		std::vector<Op*> held; // Writes waiting for the open
+	};
+	struct Seg {
+		Job *job;
+		File *file; // Own file, the byterange file or NULL
+		std::string key_filename;
+		unsigned ops; // In flight
+		bool closed; // Seen its CLOSE
+		unsigned long long opened; // monotonic_ns() of its OPEN
+	};
+
+	Rendition *r;
+	Uring &m_ring;
+	unsigned m_max_buffers;
+	unsigned m_buffers; // Held or being written
+	unsigned m_key_writes;
+	File m_byterange;
+	std::deque<Seg*> m_segs; // In order; the last one is being received
+
+	Op *newOp(Op::Kind kind, File *file, Seg *seg);
+	void error(const std::string &what, int result);
+	bool failed() const { return __atomic_load_n(&r->m_failed, __ATOMIC_ACQUIRE); }
+
+	void open(Job *job);
+	void openFile(File *file, Seg *seg);
+	void data(char *data, size_t length);
+	void close();
+	void write(Op *op);
+	void maybeClose(File *file, Seg *seg);
+	void completed(Op *op, int result);
+	void flush();
+	void finish();
+};
+
+Rendition::UringWriter::UringWriter(Rendition *rendition, Uring &ring, unsigned max_buffers) :
+	r(rendition),
+	m_ring(ring),
+	m_max_buffers(max_buffers),
+	m_buffers(0),
+	m_key_writes(0) {
+	m_byterange.name = r->m_byterange_filename;
+	m_byterange.opened = m_byterange.closing = m_byterange.close_queued = false;
+	m_byterange.writes = 0;
+	m_byterange.size = 0;
+}
+
+Rendition::UringWriter::Op *Rendition::UringWriter::newOp(Op::Kind kind, File *file, Seg *seg) {
+	Op *op = new Op;
+	op->kind = kind;
+	op->w = this;
+	op->file = file;
+	op->seg = seg;
+	op->data = NULL;
+	op->length = 0;
+	op->written = 0;
+	op->offset = 0;
+	if( seg ) seg->ops++;
+	return op;
+}
+
+void Rendition::UringWriter::error(const std::string &what, int result) {
+	r->fail(std::runtime_error(what + ": " + strerror(-result)));
+}
+
+void Rendition::UringWriter::run() {
+	if( ! m_byterange.name.empty() ) openFile(&m_byterange, NULL);
+	while( 1 ) {
+		Pipeline::Message m;
+		if( m_ring.pending() == 0 ) {
+			m = r->m_write_queue->pop();
+		} else if( m_buffers >= m_max_buffers || ! r->m_write_queue->try_pop(m) ) {
+			try {
+				m_ring.reap(1000); // Submits what's queued up meanwhile, in one go
+				flush();
+			} catch( std::exception &e ) {
+				r->fail(e);
+			}
+			continue;
+		}
+		if( r->m_live ) Monitor::publish(&r->m_live->write_queue, r->m_write_queue->size());
+
+		try {
+			switch( m.type ) {
+			case Pipeline::Message::OPEN: open(static_cast<Job*>(m.tag)); break;
+			case Pipeline::Message::DATA: data(m.data, m.length); break;
+			case Pipeline::Message::CLOSE: close(); break;
+			case Pipeline::Message::END: finish(); return;
+			}
+		} catch( std::exception &e ) {
+			r->fail(e);
+			if( m.type == Pipeline::Message::END ) return;
+		}
+	}
+}
+
+void Rendition::UringWriter::open(Job *job) {
+	Seg *s = new Seg;
+	s->job = job;
+	s->file = NULL;
+	s->ops = 0;
+	s->closed = false;
+	s->opened = monotonic_ns();
+	m_segs.push_back(s);
+	if( failed() ) return;
+
+	if( r->m_keys ) {
+		// Finish our own key file first: Claim() would wait for it, and so
+		// might other renditions
+		while( m_key_writes > 0 ) m_ring.reap(1000);
+		char key[16];
+		if( r->m_keys->Claim(job->sequence, key, s->key_filename) ) {
+			m_key_writes++;
+			m_ring.writeFile(s->key_filename, std::string(key, 16), "", newOp(Op::KEY, NULL, s));
+		}
+		memset(key, 0, sizeof(key));
+	}
+
+	if( ! r->m_in_filename.empty() ) return; // Nothing to write
+
+	if( ! m_byterange.name.empty() ) {
+		s->file = &m_byterange; // Opened in run()
+		job->range_start = m_byterange.size;
+	} else {
+		File *f = new File;
+		f->name = job->out_filename;
+		f->opened = f->closing = f->close_queued = false;
+		f->writes = 0;
+		f->size = 0;
+		s->file = f;
+		openFile(f, s);
+	}
+}
+void Rendition::UringWriter::openFile(File *file, Seg *seg) {
+	while( ! m_ring.allocSlot(file->slot) ) {
+		if( m_ring.pending() == 0 ) throw std::runtime_error("io_uring: out of file slots");
+		m_ring.reap(1000);
+	}
+	m_ring.openat(file->name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666, file->slot, newOp(Op::OPEN, file, seg));
+}
+
+void Rendition::UringWriter::data(char *data, size_t length) {
+	Seg *s = m_segs.empty() ? NULL : m_segs.back();
+	if( failed() || s == NULL || s->file == NULL ) {
+		r->m_write_returns->push(data);
+		return;
+	}
+	Op *op = newOp(Op::WRITE, s->file, s);
+	op->data = data;
+	op->length = length;
+	op->offset = s->file->size;
+	s->file->size += length;
+	m_buffers++;
+	if( s->file->opened ) {
+		write(op);
+	} else {
+		s->file->held.push_back(op);
+	}
+}
+
+void Rendition::UringWriter::write(Op *op) {
+	op->file->writes++;
+	m_ring.write(op->file->slot, op->data + op->written, op->length - op->written, op->offset + op->written, op);
+}
+
+void Rendition::UringWriter::close() {
+	Seg *s = m_segs.back();
+	s->closed = true;
+	Job *job = s->job;
+	if( s->file == &m_byterange ) {
+		job->range_length = m_byterange.size - job->range_start;
+	} else if( s->file ) {
+		job->range_length = s->file->size;
+		s->file->closing = true;
+		maybeClose(s->file, s);
+	}
+	flush();
+}
+
+void Rendition::UringWriter::maybeClose(File *file, Seg *seg) {
+	if( file->closing && file->opened && file->writes == 0 && ! file->close_queued ) {
+		file->close_queued = true;
+		m_ring.close(file->slot, newOp(Op::CLOSE, file, seg));
+	}
+}
+
+void Rendition::UringWriter::completed(Op *op, int result) {
+	File *f = op->file;
+	switch( op->kind ) {
+	case Op::OPEN:
+		if( result < 0 ) {
+			error("Could not open \"" + f->name + "\"", result);
+			m_ring.freeSlot(f->slot);
+			for( size_t i = 0; i < f->held.size(); i++ ) {
+				r->m_write_returns->push(f->held[i]->data);
+				m_buffers--;
+				f->held[i]->seg->ops--;
+				delete f->held[i];
+			}
+		} else {
+			f->opened = true;
+			for( size_t i = 0; i < f->held.size(); i++ ) write(f->held[i]);
+			maybeClose(f, op->seg);
+		}
+		f->held.clear();
+		break;
+
+	case Op::WRITE:
+		f->writes--;
+		if( result > 0 && op->written + result < op->length ) { // Short write; carry on with the rest
+			op->written += result;
+			write(op);
+			return;
+		}
+		if( result < 0 ) error("Could not write \"" + f->name + "\"", result);
+		if( result == 0 ) error("Could not write \"" + f->name + "\"", -EIO);
+		r->m_write_returns->push(op->data);
+		m_buffers--;
+		maybeClose(f, op->seg);
+		break;
+
+	case Op::CLOSE:
+		m_ring.freeSlot(f->slot);
+		if( result < 0 ) error("Could not write \"" + f->name + "\"", result);
+		break;
+
+	case Op::KEY:
+		m_key_writes--;
+		if( result < 0 ) {
+			r->m_keys->Abandon(op->seg->job->sequence);
+			error("Could not write key file \"" + op->seg->key_filename + "\"", result);
+		} else {
+			r->m_keys->Written(op->seg->job->sequence);
+		}
+		break;
+	}
+	if( op->seg ) op->seg->ops--;
+	delete op;
+}
+void Rendition::UringWriter::flush() {
+	while( ! m_segs.empty() && m_segs.front()->closed && m_segs.front()->ops == 0 ) {
+		Seg *s = m_segs.front();
+		m_segs.pop_front();
+		Job *job = s->job;
+		try {
+			if( ! failed() ) {
+				std::ostringstream log;
+				if( ! r->m_name.empty() ) log << "[" << r->m_name << "] ";
+				if( s->file && s->file != &m_byterange ) {
+					log << "Switching to file \"" << job->out_filename << "\"  ";
+				} else {
+					log << "Segment at offset " << job->range_start << " of \"" << job->out_filename << "\"  ";
+				}
+				log << job->duration << "secs\n";
+				std::cerr << log.str();
+
+				job->stats.write_ns = monotonic_ns() - s->opened; // Writes overlap, so this is how long they took
+				r->addSegment(job->duration, job->out_filename, job->crypto_method, s->key_filename,
+				              job->range_start, job->range_length, &job->stats);
+			}
+		} catch( std::exception &e ) {
+			r->fail(e);
+		}
+		if( s->file != &m_byterange ) delete s->file;
+		delete job;
+		delete s;
+	}
+}
+
+void Rendition::UringWriter::finish() {
+	while( m_ring.pending() > 0 ) {
+		m_ring.reap(1000);
+		flush(); // Adding segments to a live index queues playlist writes
+	}
+	if( ! m_byterange.name.empty() ) {
+		m_byterange.closing = true;
+		maybeClose(&m_byterange, NULL);
+		while( m_ring.pending() > 0 ) m_ring.reap(1000);
+	}
+	if( ! failed() ) r->m_index->End();
+}
+
+void *Rendition::uringWriteStage(void *rendition) {
+	Rendition *r = static_cast<Rendition*>(rendition);
+	IndexFileLive *live = dynamic_cast<IndexFileLive*>(r->m_index);
+	Uring *ring = NULL;
+	try {
+		ring = new Uring(256, r->m_pipeline + 8);
+	} catch( std::exception &e ) {
+		r->fail(e);
+	}
+	if( live && ring ) live->setUring(ring);
+
+	UringWriter *w = ring ? new UringWriter(r, *ring, r->m_pipeline) : NULL;
+	if( w ) w->run();
+	while( w == NULL ) { // Without a ring, only drain
+		Pipeline::Message m = r->m_write_queue->pop();
+		if( m.type == Pipeline::Message::DATA ) r->m_write_returns->push(m.data);
+		if( m.type == Pipeline::Message::CLOSE ) delete static_cast<Job*>(m.tag);
+		if( m.type == Pipeline::Message::END ) break;
+	}
+
+	if( live ) live->setUring(NULL);
+	delete w;
+	delete ring;
+	return NULL;
+}
+
+static void log_queue(std::ostream &log, const char *name, const Pipeline::QueueStats &s, size_t depth) {
+	log << "  " << name << ": " << s.pushed << " messages, max depth " << s.max_depth << "/" << depth
+	    << ", full " << s.full << " times (" << s.stall_ns / 1000000 << " ms stalled)"
+	    << ", consumer idle " << s.idle_ns / 1000000 << " ms\n";
+}
+
+void Rendition::logPipelineStats() {
+	std::ostringstream log;
+	if( ! m_name.empty() ) log << "[" << m_name << "] ";
+	log << "Pipeline queues:\n";
+	if( m_crypto_queue ) log_queue(log, "parse -> crypto", m_crypto_queue->stats(), m_crypto_queue->depth());
+	log_queue(log, m_crypto_queue ? "crypto -> write" : "parse -> write", m_write_queue->stats(), m_write_queue->depth());
+	std::cerr << log.str();
+}
+
+// vim: set ts=4 sw=4:
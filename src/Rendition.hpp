@@ -0,0 +1,115 @@
+#ifndef __RENDITION_H__
+#define __RENDITION_H__
+
+#include <fstream>
+#include <string>
+#include "Pool.hpp"
+#include "Input/Input.hpp"
+#include "Segmenter/Segmenter.hpp"
+#include "IndexFile.hpp"
+#include "IndexFileMaster.hpp"
+#include "KeyStore.hpp"
+#include "StatsLog.hpp"
+#include "Monitor.hpp"
+#include "FileArray/FileArray.hpp"
+#include "Pipeline/Stream.hpp"
+#include "Uring.hpp"
+
+/* One input, segmented into its own files and index
+ *
+ * Every Step() copies one segment, so a Pool can interleave the renditions
+ * of a ladder segment by segment.
+ *
+ * In pipeline mode, Step() only parses: encryption, and writing segments,
+ * keys and the index, happen on two threads of this rendition's own,
+ * behind bounded queues. A slow disk then doesn't hold up reading the input.
+ */
+class Rendition : public Pool::Task {
+protected:
+	std::string m_name;
+	Input::Input *m_in;
+	Segmenter::Segmenter *m_seg;
+	IndexFile *m_index;
+	FileArray::FileArray *m_out_filenames;
+
+	std::string m_in_filename; // Set in byterange-input mode
+	std::string m_byterange_filename;
+	std::ofstream m_byterange_file;
+
+	KeyStore *m_keys;
+	std::string m_crypto_engine;
+
+	IndexFileMaster *m_master;
+	unsigned long m_variant;
+	unsigned long m_peak_bandwidth;
+
+	float m_duration_acc_error;
+
+	StatsLog *m_stats_log;
+	Monitor::Counters *m_live;
+
+	void addSegment(float duration, const std::string &out_filename, const std::string &crypto_method, const std::string &key_filename,
+	                unsigned long long range_start, unsigned long long range_length, StatsLog::Record *stats = NULL);
+	/* Also logs stats, which only needs the timings and stream filled in */
+	class SpanTask;
+
+	size_t m_pipeline; // Queue depth, 0 when not pipelining
+	bool m_uring; // Write stage on io_uring
+	class UringWriter;
+	struct Job; // A segment on its way through the pipeline
+	unsigned long m_next_sequence;
+	Pipeline::Queue<Pipeline::Message> *m_crypto_queue, *m_write_queue;
+	Pipeline::Queue<char*> *m_crypto_returns, *m_write_returns;
+	Pipeline::Stream *m_parsed, *m_encrypted; // Producer ends of the queues
+	pthread_t m_crypto_thread, m_write_thread;
+	bool m_failed; // Set once m_error is
+	bool m_error_claimed;
+	std::string m_error;
+
+	bool stepPipelined();
+	static void *cryptoStage(void *rendition);
+	static void *writeStage(void *rendition);
+	static void *uringWriteStage(void *rendition);
+	void fail(const std::exception &e);
+	void logPipelineStats();
+
+public:
+	Rendition(std::string name, Input::Input *in, Segmenter::Segmenter *seg, IndexFile *index, FileArray::FileArray *out_filenames);
+	/* name is used to tag log lines, and may be empty
+	 * Takes ownership of all arguments
+	 */
+	virtual ~Rendition();
+
+	void setByteRangeFile(std::string filename) { m_byterange_filename = filename; }
+	/* Write all segments to filename */
+	void setByteRangeInput(std::string in_filename) { m_in_filename = in_filename; }
+	/* Write nothing; list the segments as byte ranges of the input file */
+	void setCrypto(KeyStore *keys, std::string engine) { m_keys = keys; m_crypto_engine = engine; }
+	void setMaster(IndexFileMaster *master, unsigned long variant) { m_master = master; m_variant = variant; }
+	void setStatsLog(StatsLog *log) { m_stats_log = log; }
+	/* Log the statistics of every segment there */
+	void setMonitor(Monitor::Counters *live) { m_live = live; m_seg->setLive(live); }
+	/* Keep live's counters up to date */
+	void setPipeline(size_t depth) { m_pipeline = depth; }
+	/* Pipeline mode with queues of depth buffers; 0 turns it off */
+	void setUring(bool uring) { m_uring = uring; }
+	/* In pipeline mode, hand all writes to the kernel through io_uring;
+	 * check Uring::supported() first
+	 */
+
+	void Begin();
+	virtual bool Step();
+	/* Copies one segment; returns false after the last one, when the index
+	 * has been closed
+	 */
+
+	bool Parallel(unsigned threads);
+	/* Segments all of a memory-mapped input at once, on `threads` threads,
+	 * into the same files Step() would have written. Call after Begin(),
+	 * instead of Step(). Returns false (having done nothing) if the input
+	 * or the segmenter doesn't allow this
+	 */
+};
+
+#endif
+// vim: set ts=4 sw=4:
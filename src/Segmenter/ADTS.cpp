@@ -1,6 +1,7 @@
 #include "ADTS.hpp"
 #include <assert.h>
 #include <iostream>
+#include "SyncWord.hpp"
 
 // LCM of sample rates
 #define FRAC_SECOND 28224000
@@ -21,55 +22,72 @@ static const unsigned long samplerate[] = {
 	11025,
 	8000};
 
+static size_t frame_length(const unsigned char *header) {
+	if( header[0] != 0xff || (header[1] & 0xf0) != 0xf0 ) return 0;
+	if( ((header[2] & 0x3c) >> 2) >= sizeof(samplerate)/sizeof(*samplerate) ) return 0;
+	size_t len = ((header[3] & 0x03) << 11) | (header[4] << 3) | ((header[5] & 0xe0) >> 5); // aac_frame_length, 13 bits
+	return len < 7 ? 0 : len;
+}
+/* Length of the ADTS frame, header included; 0 if it's not a valid header
+ */
+
+bool ADTS::probe(const char *data, size_t length) {
+	return syncword_probe(data, length, SYNCWORD_MASK_ADTS, 7, frame_length, 3);
+}
+
 ADTS::ADTS(const unsigned long length, const std::string extra_opts) :
 	Segmenter(length, extra_opts),
 	m_length(length),
 	m_pos(0) {
 }
 
-float ADTS::copy_segment(std::istream *in, std::ostream *out) {
+template <class In, class Out>
+float ADTS::copy(In *in, const Out &out) {
+	const char *run = NULL; // Start of the frames to copy; they are written in one go
 	while( m_pos / FRAC_SECOND < m_length ) {
-		try {
-			unsigned char header[7];
-			in->read(reinterpret_cast<char*>(header), 7);
-
-			// Are we in sync?
-			while( header[0] != 0xff
-			   || (header[1] & 0xe0) != 0xe0 ) {
-				std::cerr << "Lost sync, skipping byte\n";
-				do{
-					in->read(reinterpret_cast<char*>(header), 1);
-				} while( header[0] != 0xff );
+		if( in->available() < 7 ) write_run(out, run, in->data()); // refilling invalidates the buffer
+		if( ! in->fill(7) ) return -static_cast<float>(m_pos / FRAC_SECOND); // EOF
+		const unsigned char *header = reinterpret_cast<const unsigned char*>(in->data());
+		size_t len = frame_length(header);
 
-				in->read(reinterpret_cast<char*>(header+1), 6);
-			}
-
-			unsigned char samplerate_idx = (header[2] & 0x3c) >> 2;
-			size_t len = ((header[3] & 0x02) << 11) | (header[4] << 3) | ((header[5] & 0xe0) >> 5);
-			len -= 7; // Header
-			unsigned char num_blocks = (header[6] & 0x03) + 1;
-			assert(num_blocks == 1); // TODO
+		if( len == 0 ) { // We are not in sync
+			write_run(out, run, in->data());
+			unsigned long long skipped = 0;
+			bool more = syncword_resync(in, SYNCWORD_MASK_ADTS, 7, frame_length, skipped);
+			std::cerr << "Lost sync, skipped " << skipped << " bytes\n";
+			if( m_stats ) m_stats->resyncs++;
+			if( m_live ) Monitor::bump(&m_live->resyncs, 1);
+			if( ! more ) return -static_cast<float>(m_pos / FRAC_SECOND);
+			continue;
+		}
 
-			m_pos += 1024 * (FRAC_SECOND / samplerate[samplerate_idx]);
-			
-			char *buf = new char[len];
+		unsigned char samplerate_idx = (header[2] & 0x3c) >> 2;
+		unsigned char num_blocks = (header[6] & 0x03) + 1;
+		assert(num_blocks == 1); // TODO
 
-			in->read(buf, len);
-			out->write(reinterpret_cast<char*>(header), 7);
-			out->write(buf, len);
+		m_pos += 1024 * (FRAC_SECOND / samplerate[samplerate_idx]);
 
-			delete buf;
-		} catch ( std::ios_base::failure e ) {
-			// EOF is handeled here
-			if( ! in->eof() ) throw;
-			return -(m_pos / FRAC_SECOND);
+		// Add the frame, header included, to the run
+		if( in->available() < len ) write_run(out, run, in->data());
+		if( ! in->fill(len) ) return -static_cast<float>(m_pos / FRAC_SECOND);
+		if( run == NULL ) run = in->data();
+		in->consume(len);
+		if( m_live ) Monitor::publish(&m_live->bytes_in, in->offset());
+		if( m_stats ) {
+			m_stats->kept++;
+			m_stats->frames++;
 		}
 	}
+	write_run(out, run, in->data());
 
 	m_pos -= m_length * FRAC_SECOND; /* Keep our error, so we don't accumulate */
 	return m_length + m_pos / FRAC_SECOND;
 }
 
+float ADTS::copy_segment(Input::Input *in, std::ostream *out) {
+	return dispatch(this, in, out);
+}
+
 } // namespace
 
 // vim: set ts=4 sw=4:
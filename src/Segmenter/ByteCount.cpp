@@ -1,6 +1,7 @@
 #include "ByteCount.hpp"
 #include <stdlib.h>
 #include <sstream>
+#include <iostream>
 
 namespace Segmenter {
 
@@ -17,32 +18,36 @@ ByteCount::ByteCount(unsigned long length, const std::string extra_opts) :
 			throw std::invalid_argument(msg.str());
 		}
 	}
-	if( (m_buffer = static_cast<char*>(malloc(m_block))) == NULL )
-		throw std::bad_alloc();
 }
 
 ByteCount::~ByteCount() {
-	free(m_buffer);
 }
 
 void ByteCount::usage() {
+	std::cerr << "Copies blocks of bytes; the length counts blocks instead of seconds\n"
+	          << "\n"
+	          << "extra options format:\n"
+	          << "  [n]       block size in bytes, default 1024\n";
 }
 
-float ByteCount::copy_segment(std::istream *in, std::ostream *out) {
+template <class In, class Out>
+float ByteCount::copy(In *in, const Out &out) {
 	unsigned long i;
 	for( i=0; i < m_length; i++ ) {
-		try{ 
-			in->read(m_buffer, m_block);
-		} catch( std::ios_base::failure e ) {
-			// We handle EOF ourself; throw the rest
-			if( ! in->eof() ) throw;
-		}
-		out->write(m_buffer, in->gcount() ); // count may be less than m_block
-		if( in->eof() ) return -i;
+		bool eof = ! in->fill(m_block);
+		size_t count = eof ? in->available() : m_block; // count may be less than m_block
+		out.write(in->data(), count);
+		in->consume(count);
+		if( m_live ) Monitor::publish(&m_live->bytes_in, in->offset());
+		if( eof ) return -i;
 	}
 	return i;
 }
 
+float ByteCount::copy_segment(Input::Input *in, std::ostream *out) {
+	return dispatch(this, in, out);
+}
+
 } // namespace
 
 // vim: set ts=4 sw=4:
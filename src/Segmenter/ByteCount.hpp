@@ -7,17 +7,21 @@
 
 namespace Segmenter {
 
-class ByteCount : protected Segmenter {
+class ByteCount : public Segmenter {
 private:
 	unsigned long m_length;
 	unsigned long m_block;
-	char *m_buffer;
 
 public:
 	ByteCount(const unsigned long length, const std::string extra_opts);	
 	virtual ~ByteCount();
 	static void usage();
-	virtual float copy_segment(std::istream *in, std::ostream *out);
+	static bool probe(const char *data, size_t length) { return false; }
+	/* Any data will do, so never pick this one unasked */
+	virtual float copy_segment(Input::Input *in, std::ostream *out);
+
+	template <class In, class Out> float copy(In *in, const Out &out);
+	/* copy_segment() for one kind of input and output, see dispatch() */
 };
 
 } // namespace
@@ -0,0 +1,21 @@
+#ifndef __CPU_H__
+#define __CPU_H__
+
+namespace Segmenter {
+
+inline bool cpu_has_avx2() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init(); // May run before the constructors that normally do this
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+/* Used to pick the vectorised scanners at startup
+ */
+
+} // namespace
+
+#endif
+
+// vim: set ts=4 sw=4:
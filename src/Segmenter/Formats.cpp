@@ -0,0 +1,65 @@
+#include "Formats.hpp"
+#include "ByteCount.hpp"
+#include "ADTS.hpp"
+#include "MP3.hpp"
+#include "MpegtsH264.hpp"
+#include <iostream>
+#include <stdexcept>
+
+namespace Segmenter {
+
+template <class S>
+static Segmenter *make(const unsigned long length, const std::string extra_opts) {
+	return new S(length, extra_opts);
+}
+
+static const struct format {
+	const char *name;
+	const char *description;
+	Segmenter *(*create)(const unsigned long length, const std::string extra_opts);
+	bool (*probe)(const char *data, size_t length);
+	void (*usage)();
+} formats[] = {
+	/* In the order detect() tries them: the strongest sync pattern first */
+	{ "mpegts", "MPEG-TS with H.264 or HEVC video, cut before IDR/IRAP pictures", make<MpegtsH264>, MpegtsH264::probe, MpegtsH264::usage },
+	{ "adts", "AAC in ADTS frames, cut between frames", make<ADTS>, ADTS::probe, ADTS::usage },
+	{ "mp3", "MPEG audio frames, cut between frames", make<MP3>, MP3::probe, MP3::usage },
+	{ "bytecount", "Anything; segments of a fixed number of blocks", make<ByteCount>, ByteCount::probe, ByteCount::usage },
+};
+static const size_t num_formats = sizeof(formats)/sizeof(*formats);
+
+static const struct format *find(const std::string &name) {
+	for( size_t i = 0; i < num_formats; i++ ) {
+		if( name == formats[i].name ) return &formats[i];
+	}
+	return NULL;
+}
+
+Segmenter *create(const std::string &format, const unsigned long length, const std::string extra_opts) {
+	const struct format *f = find(format);
+	if( f == NULL ) throw std::invalid_argument("Unknown format \"" + format + "\"");
+	return f->create(length, extra_opts);
+}
+
+bool valid_format(const std::string &format) {
+	return find(format) != NULL;
+}
+
+std::string detect(const char *data, size_t length) {
+	for( size_t i = 0; i < num_formats; i++ ) {
+		if( formats[i].probe(data, length) ) return formats[i].name;
+	}
+	return "";
+}
+
+void usage() {
+	std::cerr << "Formats are:\n";
+	for( size_t i = 0; i < num_formats; i++ ) {
+		std::cerr << "\n" << formats[i].name << ": " << formats[i].description << "\n";
+		formats[i].usage();
+	}
+}
+
+} // namespace
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,27 @@
+#ifndef __FORMATS_H__
+#define __FORMATS_H__
+
+#include "Segmenter.hpp"
+#include <string>
+
+namespace Segmenter {
+
+Segmenter *create(const std::string &format, const unsigned long length, const std::string extra_opts);
+/* A new segmenter for format: "mpegts", "adts", "mp3" or "bytecount"
+ * Throws std::invalid_argument for anything else
+ */
+
+bool valid_format(const std::string &format);
+
+std::string detect(const char *data, size_t length);
+/* The format data seems to be in, judging by its sync patterns; empty if
+ * none fits. Never "bytecount"
+ */
+
+void usage();
+/* Lists the formats, with what their usage() says */
+
+} // namespace
+
+#endif
+// vim: set ts=4 sw=4:
@@ -1,5 +1,6 @@
 #include "MP3.hpp"
 #include <iostream>
+#include "SyncWord.hpp"
 
 // LCM of sample rates
 #define FRAC_SECOND 14112000
@@ -38,61 +39,83 @@ static const unsigned short samplerate[][4] = {
         /* MPEG 2   */ {22050, 24000, 16000, 0},
         /* MPEG 1   */ {44100, 48000, 32000, 0}};
 
+static size_t frame_length(const unsigned char *header) {
+	if( header[0] != 0xff || (header[1] & 0xe0) != 0xe0 ) return 0;
+
+	unsigned char version_idx = (header[1] & 0x18) >> 3;
+	unsigned char layer_idx = (header[1] & 0x06) >> 1;
+	unsigned char bitrate_idx = (header[2] & 0xf0) >> 4;
+	unsigned char samplerate_idx = (header[2] & 0x0c) >> 2;
+	unsigned char padding = (header[2] & 0x02) >> 1;
+	if( bitrate[version_idx][layer_idx][bitrate_idx] == 0
+	 || samplerate[version_idx][samplerate_idx] == 0 ) return 0;
+
+	return 144 * bitrate[version_idx][layer_idx][bitrate_idx]*1000
+		/ samplerate[version_idx][samplerate_idx]
+		+ padding;
+}
+/* Length of the MPEG audio frame, header included; 0 if it's not a valid header
+ */
+
+bool MP3::probe(const char *data, size_t length) {
+	return syncword_probe(data, length, SYNCWORD_MASK_MPEG, 4, frame_length, 3);
+}
+
 MP3::MP3(const unsigned long length, const std::string extra_opts) :
 	Segmenter(length, extra_opts),
 	m_length(length),
 	m_pos(0) {
 }
 
-float MP3::copy_segment(std::istream *in, std::ostream *out) {
+template <class In, class Out>
+float MP3::copy(In *in, const Out &out) {
+	const char *run = NULL; // Start of the frames to copy; they are written in one go
 	while( m_pos / FRAC_SECOND < m_length ) {
-		
-		try {
-			char header[4];
-			in->read(header, 4);
-
-        	while( header[0] != static_cast<char>(0xff)
-			   || (header[1] & 0xe0) != static_cast<char>(0xe0) ) {
-				// We are not in sync
-				do{
-					in->read(header, 1);
-				} while( header[0] != static_cast<char>(0xff) );
-				
-				in->read(header+1, 3);
-			}
-			
-			unsigned char version_idx = (header[1] & 0x18) >> 3;
-			unsigned char layer_idx = (header[1] & 0x06) >> 1;
-			unsigned char bitrate_idx = (header[2] & 0xf0) >> 4;
-			unsigned char samplerate_idx = (header[2] & 0x0c) >> 2;
-			unsigned char padding = (header[2] & 0x02) >> 1;
-
-			size_t len = 144 * bitrate[version_idx][layer_idx][bitrate_idx]*1000
-				/ samplerate[version_idx][samplerate_idx]
-				+ padding - 4;
-
-			if( layer_idx == 3 ) { /* Layer */
-				m_pos += 384 * (FRAC_SECOND / samplerate[version_idx][samplerate_idx]);
-			} else {
-				m_pos += 1152 * (FRAC_SECOND / samplerate[version_idx][samplerate_idx]);
-			}
-			
-			char *buf = new char[len];
-			
-			in->read(buf, len);
-
-			out->write(header, 4);
-			out->write(buf, len);
-			
-			delete buf;
-		} catch( std::ios_base::failure e ) {
-			if( ! in->eof() ) throw;
-			return -(m_pos / FRAC_SECOND);
+		if( in->available() < 4 ) write_run(out, run, in->data()); // refilling invalidates the buffer
+		if( ! in->fill(4) ) return -static_cast<float>(m_pos / FRAC_SECOND); // EOF
+		const unsigned char *header = reinterpret_cast<const unsigned char*>(in->data());
+		size_t len = frame_length(header);
+
+		if( len == 0 ) { // We are not in sync
+			write_run(out, run, in->data());
+			unsigned long long skipped = 0;
+			bool more = syncword_resync(in, SYNCWORD_MASK_MPEG, 4, frame_length, skipped);
+			std::cerr << "Lost sync, skipped " << skipped << " bytes\n";
+			if( m_stats ) m_stats->resyncs++;
+			if( m_live ) Monitor::bump(&m_live->resyncs, 1);
+			if( ! more ) return -static_cast<float>(m_pos / FRAC_SECOND);
+			continue;
+		}
+
+		unsigned char version_idx = (header[1] & 0x18) >> 3;
+		unsigned char layer_idx = (header[1] & 0x06) >> 1;
+		unsigned char samplerate_idx = (header[2] & 0x0c) >> 2;
+
+		if( layer_idx == 3 ) { /* Layer */
+			m_pos += 384 * (FRAC_SECOND / samplerate[version_idx][samplerate_idx]);
+		} else {
+			m_pos += 1152 * (FRAC_SECOND / samplerate[version_idx][samplerate_idx]);
+		}
+
+		// Add the frame, header included, to the run
+		if( in->available() < len ) write_run(out, run, in->data());
+		if( ! in->fill(len) ) return -static_cast<float>(m_pos / FRAC_SECOND);
+		if( run == NULL ) run = in->data();
+		in->consume(len);
+		if( m_live ) Monitor::publish(&m_live->bytes_in, in->offset());
+		if( m_stats ) {
+			m_stats->kept++;
+			m_stats->frames++;
 		}
 	}
-    
+	write_run(out, run, in->data());
+
 	m_pos -= m_length * FRAC_SECOND; /* Keep our error, so we don't accumulate */
-    return m_length + m_pos / FRAC_SECOND;
+	return m_length + m_pos / FRAC_SECOND;
+}
+
+float MP3::copy_segment(Input::Input *in, std::ostream *out) {
+	return dispatch(this, in, out);
 }
 
 } // namespace
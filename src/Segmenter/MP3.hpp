@@ -5,7 +5,7 @@
 
 namespace Segmenter {
 
-class MP3 : protected Segmenter {
+class MP3 : public Segmenter {
 private:
 	unsigned long m_length;
 	unsigned long long m_pos;
@@ -14,7 +14,12 @@ public:
 	MP3(const unsigned long length, const std::string extra_opts);
 	virtual ~MP3() {}
 	static void usage() {}
-	virtual float copy_segment(std::istream *in, std::ostream *out);
+	static bool probe(const char *data, size_t length);
+	/* Does data look like this format? */
+	virtual float copy_segment(Input::Input *in, std::ostream *out);
+
+	template <class In, class Out> float copy(In *in, const Out &out);
+	/* copy_segment() for one kind of input and output, see dispatch() */
 };
 
 } // namespace
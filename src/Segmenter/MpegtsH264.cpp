@@ -1,21 +1,30 @@
 #include "MpegtsH264.hpp"
+#include "TsSync.hpp"
+#include "Nal.hpp"
+#include "../Input/Memory.hpp"
+#include "../Pool.hpp"
 #include <iostream>
 #include <stdexcept>
 #include <string.h>
 
 #define TS_SYNC_BYTE 0x47
-#define PID(b) ( (( *(b) & 0x1f) << 8) | *(b+1) )
+#define PID(b) ( (( *(b) & 0x1f) << 8) | static_cast<unsigned char>(*(b+1)) )
 #define TS_PAYLOAD_UNIT_START(b) (b[1] & 0x40 )
 #define TS_PAYLOAD_START(b) (4 + (b[3] & 0x20 ? 1+b[4] : 0))
-#define TS_PCR_FREQ 90000LL
+#define TS_CLOCK_FREQ 90000LL // PCR base, PTS and DTS
+#define TS_TIMESTAMP_MASK 0x1ffffffffLL // They're 33 bits and wrap around
+#define TS_TIMESTAMP_HALF 0x100000000LL // Differences beyond this go backwards
 
-#define PAT_LENGTH(t) ( (t[1] & 0x0f) << 8 | t[2] )
-
-#define PMT_LENGTH(t) ( (t[0] & 0x0f) << 8 | t[1] )
-#define PMT_ES_LENGTH(t) ( (t[0] & 0x0f) << 8 | t[1] )
-#define PMT_ES_TYPE(t) t[0]
+#define PMT_LENGTH(t) ( ((t)[0] & 0x0f) << 8 | (t)[1] )
+#define PMT_ES_LENGTH(t) ( ((t)[0] & 0x0f) << 8 | (t)[1] )
+#define PMT_ES_TYPE(t) (t)[0]
 
 #define STREAM_TYPE_VIDEO_H264      0x1b
+#define STREAM_TYPE_VIDEO_HEVC      0x24
+
+#define PES_LOOKAHEAD (64 * TS_PACKET_SIZE) // How far to follow a PES, e.g. for its first slice
+#define PES_HEADER_SIZE 9 // Up to and including PES_header_data_length
+#define PES_TIMESTAMPS_SIZE 19 // With a PTS and a DTS
 
 #define TS_PCR(t) (   (static_cast<unsigned long long>(static_cast<unsigned char>(t[6])) << 25) \
                     | (static_cast<unsigned long long>(static_cast<unsigned char>(t[7])) << 17) \
@@ -24,16 +33,29 @@
                     | (static_cast<unsigned long long>(static_cast<unsigned char>(t[10])) >> 7) \
                   )
 
+#define PES_TIMESTAMP(t) (   (static_cast<signed long long>((t)[0] & 0x0e) << 29) \
+                           | ((t)[1] << 22) | (((t)[2] & 0xfe) << 14) \
+                           | ((t)[3] << 7) | ((t)[4] >> 1) \
+                         )
+
 namespace Segmenter {
 
 MpegtsH264::MpegtsH264(const unsigned long length, const std::string extra_opts) :
 	Segmenter(length, extra_opts),
-	m_pcr_length( length * TS_PCR_FREQ ),
-	m_pcr_segstart( -1 ),
+	m_length( length * TS_CLOCK_FREQ ),
+	m_segstart( -1 ),
+	m_pending( false ),
 	m_pmt_pid( TS_DUMMY_PID ),
-	m_h264_pid( TS_DUMMY_PID ) {
+	m_video_pid( TS_DUMMY_PID ),
+	m_video_type( 0 ),
+	m_program( 0 ),
+	m_pat_version( -1 ),
+	m_pmt_version( -1 ),
+	m_count_pid( TS_DUMMY_PID ),
+	m_count( NULL ),
+	m_psi_end( 0 ) {
+	memset(m_pid_action, 0, sizeof(m_pid_action));
 	m_idr = ( extra_opts.compare("IDR") == 0 );
-	m_pat[0] = m_pmt[0] = 0x00;
 
 	if( m_idr ) {
 		std::cerr << "Splitting every IDR, ignoring timing\n";
@@ -47,153 +69,680 @@ void MpegtsH264::usage() {
 	std::cerr << "Splits an MPEG-TS intelligently:\n"
 	          << "Parses the PAT and PMT tables to identify the stream-type\n"
 			  << "Cut the stream only right before the start of a new PES\n"
-			  << "If the stream is h264, it will only cut before an IDR-frame\n"
+			  << "If the stream is h264 or hevc, it will only cut before an IDR-frame\n"
+			  << "(or another IRAP picture in hevc: CRA or BLA)\n"
 			  << "\n"
 			  << "extra options format:\n"
 			  << "  [IDR]     if IDR is specified, the TS will be cut every IDR frame\n";
 }
 
 
-float MpegtsH264::copy_segment(std::istream *in, std::ostream *out) {
-	if( m_pat[0] == TS_SYNC_BYTE && m_pmt[0] == TS_SYNC_BYTE ) {
+bool MpegtsH264::probe(const char *data, size_t length) {
+	size_t off = ts_sync_scan(data, length);
+	return off + (TS_SYNC_PACKETS-1) * TS_PACKET_SIZE < length && data[off] == TS_SYNC_BYTE;
+}
+
+bool MpegtsH264::resync(Input::Input *in, bool quiet) {
+	unsigned long long skipped = 0;
+	bool eof = false;
+	while( 1 ) {
+		if( ! in->fill(TS_SYNC_PACKETS * TS_PACKET_SIZE) ) eof = true;
+		// Near the end of the stream, settle for the packets that are left
+		unsigned packets = eof ? in->available() / TS_PACKET_SIZE : TS_SYNC_PACKETS;
+		if( packets == 0 ) {
+			skipped += in->available();
+			in->consume(in->available());
+			break;
+		}
+		if( packets > TS_SYNC_PACKETS ) packets = TS_SYNC_PACKETS;
+
+		size_t off = ts_sync_scan(in->data(), in->available(), packets);
+		in->consume(off);
+		skipped += off;
+		if( in->available() >= (packets-1) * TS_PACKET_SIZE + 1 ) {
+			break; // Found a sync pattern
+		}
+		if( eof ) {
+			skipped += in->available();
+			in->consume(in->available());
+			break;
+		}
+	}
+	if( ! quiet ) std::cerr << "Lost TS-sync, skipped " << skipped << " bytes\n";
+	return in->available() >= TS_PACKET_SIZE;
+}
+
+bool MpegtsH264::parse_psi(const char *pkt, pid_t pid) {
+	if( m_pat.empty() ) { // Parse a PAT to find this
+		if( pid != 0 ) return false; // Not a PAT
+		update_psi(pkt, PID_PAT);
+		return true;
+	}
+
+	// Parse the PMT to find these
+	if( pid != m_pmt_pid ) return false; // Not the PMT
+	update_psi(pkt, PID_PMT);
+	return true;
+}
+
+void MpegtsH264::update_psi(const char *pkt, unsigned char action) {
+	SectionAssembler &assembler = ( action & PID_PAT ) ? m_pat_sections : m_pmt_sections;
+	const std::vector<SectionAssembler::Section> &sections = assembler.push(pkt);
+	for( size_t i = 0; i < sections.size(); i++ ) {
+		const SectionAssembler::Section &section = sections[i];
+		const unsigned char *s = reinterpret_cast<const unsigned char*>(section.data.data());
+		if( ! PSI_CURRENT(s) || PSI_SECTION_NUMBER(s) != 0 ) continue; // Single-section tables only
+		if( action & PID_PAT ) {
+			if( PSI_TABLE_ID(s) != PSI_TABLE_ID_PAT || static_cast<int>(PSI_VERSION(s)) == m_pat_version ) continue;
+			use_pat(section);
+		} else {
+			if( PSI_TABLE_ID(s) != PSI_TABLE_ID_PMT || PSI_EXTENSION(s) != m_program ) continue; // Another program's
+			if( static_cast<int>(PSI_VERSION(s)) == m_pmt_version ) continue;
+			if( m_pmt.empty() ) {
+				parse_pmt(section);
+				continue;
+			}
+			std::cerr << "PMT version " << m_pmt_version << " changed to " << PSI_VERSION(s) << "\n";
+			try {
+				parse_pmt(section);
+			} catch( std::logic_error &e ) {
+				std::cerr << "Keeping the previous PMT\n";
+				m_pmt_version = PSI_VERSION(s); // Don't try this one again
+			}
+		}
+	}
+}
+
+void MpegtsH264::use_pat(const SectionAssembler::Section &section) {
+	const unsigned char *s = reinterpret_cast<const unsigned char*>(section.data.data());
+	const unsigned char *end = s + section.data.size() - PSI_CRC_SIZE;
+	unsigned program = 0, programs = 0;
+	pid_t pmt_pid = TS_DUMMY_PID;
+	for( const unsigned char *q = s + PSI_HEADER_SIZE; q + 4 <= end; q += 4 ) {
+		if( (q[0] << 8 | q[1]) == 0 ) continue; // Network PID
+		program = q[0] << 8 | q[1];
+		pmt_pid = PID(q+2);
+		programs++;
+	}
+	if( programs != 1 ) {
+		if( m_pat.empty() ) throw std::logic_error("Not implemented: Seems to be an MPTS");
+		std::cerr << "PAT now lists " << programs << " programs, keeping the previous one\n";
+		m_pat_version = PSI_VERSION(s); // Don't try this one again
+		return;
+	}
+
+	if( ! m_pat.empty() ) std::cerr << "PAT version " << m_pat_version << " changed to " << PSI_VERSION(s) << "\n";
+	if( pmt_pid != m_pmt_pid || program != m_program ) { // Wait for the new PMT, dropping the old one
+		if( m_pmt_pid != TS_DUMMY_PID ) m_pid_action[m_pmt_pid] &= ~(PID_KEEP | PID_PMT);
+		m_pid_action[pmt_pid] |= PID_KEEP | PID_PMT;
+		m_pmt_sections.reset();
+		m_pmt_version = -1;
+		std::cerr << "Parsed PAT, using PMT PID " << pmt_pid << "\n";
+	}
+	m_pid_action[0] = PID_KEEP | PID_PAT;
+	m_program = program;
+	m_pmt_pid = pmt_pid;
+	m_pat_version = PSI_VERSION(s);
+	m_pat = section.packets; // Segments start with these
+}
+
+void MpegtsH264::parse_pmt(const SectionAssembler::Section &section) {
+	const unsigned char *s = reinterpret_cast<const unsigned char*>(section.data.data());
+	const unsigned char *end = s + section.data.size() - PSI_CRC_SIZE;
+	const unsigned char *q = s + PSI_HEADER_SIZE + 4; // After the PCR PID and program info length
+	if( q > end ) throw std::logic_error("PMT too short");
+	q += PMT_LENGTH(q - 2); // skip over the program info descriptor
+	// we are now at the first byte of the ES-list
+	unsigned char action[TS_PID_COUNT];
+	memset(action, 0, sizeof(action));
+	action[0] = PID_KEEP | PID_PAT;
+	action[m_pmt_pid] = PID_KEEP | PID_PMT;
+	pid_t video_pid = TS_DUMMY_PID;
+	unsigned char video_type = 0;
+	unsigned media = 0;
+	std::cerr << "Parsed PMT: media PIDs: ";
+	for( ; q + 5 <= end; q += 5 + PMT_ES_LENGTH(q + 3) ) {
+		pid_t es_pid = PID(q+1);
+		action[es_pid] |= PID_KEEP | PID_PES;
+		media++;
+		if( PMT_ES_TYPE(q) == STREAM_TYPE_VIDEO_H264 ) {
+			video_pid = es_pid;
+			video_type = PMT_ES_TYPE(q);
+			std::cerr << es_pid << "(h264) ";
+		} else if( PMT_ES_TYPE(q) == STREAM_TYPE_VIDEO_HEVC ) {
+			video_pid = es_pid;
+			video_type = PMT_ES_TYPE(q);
+			std::cerr << es_pid << "(hevc) ";
+		} else {
+			std::cerr << es_pid << " ";
+		}
+	}
+	if( media == 0 ) {
+		std::cerr << "None found, exiting...\n";
+		throw std::logic_error("No media PID's found");
+	}
+	if( video_pid == TS_DUMMY_PID ) {
+		std::cerr << "No h264 or hevc PID found, exiting...\n";
+		throw std::logic_error("No h264 or hevc PID found");
+	}
+	std::cerr << "\n";
+
+	action[video_pid] |= PID_VIDEO;
+	Clocks clocks;
+	for( pid_t pid = 0; pid < TS_PID_COUNT; pid++ ) {
+		if( ! (action[pid] & PID_PES) ) continue;
+		struct es_clock c = { pid, -1 };
+		for( size_t i = 0; i < m_clocks.size(); i++ ) {
+			if( m_clocks[i].pid == pid ) c = m_clocks[i]; // Still the same stream
+		}
+		clocks.push_back(c);
+	}
+	m_clocks.swap(clocks);
+	memcpy(m_pid_action, action, sizeof(action));
+	m_video_pid = video_pid;
+	m_video_type = video_type;
+	m_pmt_version = PSI_VERSION(s);
+	m_pmt = section.packets; // Segments start with these
+}
+
+bool MpegtsH264::psi_current(const char *pkt, unsigned char action) const {
+	if( ! TS_PAYLOAD_UNIT_START(pkt) ) return true; // No section starts here
+	const unsigned char *p = reinterpret_cast<const unsigned char*>(pkt);
+	const unsigned char *end = p + TS_PACKET_SIZE;
+	const unsigned char *q = p + TS_PAYLOAD_START(p);
+	if( q >= end ) return true;
+	for( q += 1 + *q; q < end && *q != 0xff; q += 3 + PSI_LENGTH(q) ) {
+		if( q + PSI_HEADER_SIZE > end ) return false; // Can't tell
+		if( ! PSI_CURRENT(q) || PSI_SECTION_NUMBER(q) != 0 ) continue;
+		if( action & PID_PAT ) {
+			if( PSI_TABLE_ID(q) == PSI_TABLE_ID_PAT && static_cast<int>(PSI_VERSION(q)) != m_pat_version ) return false;
+		} else {
+			if( PSI_TABLE_ID(q) == PSI_TABLE_ID_PMT && PSI_EXTENSION(q) == m_program
+			 && static_cast<int>(PSI_VERSION(q)) != m_pmt_version ) return false;
+		}
+	}
+	return true;
+}
+
+void MpegtsH264::forget_psi() {
+	m_pat.clear();
+	m_pmt.clear();
+	m_pat_sections.reset();
+	m_pmt_sections.reset();
+	m_pmt_pid = m_video_pid = TS_DUMMY_PID;
+	m_video_type = 0;
+	m_program = 0;
+	m_pat_version = m_pmt_version = -1;
+	memset(m_pid_action, 0, sizeof(m_pid_action));
+	m_clocks.clear();
+	m_psi_runs.clear();
+}
+
+template <class F>
+int MpegtsH264::follow_pes(const char *pkt, size_t available, F &f) {
+	pid_t pid = PID(pkt+1);
+	size_t limit = available < PES_LOOKAHEAD ? available : PES_LOOKAHEAD;
+	for( size_t off = 0; off + TS_PACKET_SIZE <= limit; off += TS_PACKET_SIZE ) {
+		const unsigned char *p = reinterpret_cast<const unsigned char*>(pkt + off);
+		if( off > 0 ) {
+			if( p[0] != TS_SYNC_BYTE ) return PES_NO; // Lost sync
+			if( PID(p+1) != pid ) continue;
+			if( TS_PAYLOAD_UNIT_START(p) ) return PES_NO; // The next PES
+		}
+		if( ! (p[3] & 0x10) ) continue; // No payload
+		const unsigned char *q = p + TS_PAYLOAD_START(p);
+		if( q < p + TS_PACKET_SIZE && f(q, p + TS_PACKET_SIZE) ) return PES_YES;
+	}
+	return limit < PES_LOOKAHEAD ? PES_MORE : PES_NO;
+}
+
+class FirstSlice {
+	/* Skips the PES header, then has the access unit classified */
+	size_t m_pes, m_header; // PES bytes so far, and the length of its header once known
+public:
+	AccessUnitScanner au;
+	AccessUnitScanner::Result result;
+
+	FirstSlice(AccessUnitScanner::Codec codec) : m_pes(0), m_header(PES_HEADER_SIZE), au(codec), result(AccessUnitScanner::UNDECIDED) {}
+	bool operator()(const unsigned char *q, const unsigned char *end) {
+		for( ; q < end && m_pes < PES_HEADER_SIZE; q++, m_pes++ ) {
+			if( m_pes == PES_HEADER_SIZE - 1 ) m_header = PES_HEADER_SIZE + *q;
+		}
+		size_t skip = m_header - m_pes;
+		if( skip > static_cast<size_t>(end - q) ) skip = end - q;
+		q += skip;
+		m_pes += skip;
+		if( q < end ) result = au.push(reinterpret_cast<const char*>(q), end - q);
+		return result != AccessUnitScanner::UNDECIDED;
+	}
+};
+
+int MpegtsH264::opens_gop(const char *pkt, size_t available, unsigned char action) const {
+	if( m_video_pid != TS_DUMMY_PID && ! (action & PID_VIDEO) ) return PES_NO; // if video_pid is set, only match on that pid
+	if( ! TS_PAYLOAD_UNIT_START(pkt) ) return PES_NO; // not the start of a new PES
+
+	FirstSlice f(m_video_type == STREAM_TYPE_VIDEO_HEVC ? AccessUnitScanner::HEVC : AccessUnitScanner::H264);
+	int found = follow_pes(pkt, available, f);
+	if( found != PES_YES ) return found;
+	return f.result == AccessUnitScanner::RANDOM_ACCESS ? PES_YES : PES_NO;
+}
+
+class PesHeader {
+	/* Collects the start of the PES header, up to the timestamps */
+public:
+	unsigned char b[PES_TIMESTAMPS_SIZE];
+	size_t n;
+
+	PesHeader() : n(0) {}
+	size_t want() const { // Up to the DTS if there's one
+		return ( n >= 8 && (b[7] & 0xc0) == 0xc0 ) ? PES_TIMESTAMPS_SIZE : PES_TIMESTAMPS_SIZE - 5;
+	}
+	bool operator()(const unsigned char *q, const unsigned char *end) {
+		while( q < end && n < want() ) b[n++] = *q++;
+		return n >= want();
+	}
+};
+
+int MpegtsH264::pes_timestamps(const char *pkt, size_t available, signed long long &pts, signed long long &dts) {
+	PesHeader h;
+	int found = follow_pes(pkt, available, h);
+	if( found != PES_YES ) return found;
+	const unsigned char *pes = h.b;
+	if( pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01 ) return PES_NO; // No PES start code
+	if( (pes[6] & 0xc0) != 0x80 || ! (pes[7] & 0x80) ) return PES_NO; // No optional header, or no PTS in it
+	pts = PES_TIMESTAMP(pes + 9);
+	dts = ( pes[7] & 0x40 ) ? PES_TIMESTAMP(pes + 14) : pts;
+	return PES_YES;
+}
+
+template <class In, class Out>
+const char *MpegtsH264::look_ahead(In *in, const Out &out, const char *&run) {
+	write_run(out, run, in->data()); // refilling invalidates the buffer
+	in->fill(PES_LOOKAHEAD);
+	return in->data();
+}
+
+void MpegtsH264::tick(Clocks &clocks, pid_t pid, signed long long pts, signed long long dts,
+                      signed long long &start, signed long long &end) {
+	if( start == -1 ) start = pts;
+	long long frame = 0; // Until its next PES, going by the one before
+	for( size_t i = 0; i < clocks.size(); i++ ) {
+		if( clocks[i].pid != pid ) continue;
+		if( clocks[i].last != -1 ) {
+			frame = (dts - clocks[i].last) & TS_TIMESTAMP_MASK;
+			if( frame >= TS_TIMESTAMP_HALF ) frame = 0; // Went back
+		}
+		clocks[i].last = dts;
+		break;
+	}
+	signed long long reach = (pts + frame) & TS_TIMESTAMP_MASK;
+	if( end == -1 || ((reach - end) & TS_TIMESTAMP_MASK) < TS_TIMESTAMP_HALF ) end = reach;
+}
+
+bool MpegtsH264::enough(signed long long pts, signed long long segstart, signed long long start) const {
+	return start != -1
+	    && ((pts - segstart) & TS_TIMESTAMP_MASK) >= m_length // Enough seconds
+	    && ((pts - start) & TS_TIMESTAMP_MASK) != 0; // Never an empty segment
+}
+
+void MpegtsH264::advance(signed long long &segstart, signed long long pts) const {
+	segstart = (segstart + m_length) & TS_TIMESTAMP_MASK;
+	if( ((pts - segstart) & TS_TIMESTAMP_MASK) >= m_length ) {
+		segstart = pts; // A whole segment behind, after a long GOP or a jump in the timestamps
+	}
+}
+
+float MpegtsH264::seconds(signed long long start, signed long long end) {
+	if( start == -1 ) return 0;
+	return static_cast<double>((end - start) & TS_TIMESTAMP_MASK) / TS_CLOCK_FREQ;
+}
+
+template <class In, class Out>
+float MpegtsH264::copy(In *in, const Out &out) {
+	if( ! m_pat.empty() && ! m_pmt.empty() ) {
 		// Start new files with PAT and PMT
-		out->write(m_pat, TS_PACKET_SIZE);
-		out->write(m_pmt, TS_PACKET_SIZE);
+		out.write(m_pat.data(), m_pat.size());
+		out.write(m_pmt.data(), m_pmt.size());
 	}	
 
-	signed long long pcr = -1, pcr_segstart_actual = -1;
+	signed long long start = -1, end = -1; // See tick()
+	signed long long pts, dts;
+	const char *run = NULL; // Start of the packets to copy; they are written in one go
+	m_count_pid = TS_DUMMY_PID; // m_stats may have been cleared
 	while( 1 ) { /* exit loop on break */
 		pid_t pid;
-		if( m_pkt[0] == TS_SYNC_BYTE ) goto copy_packet; // buffer still contains a packet from previous iteration
+		unsigned char action;
+		const char *pkt;
 
-		try {
-			in->read(m_pkt, TS_PACKET_SIZE);
+		if( in->available() < TS_PACKET_SIZE ) {
+			write_run(out, run, in->data()); // refilling invalidates the buffer
+			if( ! in->fill(TS_PACKET_SIZE) ) {
+				return -seconds(start, end);
+			}
+		}
+		pkt = in->data();
+
+		if( m_pending ) { // The IDR frame that ended the previous segment opens this one
+			m_pending = false;
+			int found = pes_timestamps(pkt, in->available(), pts, dts);
+			if( found == PES_MORE ) {
+				pkt = look_ahead(in, out, run);
+				found = pes_timestamps(pkt, in->available(), pts, dts);
+			}
+			if( found == PES_YES ) tick(m_clocks, PID(pkt+1), pts, dts, start, end);
+			goto copy_packet;
+		}
 
-			if( m_pkt[0] != TS_SYNC_BYTE ) {
-				std::cerr << "Lost TS-sync\n";
-				return -((pcr - m_pcr_segstart) & 0x1ffffffffLL ) / TS_PCR_FREQ;
+		if( pkt[0] != TS_SYNC_BYTE ) {
+			write_run(out, run, pkt);
+			if( m_stats ) m_stats->resyncs++;
+			if( m_live ) Monitor::bump(&m_live->resyncs, 1);
+			if( ! resync(in) ) {
+				return -seconds(start, end);
 			}
-		} catch( std::ios_base::failure e ) {
-			if( ! in->eof() ) throw;
-			return -((pcr - pcr_segstart_actual) & 0x1ffffffffLL ) / TS_PCR_FREQ;
+			continue;
 		}
 
-		pid = PID(m_pkt+1); // PID is located after the sync-byte
+		pid = PID(pkt+1); // PID is located after the sync-byte
 
 		
-		if( m_pat[0] != TS_SYNC_BYTE ) { // Parse a PAT to find this
-			if( pid != 0 ) goto next_packet; // Not a PAT
-			if( ! TS_PAYLOAD_UNIT_START(m_pkt) ) goto next_packet; // Table doesn't start here
-			char *q = m_pkt + TS_PAYLOAD_START(m_pkt);
-			if( *q != 0x00 ) {
-				throw std::logic_error("Not implemented: table pointers");
-				// Because that probably needs glueing multiple TS-payloads together
-			}
-			q++;
-			// Parse the PAT
-			if( PAT_LENGTH(q) != 13 ) {
-				throw std::logic_error("Not implemented: Seems to be an MPTS");
-			}
-			q += 10;
-			m_pmt_pid = PID( q );
-			std::cerr << "Parsed PAT, using PMT PID " << m_pmt_pid << "\n";
-			memcpy(m_pat, m_pkt, TS_PACKET_SIZE); // keep the PAT
-			
-			goto copy_packet;
+		if( m_pmt.empty() ) { // Still looking for the PAT and PMT
+			if( parse_psi(pkt, pid) ) goto copy_packet;
+			goto drop_packet;
 		}
 
-		if( m_pmt[0] != TS_SYNC_BYTE ) { // Parse the PMT to find these
-			unsigned char length;
+		action = m_pid_action[pid];
+		if( action & (PID_PAT | PID_PMT) ) { // Rebuilds m_pid_action if a new version is complete
+			update_psi(pkt, action);
+			action = m_pid_action[pid];
+		}
+
+		if( m_stats && has_pcr(pkt) ) {
+			signed long long pcr = TS_PCR(pkt);
+			if( m_stats->first_pcr == -1 ) m_stats->first_pcr = pcr;
+			m_stats->last_pcr = pcr;
+		}
 
-			if( pid != m_pmt_pid ) goto next_packet; // Not the PMT
-			if( ! TS_PAYLOAD_UNIT_START(m_pkt) ) goto next_packet; // Table doesn't start here
-			char *q = m_pkt + TS_PAYLOAD_START(m_pkt);
-			if( *q != 0x00 ) {
-				throw std::logic_error("Not implemented: SI table-pointers"); //TODO
-				// Because that probably needs glueing multiple TS-payloads together
+		if( (action & PID_PES) && TS_PAYLOAD_UNIT_START(pkt) ) {
+			int found = pes_timestamps(pkt, in->available(), pts, dts);
+			if( found == PES_MORE ) { // The PES header goes on in later packets
+				pkt = look_ahead(in, out, run);
+				found = pes_timestamps(pkt, in->available(), pts, dts);
 			}
-			q++; // skip over pointer
-			// Parse the PMT, seek to the elementary PID list
-			q++; // skip over table-id
-			length = PMT_LENGTH(q) - 9 - 4; // rest of the header and CRC
-			q += 9; // Move to the program info length field
-			length -= PMT_LENGTH(q); // skip over the program info descriptor
-			q += 2 + PMT_LENGTH(q);
-			// we are now at the first byte of the ES-list
-			std::cerr << "Parsed PMT: media PIDs: ";
-			while( length > 0 ) {
-				q += 1;
-				pid_t es_pid = PID(q);
-				q -= 1;	// TODO
-				m_media_pids.insert( es_pid );
-				if( PMT_ES_TYPE(q) == STREAM_TYPE_VIDEO_H264 ) {
-					m_h264_pid = es_pid;
-					std::cerr << es_pid << "(h264) ";
-				} else {
-					std::cerr << es_pid << " ";
+			if( found != PES_YES ) goto keep_or_drop;
+
+			if( m_segstart == -1 ) m_segstart = pts;
+			// Should we switch to the next segment?
+			if( enough(pts, m_segstart, start) ) {
+				int gop = opens_gop(pkt, in->available(), action);
+				if( gop == PES_MORE ) { // Its first slice is further on
+					pkt = look_ahead(in, out, run);
+					gop = opens_gop(pkt, in->available(), action);
+				}
+				if( gop == PES_YES ) {
+					// IDR frame, switch now
+					// This packet stays in the buffer and opens the next segment
+					m_pending = true;
+					end = pts;
+					break;
 				}
-				q += 3;
-				length -= 3 + 2 + PMT_ES_LENGTH(q);
-				q += 2 + PMT_ES_LENGTH(q);
-			}
-			if( m_media_pids.size() == 0 ) {
-				std::cerr << "None found, exiting...\n";
-				throw std::logic_error("No media PID's found");
 			}
-			if( m_h264_pid == TS_DUMMY_PID ) {
-				std::cerr << "No h264 PID found, exiting...\n";
-				throw std::logic_error("No h264 PID found");
+			tick(m_clocks, pid, pts, dts, start, end);
+		}
+
+	keep_or_drop:
+		if( action & PID_KEEP ) goto copy_packet;
+		goto drop_packet;
+
+	copy_packet:
+		if( m_stats ) count(pkt, true);
+		if( run == NULL ) run = pkt; // Extend the current run of packets
+		in->consume(TS_PACKET_SIZE);
+		if( m_live ) Monitor::publish(&m_live->bytes_in, in->offset());
+		continue;
+
+	drop_packet:
+		if( m_stats ) count(pkt, false);
+		write_run(out, run, pkt); // A dropped packet splits the run
+		in->consume(TS_PACKET_SIZE);
+		if( m_live ) Monitor::publish(&m_live->bytes_in, in->offset());
+	}
+	write_run(out, run, in->data());
+
+	advance(m_segstart, end);
+
+	return seconds(start, end);
+}
+
+float MpegtsH264::copy_segment(Input::Input *in, std::ostream *out) {
+	return dispatch(this, in, out);
+}
+
+void MpegtsH264::count(const char *pkt, bool kept) {
+	pid_t pid = PID(pkt+1);
+	if( pid != m_count_pid ) {
+		m_count = &m_stats->pids[pid];
+		m_count_pid = pid;
+	}
+	if( ! kept ) {
+		m_count->dropped++;
+		m_stats->dropped++;
+		return;
+	}
+	m_count->kept++;
+	m_stats->kept++;
+
+	if( pid != m_video_pid || ! TS_PAYLOAD_UNIT_START(pkt) ) return;
+	m_stats->frames++;
+	signed long long pts, dts;
+	if( pes_timestamps(pkt, TS_PACKET_SIZE, pts, dts) != PES_YES ) return; // Only if the header is all in pkt
+	if( m_stats->first_pts == -1 ) {
+		m_stats->first_pts = m_stats->last_pts = pts;
+		return;
+	}
+	// Pictures may be reordered, and timestamps wrap around
+	if( ((pts - m_stats->first_pts) & TS_TIMESTAMP_MASK) >= TS_TIMESTAMP_HALF ) m_stats->first_pts = pts;
+	if( ((pts - m_stats->last_pts) & TS_TIMESTAMP_MASK) < TS_TIMESTAMP_HALF ) m_stats->last_pts = pts;
+}
+
+#define SPLIT_MIN_CHUNK (4*1024*1024)
+
+void MpegtsH264::scan(const char *data, size_t length, struct chunk &c) const {
+	Input::Memory in(data + c.begin, data + length, c.begin);
+	c.start = c.stop = length;
+	c.eof = false;
+	c.psi_changed = false;
+	bool started = false;
+	while( 1 ) {
+		if( in.available() < TS_PACKET_SIZE ) {
+			c.eof = true;
+			break;
+		}
+		const char *pkt = in.data();
+		if( pkt[0] != TS_SYNC_BYTE ) {
+			if( ! resync(&in, true) ) { // copy_span() will tell
+				c.eof = true;
+				break;
 			}
-			std::cerr << "\n";
+			continue;
+		}
+		if( ! started ) {
+			c.start = in.offset(); // May lie beyond c.end already
+			started = true;
+		}
+		if( in.offset() >= c.end ) {
+			c.stop = in.offset();
+			break;
+		}
 
-			memcpy(m_pmt, m_pkt, TS_PACKET_SIZE); // keep the PMT
+		unsigned char action = m_pid_action[PID(pkt+1)];
+		if( (action & (PID_PAT | PID_PMT)) && ! psi_current(pkt, action) ) {
+			c.psi_changed = true; // copy_segment() might switch tables here
+		}
+		struct event e;
+		if( (action & PID_PES) && TS_PAYLOAD_UNIT_START(pkt) && pes_timestamps(pkt, in.available(), e.pts, e.dts) == PES_YES ) {
+			e.pos = in.offset();
+			e.pid = PID(pkt+1);
+			e.gop = opens_gop(pkt, in.available(), action) == PES_YES;
+			c.events.push_back(e);
+		}
+		in.consume(TS_PACKET_SIZE);
+	}
+}
 
-			goto copy_packet;
+class MpegtsH264::ScanTask : public Pool::Task {
+	const MpegtsH264 &m_seg;
+	const char *m_data;
+	size_t m_length;
+	struct chunk &m_chunk;
+public:
+	ScanTask(const MpegtsH264 &seg, const char *data, size_t length, struct chunk &c) :
+		m_seg(seg), m_data(data), m_length(length), m_chunk(c) {}
+	virtual bool Step() {
+		m_seg.scan(m_data, m_length, m_chunk);
+		return false;
+	}
+};
+
+bool MpegtsH264::split(const char *data, size_t length, unsigned threads, std::vector<Span> &spans) {
+	if( ! m_pmt.empty() || m_pending ) return false; // Only from the start
+
+	// Find the PAT and PMT the way copy_segment() does
+	Input::Memory in(data, data + length);
+	while( m_pmt.empty() ) {
+		if( in.available() < TS_PACKET_SIZE ) break;
+		const char *pkt = in.data();
+		if( pkt[0] != TS_SYNC_BYTE ) {
+			if( ! resync(&in) ) break;
+			continue;
+		}
+		if( parse_psi(pkt, PID(pkt+1)) ) {
+			m_psi_runs.push_back( std::make_pair(in.offset(), TS_PACKET_SIZE) );
+		}
+		in.consume(TS_PACKET_SIZE);
+	}
+	if( m_pmt.empty() ) { // Nothing worth splitting up
+		forget_psi();
+		return false;
+	}
+	m_psi_end = in.offset();
+
+	// Walk the rest in chunks, in parallel
+	if( threads < 1 ) threads = 1;
+	size_t count = threads * 4;
+	if( count > (length - m_psi_end) / SPLIT_MIN_CHUNK + 1 ) count = (length - m_psi_end) / SPLIT_MIN_CHUNK + 1;
+	unsigned long long step = ((length - m_psi_end) / count / TS_PACKET_SIZE + 1) * TS_PACKET_SIZE;
+	count = (length - m_psi_end + step - 1) / step; // Rounding up step may leave chunks empty
+	if( count < 1 ) count = 1;
+	std::vector<struct chunk> chunks(count);
+	Pool pool(threads);
+	std::vector<ScanTask*> tasks;
+	for( size_t i = 0; i < count; i++ ) {
+		chunks[i].begin = m_psi_end + i * step;
+		chunks[i].end = (i+1 < count) ? chunks[i].begin + step : length;
+		tasks.push_back( new ScanTask(*this, data, length, chunks[i]) );
+		pool.Add(tasks.back());
+	}
+	pool.Run();
+	for( size_t i = 0; i < tasks.size(); i++ ) delete tasks[i];
+	for( size_t i = 0; i < count; i++ ) {
+		if( chunks[i].psi_changed ) { // Cut points would depend on which PMT applies where
+			forget_psi();
+			return false;
+		}
+	}
+
+	/* Stitch: replay the events through the rules of copy_segment().
+	 * A chunk is only valid if its walk started on the packet where the
+	 * previous one stopped; corruption near a boundary can throw the
+	 * speculative walk off, then that chunk is walked again from there
+	 */
+	signed long long segstart = m_segstart;
+	signed long long start = -1, end = -1;
+	Clocks clocks = m_clocks;
+	struct Span seg = { 0, 0, 0 };
+	for( size_t i = 0; i < count; i++ ) {
+		struct chunk &c = chunks[i];
+		if( i > 0 && c.start != chunks[i-1].stop ) {
+			c.begin = chunks[i-1].stop;
+			c.events.clear();
+			scan(data, length, c);
+			if( c.psi_changed ) {
+				spans.clear();
+				forget_psi();
+				return false;
+			}
 		}
 
-		if( (m_pkt[3] & 0x20)	// Adaptation field present
-		 && m_pkt[4]	// Adaptation field length > 0
-		 && m_pkt[5] & 0x10 ) { // PCR present
-			pcr = TS_PCR(m_pkt);
-		 	if( pcr_segstart_actual == -1 ) {
-				pcr_segstart_actual = pcr;
+		for( typeof(c.events.begin()) e = c.events.begin(); e != c.events.end(); e++ ) {
+			if( segstart == -1 ) segstart = e->pts;
+			if( e->gop && enough(e->pts, segstart, start) ) {
+				seg.end = e->pos;
+				seg.duration = seconds(start, e->pts);
+				spans.push_back(seg);
+				advance(segstart, e->pts);
+
+				seg.begin = e->pos; // Opens the next one
+				start = end = -1;
 			}
+			tick(clocks, e->pid, e->pts, e->dts, start, end);
+		}
+		if( c.eof ) break;
+	}
+	seg.end = length;
+	seg.duration = -seconds(start, end);
+	spans.push_back(seg);
+	return true;
+}
+
+template <class Out>
+void MpegtsH264::copy_span_to(const char *data, size_t length, const std::vector<Span> &spans, size_t n, const Out &out) {
+	const Span &span = spans.at(n);
+	unsigned long long from = span.begin;
+	if( n == 0 ) {
+		for( size_t i = 0; i < m_psi_runs.size(); i++ ) {
+			out.write(data + m_psi_runs[i].first, m_psi_runs[i].second);
 		}
+		from = m_psi_end;
+	} else {
+		// Start new files with PAT and PMT
+		out.write(m_pat.data(), m_pat.size());
+		out.write(m_pmt.data(), m_pmt.size());
+	}
 
-		// Should we switch to the next segment?
-		if( ((pcr - m_pcr_segstart) & 0x1ffffffffLL) >= m_pcr_length // Enough seconds
-		 && (m_h264_pid == TS_DUMMY_PID || pid == m_h264_pid) // if h264_pid is set, only match on that pid
-		 && TS_PAYLOAD_UNIT_START(m_pkt) // start of a new PES
-		 ) { // Parse the PES header
-			char *q = m_pkt;
-			q += TS_PAYLOAD_START(q);
-			q += 8;
-			q += 1 + *q; // Header length field
-			
-			// What NAL do we have?
-			if( *(q+4) == 0x09 ) q += 6; // NAL is an AUD, skip it
+	Input::Memory in(data + from, data + length, from);
+	bool opening = n > 0;
+	const char *run = NULL;
+	while( in.available() >= TS_PACKET_SIZE && in.offset() < span.end ) {
+		const char *pkt = in.data();
+		if( opening ) {
+			opening = false;
+			goto copy_packet;
+		}
 
-			if( *(q+4) == 0x67 )// NAL is an SPS
-				break; // IDR frame, switch now
+		if( pkt[0] != TS_SYNC_BYTE ) {
+			write_run(out, run, pkt);
+			if( ! resync(&in) ) break;
+			continue;
 		}
 
-		// Copy this packet?
-		if( pid == 0 ) goto copy_packet;
-		if( pid == m_pmt_pid) goto copy_packet;
-		if( m_media_pids.find( pid ) != m_media_pids.end() ) goto copy_packet;
+		if( m_pid_action[PID(pkt+1)] & PID_KEEP ) goto copy_packet;
 
-		goto next_packet;
+		// drop packet
+		write_run(out, run, pkt); // A dropped packet splits the run
+		in.consume(TS_PACKET_SIZE);
+		continue;
 
 	copy_packet:
-		out->write(m_pkt, TS_PACKET_SIZE);
-
-	next_packet:
-		m_pkt[0] = 0x00; // mark buffer as written
+		if( run == NULL ) run = pkt; // Extend the current run of packets
+		in.consume(TS_PACKET_SIZE);
 	}
+	write_run(out, run, in.data());
+}
 
-	m_pcr_segstart += m_pcr_length;
-
-	return ((pcr - pcr_segstart_actual) & 0x1ffffffffLL ) / TS_PCR_FREQ;
+void MpegtsH264::copy_span(const char *data, size_t length, const std::vector<Span> &spans, size_t n, std::ostream *out) {
+	if( out ) copy_span_to(data, length, spans, n, StreamOutput(out));
+	else copy_span_to(data, length, spans, n, NoOutput());
 }
 
 } // namespace
@@ -2,28 +2,170 @@
 #define __MPEGTSH264_H__
 
 #include "Segmenter.hpp"
-#include <set>
+#include "Psi.hpp"
+#include <vector>
+#include <utility>
 
 #define TS_PACKET_SIZE 188
 #define TS_DUMMY_PID 0x2000 // Out of range, will never match
+#define TS_PID_COUNT 0x2000
 
 namespace Segmenter {
 
 class MpegtsH264: public Segmenter {
 private:
-	long long m_pcr_length;
-	signed long long m_pcr_segstart;
+	long long m_length; // Target segment duration, in 90 kHz ticks
+	signed long long m_segstart;
+	/* PTS where the target duration of the current segment is counted
+	 * from; -1 until the first PTS
+	 */
 	bool m_idr;
-	char m_pat[TS_PACKET_SIZE], m_pmt[TS_PACKET_SIZE], m_pkt[TS_PACKET_SIZE];
+	std::string m_pat, m_pmt;
+	/* The TS packets of the current PAT and PMT, to start every segment
+	 * with; empty until found
+	 */
+	SectionAssembler m_pat_sections, m_pmt_sections;
+	bool m_pending; // The packet at m_in->data() opens the next segment
 	typedef unsigned short pid_t;
-	pid_t m_pmt_pid, m_h264_pid;
-	std::set<pid_t> m_media_pids;
+	pid_t m_pmt_pid, m_video_pid;
+	unsigned char m_video_type; // Stream type of m_video_pid: H.264 or HEVC
+	unsigned m_program; // Number, from the PAT
+
+	enum {
+		PID_KEEP = 0x01, // PAT, PMT and the elementary streams; the rest is dropped
+		PID_PMT = 0x02,
+		PID_VIDEO = 0x04, // The H.264 or HEVC stream, where segments start
+		PID_PAT = 0x08,
+		PID_PES = 0x10 // Elementary streams, whose PES headers carry the timestamps
+	};
+	unsigned char m_pid_action[TS_PID_COUNT];
+	/* What to do with packets of every PID, so deciding takes a single
+	 * load. Built from the PMT; all zeroes before that
+	 */
+	int m_pat_version, m_pmt_version; // Of m_pat and m_pmt, -1 if unknown
+
+	struct es_clock {
+		pid_t pid;
+		signed long long last; // Decode time of its latest PES, -1 if none yet
+	};
+	typedef std::vector<struct es_clock> Clocks;
+	Clocks m_clocks; // One per elementary stream, from the PMT
+
+	bool parse_psi(const char *pkt, pid_t pid);
+	/* Used until the PAT and PMT are found; returns whether to keep pkt
+	 */
+	void update_psi(const char *pkt, unsigned char action);
+	/* Feeds a packet of the PAT or PMT PID to its assembler, and takes in
+	 * any new version of the table it completes
+	 */
+	void use_pat(const SectionAssembler::Section &section);
+	void parse_pmt(const SectionAssembler::Section &section);
+	/* Rebuilds m_pid_action; throws std::logic_error if the PMT is unusable.
+	 * A new version that is unusable is logged and the previous one kept
+	 */
+	bool psi_current(const char *pkt, unsigned char action) const;
+	/* Do the sections starting in pkt leave the tables as they are? For
+	 * split(), which doesn't assemble them; false if it can't tell
+	 */
+	void forget_psi();
+	static bool has_pcr(const char *pkt) {
+		return (pkt[3] & 0x20) // Adaptation field present
+		    && pkt[4] // Adaptation field length > 0
+		    && (pkt[5] & 0x10); // PCR present
+	}
+	/* Looking into the PES that starts in a packet may take the packets of
+	 * its PID after that one too, up to PES_LOOKAHEAD bytes of the stream.
+	 * With fewer `available` than that in the buffer, the answer may be
+	 * PES_MORE: fill() and ask again. Short of the end of the stream, it
+	 * doesn't depend on how much is buffered
+	 */
+	enum { PES_NO, PES_YES, PES_MORE };
+	template <class F>
+	static int follow_pes(const char *pkt, size_t available, F &f);
+	/* Hands the payload of the PES to f(p, end) packet by packet, until that
+	 * returns true; then PES_YES
+	 */
+	int opens_gop(const char *pkt, size_t available, unsigned char action) const;
+	/* Does pkt start a picture that can be decoded on its own, an IDR frame
+	 * or another IRAP picture in HEVC? Segments may only start there
+	 */
+	static int pes_timestamps(const char *pkt, size_t available, signed long long &pts, signed long long &dts);
+	/* Reads the PTS and DTS of the PES that starts in pkt; dts is the PTS
+	 * if it has none. PES_NO if it has no PTS
+	 */
+	template <class In, class Out>
+	const char *look_ahead(In *in, const Out &out, const char *&run);
+	/* Makes PES_LOOKAHEAD bytes available, or what's left of the stream,
+	 * writing out the run first. Returns the packet at in->data()
+	 */
+
+	/* Segments are timed by PTS, in 90 kHz ticks: from the first PTS of a
+	 * segment to the first PTS of the next one, which is the IDR frame that
+	 * opens it. The last one lasts until the end of its latest access unit.
+	 * copy_segment() and split() both go by these
+	 */
+	static void tick(Clocks &clocks, pid_t pid, signed long long pts, signed long long dts,
+	                 signed long long &start, signed long long &end);
+	/* Takes in the timestamps of a PES of pid. start is the first PTS of the
+	 * segment, end how far its media reaches so far; both -1 at first
+	 */
+	bool enough(signed long long pts, signed long long segstart, signed long long start) const;
+	/* May an IDR frame at pts end the segment? */
+	void advance(signed long long &segstart, signed long long pts) const;
+	/* Moves segstart on after a cut before pts */
+	static float seconds(signed long long start, signed long long end);
+	/* From start to end, 0 if start is unknown */
+
+	pid_t m_count_pid;
+	PidCount *m_count; // m_stats->pids[m_count_pid]; PIDs come in runs
+	void count(const char *pkt, bool kept);
+	/* Adds pkt to m_stats */
+
+	/* split() walks byte ranges of the input in parallel, noting the packets
+	 * that matter for the cut decision. Stitching the ranges together
+	 * replays these through the rules of copy_segment()
+	 */
+	struct event {
+		unsigned long long pos;
+		signed long long pts, dts;
+		pid_t pid;
+		bool gop; // opens_gop() == PES_YES
+	};
+	/* One for every PES start with a PTS */
+	struct chunk {
+		unsigned long long begin, end; // Range to walk
+		unsigned long long start; // First packet walked
+		unsigned long long stop; // Packet where the walk left the range
+		bool eof; // The walk ran into the end of the stream instead
+		bool psi_changed; // Saw another PAT or PMT version
+		std::vector<struct event> events;
+	};
+	void scan(const char *data, size_t length, struct chunk &c) const;
+	class ScanTask;
+
+	unsigned long long m_psi_end; // split(): where the PAT and PMT were parsed
+	std::vector<std::pair<unsigned long long, size_t> > m_psi_runs; // and what was kept up to there
+	template <class Out>
+	void copy_span_to(const char *data, size_t length, const std::vector<Span> &spans, size_t n, const Out &out);
+	/* copy_span() for one kind of output */
 
 public:
 	MpegtsH264(const unsigned long length, const std::string extra_opts);
 	virtual ~MpegtsH264();
 	static void usage();
-	virtual float copy_segment(std::istream *in, std::ostream *out);
+	static bool probe(const char *data, size_t length);
+	/* Does data look like this format? */
+	static bool resync(Input::Input *in, bool quiet = false);
+	/* Skip to the next position where TS_SYNC_PACKETS sync bytes follow
+	 * each other at packet distance. Returns false on end of stream
+	 */
+	virtual float copy_segment(Input::Input *in, std::ostream *out);
+
+	template <class In, class Out> float copy(In *in, const Out &out);
+	/* copy_segment() for one kind of input and output, see dispatch() */
+
+	virtual bool split(const char *data, size_t length, unsigned threads, std::vector<Span> &spans);
+	virtual void copy_span(const char *data, size_t length, const std::vector<Span> &spans, size_t n, std::ostream *out);
 };
 
 } // namespace
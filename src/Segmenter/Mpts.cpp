@@ -0,0 +1,268 @@
+#include "Mpts.hpp"
+#include "TsSync.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <string.h>
+
+#define TS_SYNC_BYTE 0x47
+#define PID(b) ( (( *(b) & 0x1f) << 8) | static_cast<unsigned char>(*(b+1)) )
+#define TS_PAYLOAD_UNIT_START(b) (b[1] & 0x40 )
+#define TS_PAYLOAD_START(b) (4 + (b[3] & 0x20 ? 1+b[4] : 0))
+#define TS_NULL_PID 0x1fff
+
+#define PUMP_PACKETS 1024 // Routed per pump(), about 190KiB
+
+namespace Segmenter {
+
+Mpts::Program::Program(Mpts *mpts, unsigned number, unsigned long long bit) :
+	m_mpts(mpts),
+	m_number(number),
+	m_bit(bit),
+	m_pmt_pid(TS_DUMMY_PID),
+	m_pcr_pid(TS_DUMMY_PID),
+	m_pmt_version(-1),
+	m_pat_cc(0) {
+	m_pat[0] = 0x00;
+}
+
+Mpts::Program::~Program() {
+	m_mpts->detach(this);
+}
+
+bool Mpts::Program::refill(size_t want) {
+	size_t left = available();
+	pthread_mutex_lock(&m_mpts->m_lock);
+	while( 1 ) {
+		if( ! m_pending.empty() ) { // Append it to what's left
+			if( left == 0 ) {
+				m_buf.swap(m_pending);
+			} else {
+				memmove(&m_buf[0], m_cur, left);
+				m_buf.resize(left);
+				m_buf.insert(m_buf.end(), m_pending.begin(), m_pending.end());
+			}
+			m_pending.clear();
+			left = m_buf.size();
+			m_cur = &m_buf[0];
+			m_end = m_cur + left;
+		}
+		if( left >= want ) break;
+		if( ! m_mpts->pump() ) break;
+	}
+	pthread_mutex_unlock(&m_mpts->m_lock);
+	return available() >= want;
+}
+
+Mpts::Mpts(Input::Input *in) :
+	m_in(in),
+	m_eof(false),
+	m_pat_version(-1),
+	m_ts_id(0) {
+	pthread_mutex_init(&m_lock, NULL);
+	memset(m_route, 0, sizeof(m_route));
+}
+
+Mpts::~Mpts() {
+	pthread_mutex_destroy(&m_lock);
+	delete m_in;
+}
+
+std::vector<unsigned> Mpts::programs(const char *data, size_t length) {
+	std::vector<unsigned> ret;
+	SectionAssembler pat;
+	size_t off = ts_sync_scan(data, length);
+	while( off + TS_PACKET_SIZE <= length ) {
+		const char *pkt = data + off;
+		if( pkt[0] != TS_SYNC_BYTE ) {
+			off += ts_sync_scan(pkt, length - off);
+			if( off + TS_PACKET_SIZE > length || data[off] != TS_SYNC_BYTE ) break;
+			pat.reset();
+			continue;
+		}
+		off += TS_PACKET_SIZE;
+		if( PID(pkt+1) != 0 ) continue;
+		const std::vector<SectionAssembler::Section> &sections = pat.push(pkt);
+		for( size_t i = 0; i < sections.size(); i++ ) {
+			const unsigned char *s = reinterpret_cast<const unsigned char*>(sections[i].data.data());
+			if( PSI_TABLE_ID(s) != PSI_TABLE_ID_PAT || ! PSI_CURRENT(s) ) continue;
+			const unsigned char *end = s + sections[i].data.size() - PSI_CRC_SIZE;
+			for( const unsigned char *q = s + PSI_HEADER_SIZE; q + 4 <= end; q += 4 ) {
+				unsigned number = q[0] << 8 | q[1];
+				if( number != 0 ) ret.push_back(number); // 0 is the network PID
+			}
+			return ret;
+		}
+	}
+	return ret;
+}
+
+Mpts::Program *Mpts::program(unsigned number) {
+	pthread_mutex_lock(&m_lock);
+	if( m_programs.size() >= MPTS_MAX_PROGRAMS ) {
+		pthread_mutex_unlock(&m_lock);
+		throw std::length_error("Too many programs to segment out of one MPTS");
+	}
+	Program *p = new Program(this, number, 1ULL << m_programs.size());
+	m_programs.push_back(p);
+	pthread_mutex_unlock(&m_lock);
+	return p;
+}
+
+void Mpts::detach(Program *p) {
+	pthread_mutex_lock(&m_lock);
+	for( size_t i = 0; i < m_programs.size(); i++ ) {
+		if( m_programs[i] == p ) m_programs[i] = NULL;
+	}
+	route();
+	pthread_mutex_unlock(&m_lock);
+}
+
+void Mpts::route() {
+	memset(m_route, 0, sizeof(m_route));
+	for( size_t i = 0; i < m_programs.size(); i++ ) {
+		Program *p = m_programs[i];
+		if( p == NULL || p->m_pmt_pid == TS_DUMMY_PID ) continue;
+		m_route[p->m_pmt_pid] |= p->m_bit;
+		if( p->m_pcr_pid != TS_DUMMY_PID ) m_route[p->m_pcr_pid] |= p->m_bit;
+		for( size_t j = 0; j < p->m_es_pids.size(); j++ ) m_route[p->m_es_pids[j]] |= p->m_bit;
+	}
+	m_route[0] = 0; // Gets a PAT of its own
+	m_route[TS_NULL_PID] = 0;
+}
+
+void Mpts::parse_pat(const SectionAssembler::Section &section) {
+	const unsigned char *s = reinterpret_cast<const unsigned char*>(section.data.data());
+	if( PSI_TABLE_ID(s) != PSI_TABLE_ID_PAT || ! PSI_CURRENT(s) || PSI_SECTION_NUMBER(s) != 0 ) return;
+	if( static_cast<int>(PSI_VERSION(s)) == m_pat_version ) return;
+	m_pat_version = PSI_VERSION(s);
+	m_ts_id = PSI_EXTENSION(s);
+
+	const unsigned char *e = s + section.data.size() - PSI_CRC_SIZE;
+	std::cerr << "Parsed PAT version " << m_pat_version << ", programs:";
+	std::vector<pid_t> pmt_pids(m_programs.size(), TS_DUMMY_PID);
+	for( const unsigned char *q = s + PSI_HEADER_SIZE; q + 4 <= e; q += 4 ) {
+		unsigned number = q[0] << 8 | q[1];
+		if( number == 0 ) continue; // Network PID
+		std::cerr << " " << number;
+		for( size_t i = 0; i < m_programs.size(); i++ ) {
+			if( m_programs[i] && m_programs[i]->m_number == number ) pmt_pids[i] = PID(q+2);
+		}
+	}
+	std::cerr << "\n";
+
+	for( size_t i = 0; i < m_programs.size(); i++ ) {
+		Program *p = m_programs[i];
+		if( p == NULL ) continue;
+		if( pmt_pids[i] == TS_DUMMY_PID ) std::cerr << "Program " << p->m_number << " is not in the PAT\n";
+		if( pmt_pids[i] != p->m_pmt_pid ) { // Its PIDs come from the new PMT
+			p->m_pmt_pid = pmt_pids[i];
+			p->m_pcr_pid = TS_DUMMY_PID;
+			p->m_es_pids.clear();
+			p->m_pmt_version = -1;
+			p->m_pmt_sections.reset();
+		}
+		build_pat(p);
+	}
+	route();
+}
+
+void Mpts::build_pat(Program *p) {
+	if( p->m_pmt_pid == TS_DUMMY_PID ) {
+		p->m_pat[0] = 0x00; // None to send
+		return;
+	}
+	unsigned char *b = reinterpret_cast<unsigned char*>(p->m_pat);
+	memset(b, 0xff, TS_PACKET_SIZE); // Stuffing after the section
+	b[0] = TS_SYNC_BYTE;
+	b[1] = 0x40; // Payload unit start, PID 0
+	b[2] = 0x00;
+	b[3] = 0x10; // Payload only
+	b[4] = 0x00; // pointer field
+	unsigned char *s = b + 5;
+	s[0] = PSI_TABLE_ID_PAT;
+	s[1] = 0xb0; // Section syntax
+	s[2] = 5 + 4 + PSI_CRC_SIZE; // One program
+	s[3] = m_ts_id >> 8;
+	s[4] = m_ts_id;
+	s[5] = 0xc1 | m_pat_version << 1; // Current
+	s[6] = s[7] = 0x00; // Section 0 of 0
+	s[8] = p->m_number >> 8;
+	s[9] = p->m_number;
+	s[10] = 0xe0 | p->m_pmt_pid >> 8;
+	s[11] = p->m_pmt_pid;
+	uint32_t crc = crc32_mpeg(s, 12);
+	s[12] = crc >> 24;
+	s[13] = crc >> 16;
+	s[14] = crc >> 8;
+	s[15] = crc;
+}
+
+void Mpts::parse_pmt(Program *p, const SectionAssembler::Section &section) {
+	const unsigned char *s = reinterpret_cast<const unsigned char*>(section.data.data());
+	if( PSI_TABLE_ID(s) != PSI_TABLE_ID_PMT || PSI_EXTENSION(s) != p->m_number ) return; // Shares the PID
+	if( ! PSI_CURRENT(s) || static_cast<int>(PSI_VERSION(s)) == p->m_pmt_version ) return;
+	const unsigned char *e = s + section.data.size() - PSI_CRC_SIZE;
+	if( s + PSI_HEADER_SIZE + 4 > e ) return;
+
+	p->m_pmt_version = PSI_VERSION(s);
+	p->m_pcr_pid = PID(s+8);
+	if( p->m_pcr_pid == TS_NULL_PID ) p->m_pcr_pid = TS_DUMMY_PID; // No PCR
+	p->m_es_pids.clear();
+	const unsigned char *q = s + 12 + ((s[10] & 0x0f) << 8 | s[11]); // After the program info
+	while( q + 5 <= e ) {
+		p->m_es_pids.push_back(PID(q+1));
+		q += 5 + ((q[3] & 0x0f) << 8 | q[4]);
+	}
+	route();
+}
+
+bool Mpts::pump() {
+	if( m_eof ) return false;
+	unsigned n;
+	for( n = 0; n < PUMP_PACKETS; n++ ) {
+		if( ! m_in->fill(TS_PACKET_SIZE) ) {
+			m_eof = true;
+			break;
+		}
+		const char *pkt = m_in->data();
+		if( pkt[0] != TS_SYNC_BYTE ) {
+			if( ! MpegtsH264::resync(m_in) ) {
+				m_eof = true;
+				break;
+			}
+			pkt = m_in->data();
+		}
+
+		pid_t pid = PID(pkt+1);
+		if( pid == 0 ) {
+			const std::vector<SectionAssembler::Section> &sections = m_pat_sections.push(pkt);
+			for( size_t j = 0; j < sections.size(); j++ ) {
+				parse_pat(sections[j]);
+				for( size_t i = 0; i < m_programs.size(); i++ ) {
+					Program *p = m_programs[i];
+					if( p == NULL || p->m_pat[0] != TS_SYNC_BYTE ) continue;
+					p->m_pat[3] = 0x10 | p->m_pat_cc;
+					p->m_pat_cc = (p->m_pat_cc + 1) & 0x0f;
+					p->m_pending.insert(p->m_pending.end(), p->m_pat, p->m_pat + TS_PACKET_SIZE);
+				}
+			}
+			m_in->consume(TS_PACKET_SIZE);
+			continue;
+		}
+
+		for( unsigned long long route = m_route[pid]; route; route &= route - 1 ) {
+			Program *p = m_programs[__builtin_ctzll(route)];
+			if( pid == p->m_pmt_pid ) {
+				const std::vector<SectionAssembler::Section> &sections = p->m_pmt_sections.push(pkt);
+				for( size_t j = 0; j < sections.size(); j++ ) parse_pmt(p, sections[j]);
+			}
+			p->m_pending.insert(p->m_pending.end(), pkt, pkt + TS_PACKET_SIZE);
+		}
+		m_in->consume(TS_PACKET_SIZE);
+	}
+	return n > 0 || ! m_eof;
+}
+
+} // namespace
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,101 @@
+#ifndef __MPTS_H__
+#define __MPTS_H__
+
+#include <vector>
+#include <pthread.h>
+#include "../Input/Input.hpp"
+#include "MpegtsH264.hpp"
+#include "Psi.hpp"
+
+#define MPTS_MAX_PROGRAMS 64 // Bits in a route
+
+namespace Segmenter {
+
+/* Splits a multi-program transport stream into one single-program stream
+ * per program, in a single pass
+ *
+ * Every program gets an Input of its own, to segment with MpegtsH264 like
+ * any other input. Reading any of these reads the next piece of the
+ * shared input, and hands every packet in it to the programs it belongs to
+ * with one lookup by PID; the others keep theirs until they get to them.
+ * The PAT is replaced by one that lists only the program itself, so the
+ * segments are plain single-program streams.
+ *
+ * The programs may be read from different threads, like renditions in a
+ * Pool. What a program hasn't read yet is buffered, so keep them about
+ * level: a program without any packets reads through the whole input on
+ * its first segment, keeping all of the others' packets in memory.
+ */
+class Mpts {
+public:
+	class Program : public Input::Input {
+	protected:
+		friend class Mpts;
+		Mpts *m_mpts;
+		unsigned m_number;
+		unsigned long long m_bit; // In m_route
+		std::vector<char> m_buf; // m_cur and m_end point in here
+		std::vector<char> m_pending; // Routed here, not yet in m_buf
+
+		typedef unsigned short pid_t;
+		pid_t m_pmt_pid; // TS_DUMMY_PID if the PAT doesn't list us
+		pid_t m_pcr_pid;
+		std::vector<pid_t> m_es_pids;
+		int m_pmt_version; // -1 before the first PMT
+		SectionAssembler m_pmt_sections;
+		char m_pat[TS_PACKET_SIZE]; // Listing only this program
+		unsigned char m_pat_cc; // Continuity counter of the next one
+
+		Program(Mpts *mpts, unsigned number, unsigned long long bit);
+		virtual bool refill(size_t want);
+
+	public:
+		virtual ~Program();
+		unsigned number() const { return m_number; }
+	};
+
+	Mpts(Input::Input *in);
+	/* Takes ownership of in */
+	~Mpts();
+	/* Delete all programs first */
+
+	static std::vector<unsigned> programs(const char *data, size_t length);
+	/* The program numbers in the first PAT in data; empty if there is none
+	 */
+
+	Program *program(unsigned number);
+	/* A new input with only the packets of this program; yours to delete,
+	 * before the Mpts. Call before reading any of them.
+	 * Throws std::length_error beyond MPTS_MAX_PROGRAMS
+	 */
+
+protected:
+	typedef Program::pid_t pid_t;
+	Input::Input *m_in;
+	pthread_mutex_t m_lock; // Guards all but the programs' m_buf
+	bool m_eof;
+	std::vector<Program*> m_programs;
+	unsigned long long m_route[TS_PID_COUNT];
+	/* Bit i is set if m_programs[i] gets the packets of the PID. Not used
+	 * for PID 0: every program gets its own PAT instead
+	 */
+	int m_pat_version; // -1 before the first PAT
+	SectionAssembler m_pat_sections;
+	unsigned short m_ts_id;
+
+	bool pump();
+	/* Routes the next piece of the input; false at its end. With m_lock */
+	void route();
+	/* Rebuilds m_route from the programs' PIDs */
+	void parse_pat(const SectionAssembler::Section &section);
+	void parse_pmt(Program *p, const SectionAssembler::Section &section);
+	/* Update the programs' PIDs from a new version of their tables */
+	void build_pat(Program *p);
+	/* Its m_pat, after the PAT changed */
+	void detach(Program *p);
+};
+
+} // namespace
+
+#endif
+// vim: set ts=4 sw=4:
@@ -0,0 +1,210 @@
+#include "Nal.hpp"
+#include "Cpu.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NAL_X86
+#include <immintrin.h>
+#endif
+
+#define NAL_TYPE(h) ( (h) & 0x1f )
+#define NAL_TYPE_SLICE 1 // Up to 4, with the data partitions
+#define NAL_TYPE_SLICE_DPC 4
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+
+#define HEVC_NAL_TYPE(h) ( ((h) >> 1) & 0x3f )
+#define HEVC_NAL_TYPE_VCL_LAST 31 // Slices, up to here
+#define HEVC_NAL_TYPE_IRAP_FIRST 16 // BLA_W_LP
+#define HEVC_NAL_TYPE_IRAP_LAST 23 // Past CRA_NUT, reserved for more IRAP types
+
+#define SEI_RECOVERY_POINT 6
+#define RBSP_STOP 0x80 // rbsp_trailing_bits, where another SEI message could start
+
+namespace Segmenter {
+
+static inline bool is_start_code(const char *p) {
+	return p[0] == 0x00 && p[1] == 0x00 && p[2] == 0x01;
+}
+
+static size_t scan_from(const char *buf, size_t pos, size_t len) {
+	if( len < 2 ) return 0;
+	for( ; pos + 2 < len; pos++ ) {
+		if( is_start_code(buf + pos) ) return pos;
+	}
+	return len - 2;
+}
+
+size_t start_code_scan_scalar(const char *buf, size_t len) {
+	return scan_from(buf, 0, len);
+}
+
+#ifdef NAL_X86
+
+size_t start_code_scan_sse2(const char *buf, size_t len) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(0x01);
+	size_t pos = 0;
+	for( ; pos + 18 <= len; pos += 16 ) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos + 1));
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos + 2));
+		__m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+		                            _mm_cmpeq_epi8(c, one));
+		unsigned bits = _mm_movemask_epi8(hit);
+		if( bits ) return pos + __builtin_ctz(bits);
+	}
+	return scan_from(buf, pos, len);
+}
+
+__attribute__((target("avx2")))
+size_t start_code_scan_avx2(const char *buf, size_t len) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(0x01);
+	size_t pos = 0;
+	for( ; pos + 34 <= len; pos += 32 ) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + pos));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + pos + 1));
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + pos + 2));
+		__m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)),
+		                               _mm256_cmpeq_epi8(c, one));
+		unsigned bits = _mm256_movemask_epi8(hit);
+		if( bits ) return pos + __builtin_ctz(bits);
+	}
+	return scan_from(buf, pos, len);
+}
+
+#else // NAL_X86
+
+size_t start_code_scan_sse2(const char *buf, size_t len) {
+	return start_code_scan_scalar(buf, len);
+}
+
+size_t start_code_scan_avx2(const char *buf, size_t len) {
+	return start_code_scan_scalar(buf, len);
+}
+
+#endif // NAL_X86
+
+typedef size_t (*scan_func)(const char *buf, size_t len);
+static const scan_func scan_best = cpu_has_avx2() ? start_code_scan_avx2 : start_code_scan_sse2;
+
+size_t start_code_scan(const char *buf, size_t len) {
+	return scan_best(buf, len);
+}
+
+void AccessUnitScanner::reset() {
+	m_state = NAL_BODY; // The PES payload should start with a start code
+	m_zeros = 0;
+	m_value = m_type = m_left = 0;
+	m_recovery = false;
+}
+
+AccessUnitScanner::Result AccessUnitScanner::push(const char *data, size_t length) {
+	const char *p = data;
+	const char *end = data + length;
+	while( p < end ) {
+		if( m_state == NAL_HEADER ) {
+			m_zeros = 0;
+			Result r = nal(*p++);
+			if( r != UNDECIDED ) return r;
+			continue;
+		}
+
+		if( m_state == NAL_BODY ) {
+			// Finish a start code that began in the previous bytes
+			if( m_zeros == 2 && p[0] == 0x01 ) {
+				p += 1;
+				m_state = NAL_HEADER;
+				continue;
+			}
+			if( m_zeros >= 1 && p + 1 < end && p[0] == 0x00 && p[1] == 0x01 ) {
+				p += 2;
+				m_state = NAL_HEADER;
+				continue;
+			}
+
+			size_t off = start_code_scan(p, end - p);
+			if( p + off + 3 <= end && is_start_code(p + off) ) {
+				p += off + 3;
+				m_state = NAL_HEADER;
+				continue;
+			}
+			// None in here; a start code may still begin in the zeros at the end
+			unsigned zeros = 0;
+			while( zeros < 2 && end - zeros > p && end[-1-static_cast<int>(zeros)] == 0x00 ) zeros++;
+			if( end - zeros == p ) zeros += m_zeros; // All of it
+			m_zeros = zeros > 2 ? 2 : zeros;
+			return UNDECIDED;
+		}
+
+		// In an SEI: byte by byte, taking out emulation prevention bytes
+		unsigned char b = *p++;
+		if( m_zeros == 2 && b <= 0x03 ) {
+			if( b == 0x03 ) {
+				m_zeros = 0;
+				continue;
+			}
+			// The NAL unit ended: a start code, or trailing zeros before one
+			m_state = ( b == 0x01 ) ? NAL_HEADER : NAL_BODY;
+			continue;
+		}
+		m_zeros = ( b == 0x00 ) ? ( m_zeros < 2 ? m_zeros + 1 : 2 ) : 0;
+		if( ! sei(b) ) m_state = NAL_BODY;
+	}
+	return UNDECIDED;
+}
+
+AccessUnitScanner::Result AccessUnitScanner::nal(unsigned char header) {
+	if( m_codec == HEVC ) {
+		unsigned type = HEVC_NAL_TYPE(header);
+		if( type <= HEVC_NAL_TYPE_VCL_LAST ) {
+			return ( type >= HEVC_NAL_TYPE_IRAP_FIRST && type <= HEVC_NAL_TYPE_IRAP_LAST ) ? RANDOM_ACCESS : OTHER;
+		}
+		m_state = NAL_BODY; // VPS, SPS, PPS, AUD, SEI...
+		return UNDECIDED;
+	}
+
+	unsigned type = NAL_TYPE(header);
+	if( type == NAL_TYPE_IDR ) return RANDOM_ACCESS;
+	if( type >= NAL_TYPE_SLICE && type <= NAL_TYPE_SLICE_DPC ) return m_recovery ? RANDOM_ACCESS : OTHER;
+	if( type == NAL_TYPE_SEI ) {
+		m_state = SEI_TYPE;
+		m_value = 0;
+		return UNDECIDED;
+	}
+	m_state = NAL_BODY; // AUD, SPS, PPS...
+	return UNDECIDED;
+}
+
+bool AccessUnitScanner::sei(unsigned char byte) {
+	switch( m_state ) {
+	case SEI_TYPE:
+		if( m_value == 0 && byte == RBSP_STOP ) return false; // No more messages
+		m_value += byte;
+		if( byte == 0xff ) return true;
+		m_type = m_value;
+		m_value = 0;
+		m_state = SEI_SIZE;
+		return true;
+
+	case SEI_SIZE:
+		m_value += byte;
+		if( byte == 0xff ) return true;
+		m_left = m_value;
+		m_value = 0;
+		m_state = m_left ? SEI_PAYLOAD : SEI_TYPE;
+		return true;
+
+	default: // SEI_PAYLOAD
+		if( m_type == SEI_RECOVERY_POINT ) {
+			if( byte & 0x80 ) m_recovery = true; // recovery_frame_cnt is ue(v); 0 is a lone 1 bit
+			return false;
+		}
+		if( --m_left == 0 ) m_state = SEI_TYPE;
+		return true;
+	}
+}
+
+} // namespace
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,79 @@
+#ifndef __NAL_H__
+#define __NAL_H__
+
+#include <stddef.h>
+
+namespace Segmenter {
+
+size_t start_code_scan(const char *buf, size_t len);
+/* Finds the first offset in buf where a 00 00 01 start code begins.
+ * If there is none, returns the number of bytes that can safely be
+ * skipped: len-2, or 0 if buf is shorter than that.
+ * Uses AVX2 or SSE2 when the CPU has it.
+ */
+
+size_t start_code_scan_scalar(const char *buf, size_t len);
+size_t start_code_scan_sse2(const char *buf, size_t len);
+size_t start_code_scan_avx2(const char *buf, size_t len);
+/* The implementations behind start_code_scan()
+ */
+
+/* Tells whether an H.264 or HEVC access unit can be decoded on its own,
+ * from the bytes of its PES payload as they come in
+ *
+ * Follows the NAL units up to the first slice. In H.264 it's a random
+ * access point if that is an IDR slice, or if a recovery point SEI before
+ * it says the picture itself is exact (recovery_frame_cnt 0, as on the I
+ * pictures of an open GOP). In HEVC if it's a slice of an IRAP picture:
+ * BLA, IDR or CRA. Start codes are found with start_code_scan(); only H.264
+ * SEI payloads are read byte by byte.
+ */
+class AccessUnitScanner {
+public:
+	enum Result {
+		UNDECIDED, // Needs more bytes
+		RANDOM_ACCESS,
+		OTHER
+	};
+
+	enum Codec { H264, HEVC };
+
+	AccessUnitScanner(Codec codec = H264) : m_codec(codec) { reset(); }
+
+	void reset();
+	/* Starts over, at the beginning of a PES payload */
+
+	Result push(const char *data, size_t length);
+	/* Feeds the next bytes of the payload. Once this returns something else
+	 * than UNDECIDED, there is no need to go on
+	 */
+
+private:
+	enum State {
+		NAL_BODY, // Looking for the next start code
+		NAL_HEADER, // Right after a start code
+		SEI_TYPE,
+		SEI_SIZE,
+		SEI_PAYLOAD
+	};
+	Codec m_codec;
+	State m_state;
+	unsigned m_zeros; // Zero bytes right before the next one, up to 2
+	unsigned m_value; // payloadType or payloadSize, as it's summed up
+	unsigned m_type; // payloadType of the SEI message being read
+	unsigned m_left; // Bytes of its payload still to come
+	bool m_recovery; // Saw a recovery point SEI for this picture
+
+	Result nal(unsigned char header);
+	/* Handles the (first) header byte of the NAL unit that starts here */
+	bool sei(unsigned char byte);
+	/* Handles the next byte of an SEI RBSP; false when the rest of the NAL
+	 * unit doesn't matter
+	 */
+};
+
+} // namespace
+
+#endif
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,149 @@
+#include "Psi.hpp"
+
+#define TS_PACKET_SIZE 188
+#define PSI_MAX_LENGTH 4096 // private_section; PAT and PMT stay within 1024
+#define PSI_STUFFING 0xff // Instead of a table_id: the rest of the packet is filler
+
+namespace Segmenter {
+
+static struct CrcTables {
+	uint32_t t[8][256];
+	/* t[0] is the usual table: the CRC of a byte followed by 0 bytes.
+	 * t[k] is the same with k more zero bytes after it
+	 */
+	CrcTables() {
+		for( unsigned i = 0; i < 256; i++ ) {
+			uint32_t crc = i << 24;
+			for( int bit = 0; bit < 8; bit++ ) {
+				crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+			}
+			t[0][i] = crc;
+		}
+		for( unsigned k = 1; k < 8; k++ ) {
+			for( unsigned i = 0; i < 256; i++ ) {
+				t[k][i] = (t[k-1][i] << 8) ^ t[0][t[k-1][i] >> 24];
+			}
+		}
+	}
+} crc_tables;
+
+uint32_t crc32_mpeg(const unsigned char *data, size_t length) {
+	const uint32_t (*t)[256] = crc_tables.t;
+	uint32_t crc = 0xffffffff;
+	for( ; length >= 8; data += 8, length -= 8 ) {
+		crc ^= static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+		crc = t[7][crc >> 24] ^ t[6][(crc >> 16) & 0xff] ^ t[5][(crc >> 8) & 0xff] ^ t[4][crc & 0xff]
+		    ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+	}
+	for( ; length > 0; data++, length-- ) {
+		crc = (crc << 8) ^ t[0][(crc >> 24) ^ *data];
+	}
+	return crc;
+}
+
+uint32_t crc32_mpeg_bitwise(const unsigned char *data, size_t length) {
+	uint32_t crc = 0xffffffff;
+	for( size_t i = 0; i < length; i++ ) {
+		crc ^= static_cast<uint32_t>(data[i]) << 24;
+		for( int bit = 0; bit < 8; bit++ ) {
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+SectionAssembler::SectionAssembler() :
+	m_length(0),
+	m_cc(-1),
+	m_errors(0) {
+}
+
+void SectionAssembler::reset() {
+	m_section.clear();
+	m_length = 0;
+	m_packets.clear();
+	m_cc = -1;
+}
+
+void SectionAssembler::drop() {
+	if( ! m_section.empty() ) m_errors++;
+	m_section.clear();
+	m_length = 0;
+}
+
+const unsigned char *SectionAssembler::take(const unsigned char *p, const unsigned char *end) {
+	if( m_length == 0 ) { // Still reading the length
+		while( m_section.size() < 3 && p < end ) m_section += static_cast<char>(*p++);
+		if( m_section.size() < 3 ) return p;
+		m_length = 3 + PSI_LENGTH(reinterpret_cast<const unsigned char*>(m_section.data()));
+		if( m_length > PSI_MAX_LENGTH ) { // Not a section; skip the packet
+			drop();
+			return end;
+		}
+	}
+	size_t n = m_length - m_section.size();
+	if( n > static_cast<size_t>(end - p) ) n = end - p;
+	m_section.append(reinterpret_cast<const char*>(p), n);
+	p += n;
+	if( m_section.size() < m_length ) return p;
+
+	// Complete
+	const unsigned char *s = reinterpret_cast<const unsigned char*>(m_section.data());
+	bool syntax = s[1] & 0x80; // Long form, with a CRC, as PAT and PMT always are
+	if( ! syntax || m_length < PSI_HEADER_SIZE + PSI_CRC_SIZE || crc32_mpeg(s, m_length) != 0 ) {
+		drop();
+		return p;
+	}
+	m_done.push_back(Section());
+	m_done.back().data.swap(m_section);
+	m_done.back().packets = m_packets;
+	m_section.clear();
+	m_length = 0;
+	return p;
+}
+
+const std::vector<SectionAssembler::Section> &SectionAssembler::push(const char *pkt) {
+	m_done.clear();
+	const unsigned char *p = reinterpret_cast<const unsigned char*>(pkt);
+	const unsigned char *end = p + TS_PACKET_SIZE;
+
+	if( ! (p[3] & 0x10) ) return m_done; // No payload; the counter doesn't move either
+	int cc = p[3] & 0x0f;
+	if( cc == m_cc ) return m_done; // Sent twice
+	bool lost = m_cc != -1 && cc != ((m_cc + 1) & 0x0f);
+	m_cc = cc;
+	if( lost ) drop();
+
+	const unsigned char *q = p + 4;
+	if( p[3] & 0x20 ) q += 1 + p[4]; // Adaptation field
+	if( q >= end ) return m_done;
+
+	if( ! (p[1] & 0x40) ) { // Only the continuation of a section
+		if( m_section.empty() ) return m_done;
+		m_packets.append(pkt, TS_PACKET_SIZE);
+		take(q, end);
+		return m_done;
+	}
+
+	// A section starts in here, at the pointer
+	const unsigned char *start = q + 1 + *q;
+	if( start >= end ) {
+		drop();
+		return m_done;
+	}
+	if( ! m_section.empty() ) { // Finish the previous one first
+		m_packets.append(pkt, TS_PACKET_SIZE);
+		take(q + 1, start);
+		drop(); // Should be complete by now
+	}
+	for( q = start; q < end && *q != PSI_STUFFING; ) {
+		m_packets.assign(pkt, TS_PACKET_SIZE);
+		q = take(q, end);
+		if( ! m_section.empty() ) break; // Goes on in the next packet
+	}
+	return m_done;
+}
+
+} // namespace
+
+// vim: set ts=4 sw=4:
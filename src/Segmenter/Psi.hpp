@@ -0,0 +1,80 @@
+#ifndef __PSI_H__
+#define __PSI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Fields of a PSI section header, s pointing at its table_id */
+#define PSI_TABLE_ID(s) ( (s)[0] )
+#define PSI_LENGTH(s) ( ((s)[1] & 0x0f) << 8 | (s)[2] ) // What follows the length field
+#define PSI_EXTENSION(s) ( static_cast<unsigned>((s)[3]) << 8 | (s)[4] ) // Transport stream ID in the PAT, program number in a PMT
+#define PSI_VERSION(s) ( ((s)[5] >> 1) & 0x1f )
+#define PSI_CURRENT(s) ( (s)[5] & 0x01 )
+#define PSI_SECTION_NUMBER(s) ( (s)[6] )
+#define PSI_HEADER_SIZE 8 // Up to and including last_section_number
+#define PSI_CRC_SIZE 4
+
+#define PSI_TABLE_ID_PAT 0x00
+#define PSI_TABLE_ID_PMT 0x02
+
+namespace Segmenter {
+
+uint32_t crc32_mpeg(const unsigned char *data, size_t length);
+/* The CRC of PSI sections (CRC-32/MPEG-2), 8 bytes per step with tables.
+ * Over a whole section, CRC included, it comes out as 0
+ */
+
+uint32_t crc32_mpeg_bitwise(const unsigned char *data, size_t length);
+/* The same, one bit at a time; to check crc32_mpeg() against */
+
+/* Puts the PSI sections of one PID back together from its TS packets
+ *
+ * Follows the pointer field, sections spread over several packets and
+ * several sections in one packet. A section is only handed out when it
+ * is a long-form one, with the whole header, and its CRC is right; one
+ * that misses a packet (by the continuity counter) is dropped.
+ */
+class SectionAssembler {
+public:
+	struct Section {
+		std::string data; // From the table_id up to and including the CRC
+		std::string packets;
+		/* The TS packets it came in. The first may also hold the end of
+		 * the previous section, the last the start of the next one
+		 */
+	};
+
+	SectionAssembler();
+
+	const std::vector<Section> &push(const char *pkt);
+	/* Feeds the next TS packet of the PID. Returns the sections that it
+	 * completed, if any; valid until the next push()
+	 */
+
+	void reset();
+	/* Forgets any section in progress, e.g. after losing sync */
+
+	unsigned long errors() const { return m_errors; }
+	/* Sections dropped for a wrong CRC, a short form or a lost packet */
+
+private:
+	std::string m_section; // In progress; empty if none
+	size_t m_length; // Its total length once the header is in, else 0
+	std::string m_packets; // What it came in so far
+	int m_cc; // Continuity counter of the last packet, -1 if none
+	std::vector<Section> m_done;
+	unsigned long m_errors;
+
+	const unsigned char *take(const unsigned char *p, const unsigned char *end);
+	/* Adds bytes of [p, end) to the section in progress, until it is
+	 * complete; returns where it stopped
+	 */
+	void drop();
+};
+
+} // namespace
+
+#endif
+// vim: set ts=4 sw=4:
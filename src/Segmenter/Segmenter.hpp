@@ -2,12 +2,95 @@
 #define __SEGMENTER_H__
 
 #include <fstream>
+#include <map>
+#include <vector>
+#include "../Input/Input.hpp"
+#include "../Input/Memory.hpp"
+#include "../Monitor.hpp"
 
 namespace Segmenter {
 
+struct Span {
+	unsigned long long begin, end; // Byte offsets in the input
+	float duration; // What copy_segment() would have returned
+};
+
+struct PidCount {
+	unsigned long long kept, dropped; // TS packets
+};
+
+struct Stats {
+	unsigned long long kept, dropped; // TS packets or audio frames
+	std::map<unsigned, PidCount> pids; // MPEG-TS only
+	unsigned long frames; // Video pictures or audio frames
+	unsigned long resyncs;
+	signed long long first_pcr, last_pcr; // 90 kHz PCR base, -1 if none
+	signed long long first_pts, last_pts; // Earliest and latest video PTS, -1 if none
+
+	Stats() { clear(); }
+	void clear() {
+		kept = dropped = 0;
+		pids.clear();
+		frames = resyncs = 0;
+		first_pcr = last_pcr = first_pts = last_pts = -1;
+	}
+};
+/* What a segment was made of, for the statistics log
+ */
+
+class StreamOutput {
+	std::ostream *m_out;
+public:
+	StreamOutput(std::ostream *out) : m_out(out) {}
+	void write(const char *data, size_t length) const { m_out->write(data, length); }
+};
+
+class NoOutput {
+public:
+	void write(const char *data, size_t length) const {}
+};
+/* Where the copy loops write to: an ostream, or nowhere when only looking
+ * for the cut points. The loops are templates over these, so the choice
+ * costs nothing per write
+ */
+
 /* abstract */ class Segmenter {
+protected:
+	Stats *m_stats;
+	/* NULL unless someone's interested; check before counting
+	 */
+	Monitor::Counters *m_live;
+	/* Likewise; publish bytes_in as copy_segment() goes, and count resyncs
+	 */
+
+	template <class Out>
+	static void write_run(const Out &out, const char *&run, const char *end) {
+		if( run == NULL ) return;
+		out.write(run, end - run);
+		run = NULL;
+	}
+	/* Write out the run of packets/frames [run, end) in the input buffer in
+	 * one go, if any. Call this before anything that may refill the input.
+	 */
+
+	template <class S>
+	static float dispatch(S *seg, Input::Input *in, std::ostream *out) {
+		if( in->complete() ) { // Loop over a plain view of it, never refilling
+			Input::Memory view(in->data(), in->data() + in->available(), in->offset());
+			float ret = out ? seg->copy(&view, StreamOutput(out)) : seg->copy(&view, NoOutput());
+			in->consume(view.offset() - in->offset());
+			return ret;
+		}
+		return out ? seg->copy(in, StreamOutput(out)) : seg->copy(in, NoOutput());
+	}
+	/* Implements copy_segment() with seg's template
+	 *   template <class In, class Out> float copy(In *in, const Out &out);
+	 * picking the input and output once per segment rather than deciding
+	 * over and over in the loop
+	 */
+
 public:
-	Segmenter(const unsigned long length, const std::string extra_opts) {}
+	Segmenter(const unsigned long length, const std::string extra_opts) : m_stats(NULL), m_live(NULL) {}
 	/* Called after parsing the command line options
 	 * length is the target segment duration in seconds
 	 * if extra options are specified on the command line, extr_opts
@@ -22,10 +105,35 @@ public:
 	/* Print whatever useful info to stderr
 	 */
 
-	virtual float copy_segment(std::istream *in, std::ostream *out) = 0;
-	/* The absolute value of the return value must be the number of seconds effectively copied.
+	virtual float copy_segment(Input::Input *in, std::ostream *out) = 0;
+	/* Copies the next segment from in to out. Parse the data in place in the
+	 * input buffer and write out of it directly; don't copy it around.
+	 * out may be NULL: then only find where the segment ends and consume it
+	 * The absolute value of the return value must be the number of seconds effectively copied.
 	 * A value <=0 indicated end of stream
 	 */
+
+	void setStats(Stats *stats) { m_stats = stats; }
+	/* copy_segment() adds what it copies to *stats; clear it in between.
+	 * Not filled in by split() and copy_span()
+	 */
+
+	void setLive(Monitor::Counters *live) { m_live = live; }
+	/* Keep live->bytes_in and live->resyncs up to date from copy_segment()
+	 */
+
+	virtual bool split(const char *data, size_t length, unsigned threads, std::vector<Span> &spans) { return false; }
+	/* Instead of calling copy_segment() over and over: find all segments of
+	 * an input that is completely in memory, using up to `threads` threads.
+	 * spans must come out exactly like the segments copy_segment() would
+	 * have made, up to and including the one with duration <= 0.
+	 * Returns false if this segmenter can't; nothing was consumed then
+	 */
+
+	virtual void copy_span(const char *data, size_t length, const std::vector<Span> &spans, size_t n, std::ostream *out) {}
+	/* Writes segment n of the spans found by split(), exactly like
+	 * copy_segment() would have. Called from several threads at once
+	 */
 };
 
 } // namespace
@@ -0,0 +1,126 @@
+#include "SyncWord.hpp"
+#include "Cpu.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SYNCWORD_X86
+#include <immintrin.h>
+#endif
+
+namespace Segmenter {
+
+static inline bool is_syncword(const char *p, unsigned char mask) {
+	return static_cast<unsigned char>(p[0]) == 0xff
+	    && (static_cast<unsigned char>(p[1]) & mask) == mask;
+}
+
+static size_t scan_from(const char *buf, size_t pos, size_t len, unsigned char mask) {
+	if( len == 0 ) return 0;
+	for( ; pos + 1 < len; pos++ ) {
+		if( is_syncword(buf + pos, mask) ) return pos;
+	}
+	return len - 1;
+}
+
+size_t syncword_scan_scalar(const char *buf, size_t len, unsigned char mask) {
+	return scan_from(buf, 0, len, mask);
+}
+
+#ifdef SYNCWORD_X86
+
+size_t syncword_scan_sse2(const char *buf, size_t len, unsigned char mask) {
+	const __m128i ff = _mm_set1_epi8(0xff);
+	const __m128i m = _mm_set1_epi8(mask);
+	size_t pos = 0;
+	for( ; pos + 17 <= len; pos += 16 ) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos + 1));
+		__m128i hit = _mm_and_si128(_mm_cmpeq_epi8(a, ff),
+		                            _mm_cmpeq_epi8(_mm_and_si128(b, m), m));
+		unsigned bits = _mm_movemask_epi8(hit);
+		if( bits ) return pos + __builtin_ctz(bits);
+	}
+	return scan_from(buf, pos, len, mask);
+}
+
+__attribute__((target("avx2")))
+size_t syncword_scan_avx2(const char *buf, size_t len, unsigned char mask) {
+	const __m256i ff = _mm256_set1_epi8(0xff);
+	const __m256i m = _mm256_set1_epi8(mask);
+	size_t pos = 0;
+	for( ; pos + 33 <= len; pos += 32 ) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + pos));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + pos + 1));
+		__m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(a, ff),
+		                               _mm256_cmpeq_epi8(_mm256_and_si256(b, m), m));
+		unsigned bits = _mm256_movemask_epi8(hit);
+		if( bits ) return pos + __builtin_ctz(bits);
+	}
+	return scan_from(buf, pos, len, mask);
+}
+
+#else // SYNCWORD_X86
+
+size_t syncword_scan_sse2(const char *buf, size_t len, unsigned char mask) {
+	return syncword_scan_scalar(buf, len, mask);
+}
+
+size_t syncword_scan_avx2(const char *buf, size_t len, unsigned char mask) {
+	return syncword_scan_scalar(buf, len, mask);
+}
+
+#endif // SYNCWORD_X86
+
+typedef size_t (*scan_func)(const char *buf, size_t len, unsigned char mask);
+static const scan_func scan_best = cpu_has_avx2() ? syncword_scan_avx2 : syncword_scan_sse2;
+
+size_t syncword_scan(const char *buf, size_t len, unsigned char mask) {
+	return scan_best(buf, len, mask);
+}
+
+bool syncword_resync(Input::Input *in, unsigned char mask, size_t header_size,
+                     frame_length_func frame_length, unsigned long long &skipped) {
+	while( 1 ) {
+		if( ! in->fill(header_size) ) { // Not even a header left
+			skipped += in->available();
+			in->consume(in->available());
+			return false;
+		}
+
+		size_t off = syncword_scan(in->data(), in->available(), mask);
+		in->consume(off);
+		skipped += off;
+		if( ! in->fill(header_size) ) continue; // Candidate (if any) is cut off
+
+		const unsigned char *header = reinterpret_cast<const unsigned char*>(in->data());
+		if( is_syncword(in->data(), mask) ) {
+			size_t len = frame_length(header);
+			if( len >= header_size ) {
+				// Only trust it if the next frame starts right after this one
+				if( ! in->fill(len + 2) ) {
+					if( in->available() >= len ) return true; // Last frame of the stream
+				} else if( is_syncword(in->data() + len, mask) ) {
+					return true;
+				}
+			}
+		}
+
+		in->consume(1); // False positive
+		skipped++;
+	}
+}
+
+bool syncword_probe(const char *buf, size_t len, unsigned char mask, size_t header_size,
+                    frame_length_func frame_length, unsigned frames) {
+	size_t pos = syncword_scan(buf, len, mask);
+	for( unsigned i = 0; i < frames; i++ ) {
+		if( pos + header_size > len || ! is_syncword(buf + pos, mask) ) return false;
+		size_t flen = frame_length(reinterpret_cast<const unsigned char*>(buf + pos));
+		if( flen < header_size ) return false;
+		pos += flen;
+	}
+	return true;
+}
+
+} // namespace
+
+// vim: set ts=4 sw=4:
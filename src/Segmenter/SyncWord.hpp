@@ -0,0 +1,49 @@
+#ifndef __SYNCWORD_H__
+#define __SYNCWORD_H__
+
+#include <stddef.h>
+#include "../Input/Input.hpp"
+
+#define SYNCWORD_MASK_ADTS 0xf0 // 12 bit syncword 0xFFF
+#define SYNCWORD_MASK_MPEG 0xe0 // 11 bit syncword 0xFFE
+
+namespace Segmenter {
+
+size_t syncword_scan(const char *buf, size_t len, unsigned char mask);
+/* Finds the first offset in buf with an 0xff byte, followed by a byte
+ * that has all the bits in `mask` set.
+ * If there is none, returns the number of bytes that can safely be
+ * skipped: len-1, or 0 if buf is empty.
+ * Uses AVX2 or SSE2 when the CPU has it.
+ */
+
+size_t syncword_scan_scalar(const char *buf, size_t len, unsigned char mask);
+size_t syncword_scan_sse2(const char *buf, size_t len, unsigned char mask);
+size_t syncword_scan_avx2(const char *buf, size_t len, unsigned char mask);
+/* The implementations behind syncword_scan()
+ */
+
+typedef size_t (*frame_length_func)(const unsigned char *header);
+/* Returns the length of the frame, header included, that starts with
+ * `header`; 0 if it's not a valid header
+ */
+
+bool syncword_resync(Input::Input *in, unsigned char mask, size_t header_size,
+                     frame_length_func frame_length, unsigned long long &skipped);
+/* Skips the input to the next valid header that is followed by another
+ * syncword exactly one frame later (or by the end of the stream).
+ * Adds the number of skipped bytes to `skipped`.
+ * Returns false on end of stream
+ */
+
+bool syncword_probe(const char *buf, size_t len, unsigned char mask, size_t header_size,
+                    frame_length_func frame_length, unsigned frames);
+/* Does buf hold `frames` valid frames back to back, starting at the first
+ * syncword? For telling formats apart
+ */
+
+} // namespace
+
+#endif
+
+// vim: set ts=4 sw=4:
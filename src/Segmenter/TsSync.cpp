@@ -0,0 +1,97 @@
+#include "TsSync.hpp"
+#include "Cpu.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TSSYNC_X86
+#include <immintrin.h>
+#endif
+
+#define TS_SYNC_BYTE 0x47
+#define TS_PACKET_SIZE 188
+
+namespace Segmenter {
+
+static inline size_t scan_limit(size_t len, unsigned packets) {
+	size_t span = (packets-1) * TS_PACKET_SIZE;
+	return len > span ? len - span : 0;
+}
+/* Number of offsets that can be checked for `packets` sync bytes
+ */
+
+static inline bool is_sync(const char *p, unsigned packets) {
+	for( unsigned k = 0; k < packets; k++ ) {
+		if( p[k * TS_PACKET_SIZE] != TS_SYNC_BYTE ) return false;
+	}
+	return true;
+}
+
+static size_t scan_from(const char *buf, size_t pos, size_t limit, unsigned packets) {
+	for( ; pos < limit; pos++ ) {
+		if( is_sync(buf + pos, packets) ) return pos;
+	}
+	return limit;
+}
+
+size_t ts_sync_scan_scalar(const char *buf, size_t len, unsigned packets) {
+	return scan_from(buf, 0, scan_limit(len, packets), packets);
+}
+
+#ifdef TSSYNC_X86
+
+size_t ts_sync_scan_sse2(const char *buf, size_t len, unsigned packets) {
+	size_t limit = scan_limit(len, packets);
+	const __m128i sync = _mm_set1_epi8(TS_SYNC_BYTE);
+	size_t pos = 0;
+	for( ; pos + 16 <= limit; pos += 16 ) {
+		// Test 16 candidate offsets at once
+		__m128i m = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos)), sync);
+		for( unsigned k = 1; k < packets && _mm_movemask_epi8(m); k++ ) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos + k*TS_PACKET_SIZE));
+			m = _mm_and_si128(m, _mm_cmpeq_epi8(v, sync));
+		}
+		unsigned mask = _mm_movemask_epi8(m);
+		if( mask ) return pos + __builtin_ctz(mask);
+	}
+	return scan_from(buf, pos, limit, packets);
+}
+
+__attribute__((target("avx2")))
+size_t ts_sync_scan_avx2(const char *buf, size_t len, unsigned packets) {
+	size_t limit = scan_limit(len, packets);
+	const __m256i sync = _mm256_set1_epi8(TS_SYNC_BYTE);
+	size_t pos = 0;
+	for( ; pos + 32 <= limit; pos += 32 ) {
+		// Test 32 candidate offsets at once
+		__m256i m = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + pos)), sync);
+		for( unsigned k = 1; k < packets && _mm256_movemask_epi8(m); k++ ) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + pos + k*TS_PACKET_SIZE));
+			m = _mm256_and_si256(m, _mm256_cmpeq_epi8(v, sync));
+		}
+		unsigned mask = _mm256_movemask_epi8(m);
+		if( mask ) return pos + __builtin_ctz(mask);
+	}
+	return scan_from(buf, pos, limit, packets);
+}
+
+#else // TSSYNC_X86
+
+size_t ts_sync_scan_sse2(const char *buf, size_t len, unsigned packets) {
+	return ts_sync_scan_scalar(buf, len, packets);
+}
+
+size_t ts_sync_scan_avx2(const char *buf, size_t len, unsigned packets) {
+	return ts_sync_scan_scalar(buf, len, packets);
+}
+
+#endif // TSSYNC_X86
+
+typedef size_t (*scan_func)(const char *buf, size_t len, unsigned packets);
+static const scan_func scan_best = cpu_has_avx2() ? ts_sync_scan_avx2 : ts_sync_scan_sse2;
+
+size_t ts_sync_scan(const char *buf, size_t len, unsigned packets) {
+	return scan_best(buf, len, packets);
+}
+
+} // namespace
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,30 @@
+#ifndef __TSSYNC_H__
+#define __TSSYNC_H__
+
+#include <stddef.h>
+
+#define TS_SYNC_PACKETS 5 // Number of consecutive sync bytes needed to regain sync
+
+namespace Segmenter {
+
+size_t ts_sync_scan(const char *buf, size_t len, unsigned packets = TS_SYNC_PACKETS);
+/* Finds the first offset in buf where a sync byte (0x47) repeats every
+ * 188 bytes for `packets` packets.
+ * If there is none, returns the number of bytes that can safely be
+ * skipped: len - (packets-1)*188, or 0 if buf is shorter than that.
+ * Uses AVX2 or SSE2 when the CPU has it.
+ */
+
+size_t ts_sync_scan_scalar(const char *buf, size_t len, unsigned packets);
+size_t ts_sync_scan_sse2(const char *buf, size_t len, unsigned packets);
+size_t ts_sync_scan_avx2(const char *buf, size_t len, unsigned packets);
+/* The implementations behind ts_sync_scan(). The vector versions
+ * fall back to the scalar one when not compiled for x86.
+ * Only call ts_sync_scan_avx2() if cpu_has_avx2().
+ */
+
+} // namespace
+
+#endif
+
+// vim: set ts=4 sw=4:
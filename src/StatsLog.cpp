@@ -0,0 +1,184 @@
+#include "StatsLog.hpp"
+#include "Clock.hpp"
+#include <iomanip>
+#include <sstream>
+#include <stdio.h>
+#include <sys/time.h>
+
+void StatsLog::Record::clear() {
+	rendition.clear();
+	sequence = 0;
+	filename.clear();
+	duration = 0;
+	bytes_in = bytes_out = 0;
+	stream.clear();
+	parse_ns = encrypt_ns = write_ns = stall_ns = 0;
+}
+
+StatsLog::StatsLog(const std::string &json_filename, const std::string &prometheus_filename) :
+	m_prometheus_filename(prometheus_filename) {
+	pthread_mutex_init(&m_lock, NULL);
+	if( ! json_filename.empty() ) {
+		m_json.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+		m_json.open(json_filename.c_str(), std::ios_base::app | std::ios_base::out);
+	}
+}
+
+StatsLog::~StatsLog() {
+	pthread_mutex_destroy(&m_lock);
+}
+
+static void json_string(std::ostream &out, const std::string &s) {
+	out << '"';
+	for( size_t i = 0; i < s.size(); i++ ) {
+		unsigned char c = s[i];
+		if( c == '"' || c == '\\' ) {
+			out << '\\' << c;
+		} else if( c < 0x20 ) {
+			out << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0x0f];
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+static void json_span(std::ostream &out, signed long long first, signed long long last) {
+	if( first == -1 ) {
+		out << "null";
+	} else {
+		out << ((last - first) & 0x1ffffffffLL) / 90000.0;
+	}
+}
+
+void StatsLog::Add(const Record &r) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	double bitrate = r.duration > 0 ? r.bytes_out * 8 / r.duration : 0;
+
+	std::ostringstream line; // Rendered before taking the lock
+	line << std::fixed << std::setprecision(3);
+	line << "{\"time\":" << now.tv_sec + now.tv_usec / 1e6
+	     << ",\"rendition\":";
+	json_string(line, r.rendition);
+	line << ",\"sequence\":" << r.sequence
+	     << ",\"file\":";
+	json_string(line, r.filename);
+	line << ",\"duration\":" << r.duration
+	     << ",\"bytes_in\":" << r.bytes_in
+	     << ",\"bytes_out\":" << r.bytes_out
+	     << ",\"bitrate\":" << std::setprecision(0) << bitrate << std::setprecision(3)
+	     << ",\"kept\":" << r.stream.kept
+	     << ",\"dropped\":" << r.stream.dropped
+	     << ",\"pids\":{";
+	for( typeof(r.stream.pids.begin()) i = r.stream.pids.begin(); i != r.stream.pids.end(); i++ ) {
+		if( i != r.stream.pids.begin() ) line << ",";
+		line << "\"" << i->first << "\":{\"kept\":" << i->second.kept << ",\"dropped\":" << i->second.dropped << "}";
+	}
+	line << "},\"frames\":" << r.stream.frames
+	     << ",\"resyncs\":" << r.stream.resyncs
+	     << ",\"pcr_span\":";
+	json_span(line, r.stream.first_pcr, r.stream.last_pcr);
+	line << ",\"pts_span\":";
+	json_span(line, r.stream.first_pts, r.stream.last_pts);
+	line << ",\"parse_ms\":" << r.parse_ns / 1e6
+	     << ",\"encrypt_ms\":" << r.encrypt_ns / 1e6
+	     << ",\"write_ms\":" << r.write_ns / 1e6
+	     << ",\"input_stall_ms\":" << r.stall_ns / 1e6
+	     << "}\n";
+	std::string l = line.str();
+
+	pthread_mutex_lock(&m_lock);
+	try {
+		if( m_json.is_open() ) {
+			m_json.write(l.data(), l.size());
+			m_json.flush(); // Whole lines only
+		}
+
+		struct totals &t = m_totals[r.rendition];
+		t.segments++;
+		t.bytes_in += r.bytes_in;
+		t.bytes_out += r.bytes_out;
+		t.kept += r.stream.kept;
+		t.dropped += r.stream.dropped;
+		t.frames += r.stream.frames;
+		t.resyncs += r.stream.resyncs;
+		t.parse_ns += r.parse_ns;
+		t.encrypt_ns += r.encrypt_ns;
+		t.write_ns += r.write_ns;
+		t.stall_ns += r.stall_ns;
+		t.sequence = r.sequence;
+		t.duration = r.duration;
+		t.bitrate = bitrate;
+
+		if( ! m_prometheus_filename.empty() ) WritePrometheus();
+	} catch( ... ) {
+		pthread_mutex_unlock(&m_lock);
+		throw;
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+#define METRIC(name, type, help, field, scale) \
+	out << "# HELP segmenter_" name " " help "\n" \
+	    << "# TYPE segmenter_" name " " type "\n"; \
+	for( typeof(m_totals.begin()) i = m_totals.begin(); i != m_totals.end(); i++ ) { \
+		out << "segmenter_" name "{rendition=\""; \
+		for( size_t j = 0; j < i->first.size(); j++ ) { \
+			if( i->first[j] == '"' || i->first[j] == '\\' ) out << '\\'; \
+			out << i->first[j]; \
+		} \
+		out << "\"} " << i->second.field / scale << "\n"; \
+	}
+
+void StatsLog::WritePrometheus() {
+	std::ostringstream out;
+	out << std::setprecision(12);
+	METRIC("segments_total", "counter", "Segments written", segments, 1)
+	METRIC("input_bytes_total", "counter", "Bytes read from the input", bytes_in, 1)
+	METRIC("output_bytes_total", "counter", "Bytes written to segments", bytes_out, 1)
+	METRIC("kept_total", "counter", "TS packets or audio frames copied", kept, 1)
+	METRIC("dropped_total", "counter", "TS packets left out", dropped, 1)
+	METRIC("frames_total", "counter", "Video pictures or audio frames", frames, 1)
+	METRIC("resyncs_total", "counter", "Times the input lost sync", resyncs, 1)
+	METRIC("parse_seconds_total", "counter", "Time spent parsing and copying", parse_ns, 1e9)
+	METRIC("encrypt_seconds_total", "counter", "Time spent encrypting", encrypt_ns, 1e9)
+	METRIC("write_seconds_total", "counter", "Time spent writing segments", write_ns, 1e9)
+	METRIC("input_stall_seconds_total", "counter", "Time spent waiting for input", stall_ns, 1e9)
+	METRIC("last_sequence", "gauge", "Sequence number of the last segment", sequence, 1)
+	METRIC("last_duration_seconds", "gauge", "Duration of the last segment", duration, 1)
+	METRIC("last_bitrate_bps", "gauge", "Bitrate of the last segment", bitrate, 1)
+
+	std::string temp_filename = m_prometheus_filename + ".tmp";
+	std::ofstream file;
+	file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+	file.open(temp_filename.c_str());
+	file << out.str();
+	file.close();
+	if( rename(temp_filename.c_str(), m_prometheus_filename.c_str()) ) {
+		throw std::ios_base::failure("Could not rename Prometheus file");
+	}
+}
+
+int TimedStreamBuffer::overflow(int c) {
+	if( std::char_traits<char>::eq_int_type(c, std::char_traits<char>::eof()) ) return std::char_traits<char>::not_eof(c);
+	char ch = c;
+	xsputn(&ch, 1);
+	return c;
+}
+
+std::streamsize TimedStreamBuffer::xsputn(const char *s, std::streamsize n) {
+	unsigned long long start = monotonic_ns();
+	m_output.write(s, n);
+	*m_ns += monotonic_ns() - start;
+	return n;
+}
+
+int TimedStreamBuffer::sync() {
+	unsigned long long start = monotonic_ns();
+	m_output.flush();
+	*m_ns += monotonic_ns() - start;
+	return 0;
+}
+
+// vim: set ts=4 sw=4:
@@ -0,0 +1,87 @@
+#ifndef __STATSLOG_H__
+#define __STATSLOG_H__
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <pthread.h>
+#include "Segmenter/Segmenter.hpp"
+
+/* Statistics of every segment, of all renditions
+ *
+ * Each segment is appended to a JSON-lines file as one object, written in
+ * one go. The Prometheus text file holds running totals per rendition and
+ * is rewritten (to a temp file, then renamed) after every segment.
+ * Either file name may be empty.
+ *
+ * Renditions add their segments from their own threads; that's once per
+ * segment, so a plain lock will do.
+ */
+class StatsLog {
+public:
+	struct Record {
+		std::string rendition;
+		unsigned long sequence;
+		std::string filename;
+		float duration;
+		unsigned long long bytes_in, bytes_out;
+		Segmenter::Stats stream;
+		unsigned long long parse_ns; // Parsing and copying, without the rest
+		unsigned long long encrypt_ns;
+		unsigned long long write_ns;
+		unsigned long long stall_ns; // Waiting for input
+
+		Record() { clear(); }
+		void clear();
+	};
+
+	StatsLog(const std::string &json_filename, const std::string &prometheus_filename);
+	~StatsLog();
+
+	void Add(const Record &r);
+	/* Thread-safe; throws std::ios_base::failure if a file can't be written */
+
+private:
+	pthread_mutex_t m_lock;
+	std::ofstream m_json;
+	std::string m_prometheus_filename;
+	struct totals {
+		unsigned long long segments, bytes_in, bytes_out, kept, dropped, frames, resyncs;
+		unsigned long long parse_ns, encrypt_ns, write_ns, stall_ns;
+		unsigned long sequence;
+		float duration;
+		double bitrate;
+	};
+	std::map<std::string, struct totals> m_totals; // Per rendition
+
+	void WritePrometheus();
+};
+
+class TimedStreamBuffer : public std::basic_streambuf<char, std::char_traits<char> > {
+public:
+	TimedStreamBuffer(std::ostream &output, unsigned long long *ns) : m_output(output), m_ns(ns) {}
+
+protected:
+	virtual int overflow(int c);
+	virtual std::streamsize xsputn(const char *s, std::streamsize n);
+	virtual int sync();
+
+private:
+	std::ostream &m_output;
+	unsigned long long *m_ns;
+};
+
+class TimedStream : public std::basic_ostream<char, std::char_traits<char> > {
+private:
+	TimedStreamBuffer m_buf;
+public:
+	TimedStream(std::ostream &output, unsigned long long *ns) :
+		std::basic_ostream<char, std::char_traits<char> >( &m_buf ),
+		m_buf( output, ns )
+		{}
+};
+/* Passes everything on to output unbuffered, adding the time that takes to *ns
+ */
+
+#endif
+// vim: set ts=4 sw=4:
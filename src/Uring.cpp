@@ -0,0 +1,357 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include "Uring.hpp"
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz) {
+	return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned count) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+Uring::Uring(unsigned entries, unsigned files) :
+	m_fd(-1),
+	m_sq_ring(MAP_FAILED),
+	m_cq_ring(MAP_FAILED),
+	m_sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+	m_queued(0),
+	m_pending(0) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	m_fd = io_uring_setup(entries, &p);
+	if( m_fd < 0 ) throw std::runtime_error(std::string("io_uring_setup: ") + strerror(errno));
+	if( ! (p.features & IORING_FEAT_EXT_ARG) ) {
+		::close(m_fd);
+		throw std::runtime_error("io_uring: kernel too old");
+	}
+	m_entries = p.sq_entries;
+
+	m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		if( m_cq_ring_size > m_sq_ring_size ) m_sq_ring_size = m_cq_ring_size;
+		m_cq_ring_size = m_sq_ring_size;
+	}
+	m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+	if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		m_cq_ring = m_sq_ring;
+	} else if( m_sq_ring != MAP_FAILED ) {
+		m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+	}
+	if( m_cq_ring != MAP_FAILED ) {
+		m_sqes = static_cast<struct io_uring_sqe*>(mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+	}
+	if( m_sqes == MAP_FAILED ) {
+		int err = errno;
+		cleanup();
+		throw std::runtime_error(std::string("io_uring mmap: ") + strerror(err));
+	}
+
+	char *sq = static_cast<char*>(m_sq_ring), *cq = static_cast<char*>(m_cq_ring);
+	m_sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+	m_sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+	m_sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+	m_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+	m_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+	m_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+	m_cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+	m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+	// Sparse file table to open into
+	std::vector<int> fds(files, -1);
+	if( io_uring_register(m_fd, IORING_REGISTER_FILES, &fds[0], files) < 0 ) {
+		int err = errno;
+		cleanup();
+		throw std::runtime_error(std::string("io_uring file table: ") + strerror(err));
+	}
+	for( unsigned i = files; i > 0; i-- ) m_free_slots.push_back(i-1);
+}
+
+Uring::~Uring() {
+	cleanup();
+}
+
+void Uring::cleanup() {
+	if( m_sqes != MAP_FAILED ) munmap(m_sqes, m_entries * sizeof(struct io_uring_sqe));
+	if( m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring ) munmap(m_cq_ring, m_cq_ring_size);
+	if( m_sq_ring != MAP_FAILED ) munmap(m_sq_ring, m_sq_ring_size);
+	if( m_fd >= 0 ) ::close(m_fd);
+	m_fd = -1;
+	m_sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+	m_sq_ring = m_cq_ring = MAP_FAILED;
+}
+
+bool Uring::supported() {
+	try {
+		Uring probe(4, 1);
+		return true;
+	} catch( std::exception &e ) {
+		return false;
+	}
+}
+
+struct io_uring_sqe *Uring::sqe(int opcode, Op *op, bool link) {
+	unsigned tail = *m_sq_tail + m_queued;
+	if( tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_entries ) {
+		submit(); // Make room
+		tail = *m_sq_tail;
+		while( tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_entries ) {
+			enter(1, 0);
+		}
+	}
+	unsigned index = tail & *m_sq_mask;
+	struct io_uring_sqe *s = &m_sqes[index];
+	memset(s, 0, sizeof(*s));
+	s->opcode = opcode;
+	s->user_data = reinterpret_cast<unsigned long long>(op);
+	if( link ) s->flags |= IOSQE_IO_LINK;
+	m_sq_array[index] = index;
+	m_queued++;
+	m_pending++;
+	return s;
+}
+
+void Uring::openat(const char *path, int flags, mode_t mode, unsigned slot, Op *op, bool link) {
+	struct io_uring_sqe *s = sqe(IORING_OP_OPENAT, op, link);
+	s->fd = AT_FDCWD;
+	s->addr = reinterpret_cast<unsigned long long>(path);
+	s->len = mode;
+	s->open_flags = flags;
+	s->file_index = slot + 1;
+}
+
+void Uring::write(unsigned slot, const void *buf, size_t length, unsigned long long offset, Op *op, bool link) {
+	struct io_uring_sqe *s = sqe(IORING_OP_WRITE, op, link);
+	s->flags |= IOSQE_FIXED_FILE;
+	s->fd = slot;
+	s->addr = reinterpret_cast<unsigned long long>(buf);
+	s->len = length;
+	s->off = offset;
+}
+
+void Uring::writev(unsigned slot, const struct iovec *iov, unsigned count, unsigned long long offset, Op *op, bool link) {
+	struct io_uring_sqe *s = sqe(IORING_OP_WRITEV, op, link);
+	s->flags |= IOSQE_FIXED_FILE;
+	s->fd = slot;
+	s->addr = reinterpret_cast<unsigned long long>(iov);
+	s->len = count;
+	s->off = offset;
+}
+
+void Uring::close(unsigned slot, Op *op, bool link) {
+	struct io_uring_sqe *s = sqe(IORING_OP_CLOSE, op, link);
+	s->file_index = slot + 1;
+}
+
+void Uring::renameat(const char *from, const char *to, Op *op, bool link) {
+	struct io_uring_sqe *s = sqe(IORING_OP_RENAMEAT, op, link);
+	s->fd = AT_FDCWD;
+	s->addr = reinterpret_cast<unsigned long long>(from);
+	s->len = AT_FDCWD;
+	s->addr2 = reinterpret_cast<unsigned long long>(to);
+}
+
+void Uring::unlinkat(const char *path, Op *op, bool link) {
+	struct io_uring_sqe *s = sqe(IORING_OP_UNLINKAT, op, link);
+	s->fd = AT_FDCWD;
+	s->addr = reinterpret_cast<unsigned long long>(path);
+}
+
+void Uring::enter(unsigned wait, unsigned wait_us) {
+	// Everything published in the SQ ring that the kernel didn't take yet
+	unsigned submit = *m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+	unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	void *argp = NULL;
+	size_t argsz = 0;
+	if( wait && wait_us ) {
+		ts.tv_sec = wait_us / 1000000;
+		ts.tv_nsec = (wait_us % 1000000) * 1000;
+		memset(&arg, 0, sizeof(arg));
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = reinterpret_cast<unsigned long long>(&ts);
+		argp = &arg;
+		argsz = sizeof(arg);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+	while( io_uring_enter(m_fd, submit, wait, flags, argp, argsz) < 0 ) {
+		if( errno == ETIME ) return; // Nothing came in
+		if( errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+			throw std::runtime_error(std::string("io_uring_enter: ") + strerror(errno));
+		}
+		if( errno != EINTR ) return; // Completions have to be reaped first
+	}
+}
+
+void Uring::submit() {
+	if( m_queued ) {
+		__atomic_store_n(m_sq_tail, *m_sq_tail + m_queued, __ATOMIC_RELEASE);
+		m_queued = 0;
+	}
+	if( *m_sq_tail != __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) ) enter(0, 0);
+}
+
+void Uring::reap(unsigned wait_us) {
+	submit();
+	if( wait_us && *m_cq_head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) && m_pending > 0 ) {
+		enter(1, wait_us);
+	}
+	unsigned head;
+	while( (head = *m_cq_head) != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) ) {
+		struct io_uring_cqe *c = &m_cqes[head & *m_cq_mask];
+		Op *op = reinterpret_cast<Op*>(c->user_data);
+		int result = c->res;
+		__atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE); // Before done(), which may reap too
+		m_pending--;
+		if( op ) op->done(result);
+	}
+}
+
+class Uring::FileWrite {
+public:
+	enum { OPEN, WRITE, CLOSE, RENAME, STAGES };
+	class Stage : public Op {
+	public:
+		FileWrite *f;
+		int n;
+		virtual void done(int result) { f->done(n, result); }
+	};
+
+	Uring *ring;
+	std::string path, data, rename_to;
+	unsigned slot;
+	Op *op;
+	Stage stage[STAGES];
+	int result[STAGES];
+	unsigned remaining;
+	bool reclosing;
+
+	void done(int n, int r) {
+		result[n] = r;
+		if( --remaining > 0 ) return;
+
+		if( result[OPEN] >= 0 && result[CLOSE] < 0 && ! reclosing ) {
+			// A failed write cancelled the close; the file is still in its slot
+			reclosing = true;
+			remaining = 1;
+			ring->close(slot, &stage[CLOSE]);
+			return;
+		}
+		ring->freeSlot(slot);
+
+		if( result[WRITE] >= 0 && static_cast<size_t>(result[WRITE]) != data.size() ) result[WRITE] = -EIO;
+		int error = 0;
+		for( int i = 0; i < STAGES && error == 0; i++ ) { // The first failure cancelled what came after
+			if( result[i] < 0 ) error = result[i];
+		}
+		Op *o = op;
+		delete this;
+		if( o ) o->done(error);
+	}
+};
+
+void Uring::writeFile(const std::string &path, const std::string &data, const std::string &rename_to, Op *op) {
+	unsigned slot;
+	while( ! allocSlot(slot) ) {
+		if( m_pending == 0 ) throw std::runtime_error("io_uring: out of file slots");
+		reap(1000);
+	}
+	FileWrite *f = new FileWrite;
+	f->ring = this;
+	f->path = path;
+	f->data = data;
+	f->rename_to = rename_to;
+	f->slot = slot;
+	f->op = op;
+	f->reclosing = false;
+	for( int i = 0; i < FileWrite::STAGES; i++ ) {
+		f->stage[i].f = f;
+		f->stage[i].n = i;
+		f->result[i] = 0;
+	}
+	f->remaining = rename_to.empty() ? 3 : 4;
+
+	openat(f->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666, slot, &f->stage[FileWrite::OPEN], true);
+	write(slot, f->data.data(), f->data.size(), 0, &f->stage[FileWrite::WRITE], true);
+	close(slot, &f->stage[FileWrite::CLOSE], ! rename_to.empty());
+	if( ! rename_to.empty() ) {
+		renameat(f->path.c_str(), f->rename_to.c_str(), &f->stage[FileWrite::RENAME]);
+	}
+}
+
+class Uring::Removal : public Op {
+public:
+	std::string path;
+	Op *op;
+	virtual void done(int result) {
+		Op *o = op;
+		delete this;
+		if( o ) o->done(result);
+	}
+};
+
+void Uring::removeFile(const std::string &path, Op *op) {
+	Removal *r = new Removal;
+	r->path = path;
+	r->op = op;
+	unlinkat(r->path.c_str(), r);
+}
+
+bool Uring::allocSlot(unsigned &slot) {
+	if( m_free_slots.empty() ) return false;
+	slot = m_free_slots.back();
+	m_free_slots.pop_back();
+	return true;
+}
+
+void Uring::freeSlot(unsigned slot) {
+	m_free_slots.push_back(slot);
+}
+
+#else // HAVE_LINUX_IO_URING_H
+
+Uring::Uring(unsigned entries, unsigned files) {
+	throw std::runtime_error("Compiled without io_uring support");
+}
+
+Uring::~Uring() {}
+void Uring::cleanup() {}
+
+bool Uring::supported() { return false; }
+
+void Uring::openat(const char *path, int flags, mode_t mode, unsigned slot, Op *op, bool link) {}
+void Uring::write(unsigned slot, const void *buf, size_t length, unsigned long long offset, Op *op, bool link) {}
+void Uring::writev(unsigned slot, const struct iovec *iov, unsigned count, unsigned long long offset, Op *op, bool link) {}
+void Uring::close(unsigned slot, Op *op, bool link) {}
+void Uring::renameat(const char *from, const char *to, Op *op, bool link) {}
+void Uring::unlinkat(const char *path, Op *op, bool link) {}
+void Uring::writeFile(const std::string &path, const std::string &data, const std::string &rename_to, Op *op) {}
+void Uring::removeFile(const std::string &path, Op *op) {}
+void Uring::submit() {}
+void Uring::reap(unsigned wait_us) {}
+bool Uring::allocSlot(unsigned &slot) { return false; }
+void Uring::freeSlot(unsigned slot) {}
+
+#endif // HAVE_LINUX_IO_URING_H
+
+// vim: set ts=4 sw=4:
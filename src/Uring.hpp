@@ -0,0 +1,92 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+
+/* Minimal io_uring submission/completion ring, straight on the system calls
+ *
+ * Operations are queued with the calls below and handed to the kernel in
+ * one go by submit(). Files are opened into slots of a registered file
+ * table, so an open can be linked to the writes and close that follow it
+ * without a round trip to learn the descriptor.
+ *
+ * Not thread-safe: use a ring from one thread only.
+ */
+class Uring {
+public:
+	class Op {
+	public:
+		virtual ~Op() {}
+		virtual void done(int result) = 0;
+		/* Called from reap() when the operation completes
+		 * result is what the system call would have returned, or -errno.
+		 * Operations linked after a failed one complete with -ECANCELED
+		 */
+	};
+
+	Uring(unsigned entries = 256, unsigned files = 64);
+	/* Throws std::runtime_error if the kernel doesn't do io_uring
+	 */
+	~Uring();
+
+	static bool supported();
+
+	/* Queue an operation; op may be NULL if the result doesn't matter.
+	 * With link set, the next queued operation only starts after this one
+	 * succeeded. Strings and buffers must stay valid until completion.
+	 */
+	void openat(const char *path, int flags, mode_t mode, unsigned slot, Op *op, bool link = false);
+	void write(unsigned slot, const void *buf, size_t length, unsigned long long offset, Op *op, bool link = false);
+	void writev(unsigned slot, const struct iovec *iov, unsigned count, unsigned long long offset, Op *op, bool link = false);
+	void close(unsigned slot, Op *op, bool link = false);
+	void renameat(const char *from, const char *to, Op *op, bool link = false);
+	void unlinkat(const char *path, Op *op, bool link = false);
+
+	void writeFile(const std::string &path, const std::string &data, const std::string &rename_to, Op *op);
+	/* Creates path with data in one linked chain of open, write, close and,
+	 * if rename_to isn't empty, rename. op gets the first error, or 0.
+	 * Takes copies of the strings, and a slot until it's done
+	 */
+	void removeFile(const std::string &path, Op *op = NULL);
+	/* unlinkat() that takes a copy of path */
+
+	void submit();
+	void reap(unsigned wait_us = 0);
+	/* Submits whatever is queued and handles the completions that are in,
+	 * waiting up to wait_us microseconds for the first one. Op::done() may
+	 * queue more, and even reap() again
+	 */
+
+	unsigned pending() const { return m_pending; }
+	/* Operations queued or in flight */
+
+	bool allocSlot(unsigned &slot);
+	void freeSlot(unsigned slot);
+	/* Slots in the file table; a slot is free again once its close completed */
+
+private:
+	class FileWrite;
+	class Removal;
+
+	int m_fd;
+	unsigned m_entries;
+	void *m_sq_ring, *m_cq_ring;
+	size_t m_sq_ring_size, m_cq_ring_size;
+	struct io_uring_sqe *m_sqes;
+	unsigned *m_sq_head, *m_sq_tail, *m_sq_mask, *m_sq_array;
+	unsigned *m_cq_head, *m_cq_tail, *m_cq_mask;
+	struct io_uring_cqe *m_cqes;
+	unsigned m_queued; // Not yet submitted
+	unsigned m_pending;
+	std::vector<unsigned> m_free_slots;
+
+	struct io_uring_sqe *sqe(int opcode, Op *op, bool link);
+	void enter(unsigned wait, unsigned wait_us);
+	void cleanup();
+};
+
+#endif
+// vim: set ts=4 sw=4:
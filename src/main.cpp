@@ -1,30 +1,100 @@
 #include <iostream>
 #include <sysexits.h>
 #include <list>
+#include <algorithm>
+#include <vector>
 #include <getopt.h>
 #include <sstream>
 #include <stdexcept>
 #include <assert.h>
 #include <math.h>
 #include <memory>
+#include <unistd.h>
+#include <sys/stat.h>
 
-#include "Segmenter/Segmenter.hpp"
+#include "Segmenter/Formats.hpp"
+#include "Segmenter/Mpts.hpp"
+#include "Input/Stream.hpp"
+#include "Input/Mmap.hpp"
 #include "IndexFile.hpp"
 #include "IndexFileLive.hpp"
-#include "Crypto/CryptoAes128cbc.hpp"
+#include "IndexFileMaster.hpp"
+#include "Crypto/CryptoEngine.hpp"
+#include "KeyStore.hpp"
+#include "Pool.hpp"
+#include "Uring.hpp"
+#include "StatsLog.hpp"
+#include "Monitor.hpp"
+#include "Rendition.hpp"
 #include "Random/RandomC.hpp"
 #include "FileArray/Sequence.hpp"
 #include "FileArray/Timestamp.hpp"
 
+static std::string prefixed_name(const std::string &name, const std::string &prefix) {
+	/* "dir/file" becomes "dir/<prefix>-file" */
+	size_t base = name.find_last_of('/');
+	base = (base == std::string::npos) ? 0 : base + 1;
+	return name.substr(0, base) + prefix + "-" + name.substr(base);
+}
+
+#define PROBE_SIZE (64*1024) // Bytes looked at to detect the format
+#define PAT_PROBE_SIZE (4*1024*1024) // Bytes looked at to find the PAT
+
+static std::vector<unsigned> probe_programs(Input::Input *in) {
+	/* The programs in the first PAT of an MPEG-TS input, reading more of it
+	 * as long as there is none
+	 */
+	std::vector<unsigned> ret;
+	for( size_t size = PROBE_SIZE; size <= PAT_PROBE_SIZE; size *= 2 ) {
+		bool more = in->fill(size);
+		ret = Segmenter::Mpts::programs(in->data(), in->available());
+		if( ! ret.empty() || ! more ) break;
+	}
+	return ret;
+}
+
+static Input::Input *open_input(const std::string &in_filename) {
+	if( in_filename.empty() ) {
+		std::cin.exceptions( std::ifstream::eofbit | std::ifstream::failbit | std::ifstream::badbit );
+		return new Input::Stream(std::cin);
+	}
+
+	struct stat in_stat;
+	if( stat(in_filename.c_str(), &in_stat) == 0 && S_ISREG(in_stat.st_mode) ) {
+		// Regular file: map it and let the segmenter work straight from the page cache
+		std::cerr << "Mapping input file \"" << in_filename << "\"\n";
+		return new Input::Mmap(in_filename);
+	}
+
+	std::cerr << "Opening input file \"" << in_filename << "\"\n";
+	std::ifstream *in_file = new std::ifstream(in_filename.c_str());
+	in_file->exceptions( std::ifstream::eofbit | std::ifstream::failbit | std::ifstream::badbit );
+	return new Input::Stream(*in_file);
+}
+
 int main(int argc, char *argv[]) {
 	float duration = 10;
 	std::string out_file_pattern("out-?????.ts");
-	std::auto_ptr<FileArray::FileArray> out_filenames( new FileArray::Sequence(out_file_pattern, '?') );
-	IndexFile *index = new IndexFile("out.m3u8", duration);
+	bool out_timestamp = false;
+	std::string index_filename("out.m3u8");
+	std::string uri_prefix, uri_suffix, key_prefix, key_suffix;
+	unsigned long live = 0;
 	std::string extra_options;
-	std::istream *in = &std::cin;
+	std::string format("auto");
+	std::vector<std::string> in_filenames;
+	std::vector<unsigned> selected_programs;
+	std::string master_filename;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool parallel = false;
+	long pipeline = 0;
+	bool uring = false;
+	std::string stats_filename, prometheus_filename;
+	std::string monitor_channel;
 	unsigned long crypto = 0;
+	std::string crypto_engine("auto");
 	FileArray::Sequence key_filenames("key-????.key", '?');
+	std::string byterange_filename;
+	bool byterange_input = false;
 
 	static const struct option long_opts[] = {
 		/* name, arg, flag, val */
@@ -35,24 +105,40 @@ int main(int argc, char *argv[]) {
 		{"out-suffix",  required_argument,      NULL, 's'},
 		{"length",      required_argument,      NULL, 'l'},
 		{"extra",       required_argument,      NULL, 'e'},
+		{"format",      required_argument,      NULL, 'f'},
 		{"index",       required_argument,      NULL, 'I'},
 		{"live",        required_argument,      NULL, 'L'},
 		{"crypto",      required_argument,      NULL, 'c'},
 		{"key",         required_argument,      NULL, 'k'},
 		{"key-prefix",  required_argument,      NULL, 'K'},
 		{"key-suffix",  required_argument,      NULL, 'S'},
+		{"crypto-engine", required_argument,    NULL, 'E'},
 		{"timestamp",   no_argument,            NULL, 't'},
+		{"byterange",   required_argument,      NULL, 'b'},
+		{"byterange-input", no_argument,        NULL, 'B'},
+		{"master",      required_argument,      NULL, 'M'},
+		{"threads",     required_argument,      NULL, 'j'},
+		{"parallel",    no_argument,            NULL, 'p'},
+		{"pipeline",    required_argument,      NULL, 'P'},
+		{"uring",       no_argument,            NULL, 'U'},
+		{"stats",       required_argument,      NULL, 'J'},
+		{"prometheus",  required_argument,      NULL, 'R'},
+		{"monitor",     required_argument,      NULL, 'm'},
+		{"programs",    required_argument,      NULL, 'n'},
 		{NULL, 0, NULL, 0}
 	};
 
 	int option;
-	while( -1 != (option = getopt_long(argc, argv, "?i:o:O:s:l:e:I:L:c:k:K:S:t", long_opts, NULL)) ) { switch(option) {
+	while( -1 != (option = getopt_long(argc, argv, "?i:o:O:s:l:e:f:I:L:c:k:K:S:E:tb:BM:j:pP:UJ:R:m:n:", long_opts, NULL)) ) { switch(option) {
     	case '?': /* help */
 			std::cerr << "Usage: " << argv[0] << " [options]\n"
 			          << "\n"
 					  //  <-------- --------- --------- -- 80 chars wide -- --------- --------- --------->
 					  << "Options are:\n"
 					  << "  -i --input s       Source file, default stdin.\n"
+					  << "                     Repeat to segment several renditions at once; their\n"
+					  << "                     output, index and byterange files get an \"r<n>-\"\n"
+					  << "                     prefix, and a master playlist lists them\n"
 					  << "  -o --output s      Destination pattern. '?' are replaced with a sequence\n"
 					  << "                     default \"out-?????.ts\"\n"
 					  << "  -t --timestamp     Fill in pattern with current timestamp instead of sequence\n"
@@ -64,6 +150,12 @@ int main(int argc, char *argv[]) {
 					  << "                     The rest of the argument is passed to the segmenting\n"
 					  << "                     module as-is and may contain extra settings\n"
 					  << "  -e --extra s       Extra parameters, see below\n"
+					  << "  -f --format s      Input format, see below, or \"auto\" (default) to tell\n"
+					  << "                     from the start of every input\n"
+					  << "  -n --programs s    Program numbers to segment out of a multi-program TS,\n"
+					  << "                     comma separated; default all of them. Every program\n"
+					  << "                     gets its own files and index, with a \"p<number>-\"\n"
+					  << "                     prefix. The input is read once for all of them\n"
 					  << "  -I --index s       Index list file, default \"out.m3u8\"\n"
 					  << "  -L --live i        Specifies how many segments to put in the live playlist\n"
 					  << "                     You probably want to set -i to a pipe to use this\n"
@@ -73,25 +165,55 @@ int main(int argc, char *argv[]) {
 					  << "                     default \"key-?????.key\"\n"
 					  << "  -K --key-prefix s  Prefix to add to every key filename in the index\n"
 					  << "  -S --key-suffix s  Suffix to add to every key filename in the index\n"
+					  << "  -E --crypto-engine s\n"
+					  << "                     AES implementation: \"aesni\", \"aesni-mb\", \"openssl\"\n"
+					  << "                     or \"auto\"\n"
+					  << "                     (default: AES-NI if the CPU has it)\n"
+					  << "  -b --byterange s   Write all segments into the single file s and list them\n"
+					  << "                     as byte ranges in the index\n"
+					  << "  -B --byterange-input\n"
+					  << "                     Don't write any segments; list byte ranges of the input\n"
+					  << "                     file (-i) in the index instead. Can't be used with -c\n"
+					  << "  -M --master s      Master playlist, default \"master.m3u8\"\n"
+					  << "                     Only written for multiple inputs, unless given\n"
+					  << "  -j --threads i     Number of threads to segment renditions on\n"
+					  << "                     default: the number of CPUs. For live inputs, use at\n"
+					  << "                     least as many threads as inputs\n"
+					  << "  -p --parallel      Split a file input up front, using all threads, and\n"
+					  << "                     write its segments in parallel. Same result as\n"
+					  << "                     without -p. Only for segment files (not -b, -B or\n"
+					  << "                     -t), and segmenters that support it (MpegtsH264)\n"
+					  << "  -P --pipeline i    Encrypt and write on separate threads, behind queues of\n"
+					  << "                     i buffers of 256KiB, so slow disks don't hold up\n"
+					  << "                     reading the input. Useful for live inputs\n"
+					  << "  -U --uring         Write segments, keys and the live playlist through\n"
+					  << "                     io_uring, in batches. Implies -P 16 unless given\n"
+					  << "  -J --stats s       Append statistics of every segment to s, one JSON\n"
+					  << "                     object per line: sizes, packets per PID, PCR/PTS span,\n"
+					  << "                     and time spent parsing, encrypting, writing and\n"
+					  << "                     waiting for input\n"
+					  << "  -R --prometheus s  Keep totals of these per rendition in s, in the\n"
+					  << "                     Prometheus text format\n"
+					  << "  -m --monitor s     Publish live counters as channel s in shared memory,\n"
+					  << "                     for segtop to show\n"
 					  << "\n",
-			Segmenter::SEGMENTER::usage();
+			Segmenter::usage();
 			exit(EX_USAGE);
 			break; // will never be reached
 
 		case 'i': /* input */
-			std::cerr << "Opening input file \"" << optarg << "\"\n";
-			in = new std::ifstream(optarg);
+			in_filenames.push_back(optarg);
 			break;
 			
 		case 'o': /* output */
 			out_file_pattern.assign(optarg);
-			out_filenames->init(out_file_pattern, '?');
+			FileArray::Sequence(out_file_pattern, '?'); // Throws if invalid
 			break;
 		case 'O': /* out-prefix */
-			index->setUriPrefix(optarg);
+			uri_prefix = optarg;
 			break;
 		case 's': /* out-suffix */
-			index->setUriSuffix(optarg);
+			uri_suffix = optarg;
 			break;
 
 
@@ -102,27 +224,29 @@ int main(int argc, char *argv[]) {
 				std::cerr << "Invalid integer for length parameter \"" << optarg << "\"\n";
 				exit(EX_USAGE);
 			}
-			index->setTargetDuration(duration);
 			break;
 
 		case 'e':
 			extra_options = optarg;
 			break;
 
+		case 'f': /* format */
+			format = optarg;
+			if( format != "auto" && ! Segmenter::valid_format(format) ) {
+				std::cerr << "Unknown format \"" << optarg << "\"\n";
+				exit(EX_USAGE);
+			}
+			break;
+
 		case 'I': /* index */
-			index->setFilename(optarg);
+			index_filename = optarg;
 			break;
 
 		case 'L': /* live */
-			{
-				unsigned long live = strtol(optarg, &tmp, 10);
-				if( tmp == optarg ) {
-					std::cerr << "Invalid integer for live parameter \"" << optarg << "\"\n";
-					exit(EX_USAGE);
-				}
-				IndexFile *tmp_idx = new IndexFileLive( index->Filename(), index->TargetDuration(), live, true);
-				delete index;
-				index = tmp_idx;
+			live = strtol(optarg, &tmp, 10);
+			if( tmp == optarg ) {
+				std::cerr << "Invalid integer for live parameter \"" << optarg << "\"\n";
+				exit(EX_USAGE);
 			}
 			break;
 
@@ -138,70 +262,226 @@ int main(int argc, char *argv[]) {
 			key_filenames.init(optarg, '?');
 			break;
 		case 'K': /* key-prefix */
-			index->setKeyPrefix(optarg);
+			key_prefix = optarg;
 			break;
 		case 'S': /* key-suffix */
-			index->setKeySuffix(optarg);
+			key_suffix = optarg;
+			break;
+		case 'E': /* crypto-engine */
+			crypto_engine = optarg;
+			if( ! validCryptoEngine(crypto_engine) ) {
+				std::cerr << "Unknown or unsupported crypto engine \"" << optarg << "\"\n";
+				exit(EX_USAGE);
+			}
 			break;
 
 		case 't': /* timestamp */
-			out_filenames.reset( new FileArray::Timestamp(out_file_pattern ,'?') );
+			out_timestamp = true;
 			break;
-	}}
 
+		case 'b': /* byterange */
+			byterange_filename = optarg;
+			break;
+		case 'B': /* byterange-input */
+			byterange_input = true;
+			break;
 
-	in->exceptions( std::ifstream::eofbit | std::ifstream::failbit | std::ifstream::badbit );
-	Segmenter::SEGMENTER seg(duration, extra_options);
-	index->Begin();
-	char key[16];
-	std::string key_filename;
-	Random::RandomC rnd; // TODO: better random generator
-	float duration_acc_error = 0;
-	do {
-		std::ofstream out_file;
-		out_file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
-		std::string out_filename = out_filenames->Filename( index->Sequence() );
-		out_file.open(out_filename.c_str());
-		std::cerr << "Switching to file \"" << out_filename << "\"  ";
-
-		if( crypto && index->Sequence() % crypto == 1 ) {
-			// Switch Crypto key
-			rnd.Bytes(key, 16);
-			key_filename = key_filenames.Filename( index->Sequence() );
-			std::cerr << "New crypto file \"" << key_filename << "\"\n";
-			std::ofstream key_file;
-			key_file.exceptions( std::ofstream::failbit | std::ofstream::badbit );
-			key_file.open( key_filename.c_str() );
-			key_file.write(key, 16);
-			key_file.close();
+		case 'M': /* master */
+			master_filename = optarg;
+			break;
+		case 'j': /* threads */
+			threads = strtol(optarg, &tmp, 10);
+			if( tmp == optarg || threads < 1 ) {
+				std::cerr << "Invalid number of threads \"" << optarg << "\"\n";
+				exit(EX_USAGE);
+			}
+			break;
+		case 'p': /* parallel */
+			parallel = true;
+			break;
+		case 'P': /* pipeline */
+			pipeline = strtol(optarg, &tmp, 10);
+			if( tmp == optarg || pipeline < 1 ) {
+				std::cerr << "Invalid queue depth \"" << optarg << "\"\n";
+				exit(EX_USAGE);
+			}
+			break;
+		case 'U': /* uring */
+			uring = true;
+			break;
+		case 'J': /* stats */
+			stats_filename = optarg;
+			break;
+		case 'R': /* prometheus */
+			prometheus_filename = optarg;
+			break;
+		case 'm': /* monitor */
+			monitor_channel = optarg;
+			break;
+		case 'n': /* programs */
+			for( char *p = optarg; ; p = tmp + 1 ) {
+				unsigned long number = strtoul(p, &tmp, 10);
+				if( tmp == p || number == 0 || number > 0xffff || ( *tmp != ',' && *tmp != '\0' ) ) {
+					std::cerr << "Invalid list of programs \"" << optarg << "\"\n";
+					exit(EX_USAGE);
+				}
+				selected_programs.push_back(number);
+				if( *tmp == '\0' ) break;
+			}
+			break;
+	}}
+
+	if( in_filenames.empty() ) in_filenames.push_back(""); // stdin
+	bool multiple = in_filenames.size() > 1;
+	if( multiple || ! master_filename.empty() ) {
+		if( master_filename.empty() ) master_filename = "master.m3u8";
+		for( size_t i = 0; i < in_filenames.size(); i++ ) {
+			if( in_filenames[i].empty() || in_filenames[i] == "-" ) {
+				std::cerr << "Multiple renditions need named inputs, not stdin\n";
+				exit(EX_USAGE);
+			}
 		}
+	}
 
-		std::ostream *out = &out_file;
-		Crypto::Crypto *crypto_module = NULL;
+	if( byterange_input ) {
+		for( size_t i = 0; i < in_filenames.size(); i++ ) {
+			struct stat st;
+			if( in_filenames[i].empty() || stat(in_filenames[i].c_str(), &st) != 0 || ! S_ISREG(st.st_mode) ) {
+				std::cerr << "--byterange-input needs a regular file as input\n";
+				exit(EX_USAGE);
+			}
+		}
 		if( crypto ) {
-			char iv[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-			for(unsigned char i=0; i < 4; i++ ) iv[15-i] = index->Sequence() >> (8*i);
-			crypto_module = new CryptoAes128cbc(key, iv);
-			out = new CryptoProxy(out_file, crypto_module);
+			std::cerr << "--byterange-input can't encrypt, the input is not modified\n";
+			exit(EX_USAGE);
 		}
+	}
 
-		duration = seg.copy_segment(in, out);
-		int rounded_duration = round(abs(duration) + duration_acc_error);
-		duration_acc_error += duration - rounded_duration;
-		if( duration <= 0 ) rounded_duration += 1; // Workaround bug in Safari plugin
-		
-		*out << std::flush;
-		out_file.close();
-		std::cerr << duration << "secs\n";
+	if( uring ) {
+		if( ! Uring::supported() ) {
+			std::cerr << "io_uring is not available, writing with plain system calls\n";
+			uring = false;
+		} else if( pipeline == 0 ) {
+			pipeline = 16;
+		}
+	}
 
-		if( crypto ) {
-			index->AddSegment(rounded_duration, out_filename, crypto_module->method(), key_filename);
-			delete out;
+	Random::RandomC rnd; // TODO: better random generator
+	KeyStore *keys = NULL;
+	if( crypto ) keys = new KeyStore(key_filenames, crypto, rnd);
+
+	StatsLog *stats = NULL;
+	if( ! stats_filename.empty() || ! prometheus_filename.empty() ) {
+		stats = new StatsLog(stats_filename, prometheus_filename);
+	}
+
+	Monitor::Monitor *monitor = NULL;
+	if( ! monitor_channel.empty() ) monitor = new Monitor::Monitor(monitor_channel);
+
+	IndexFileMaster *master = NULL;
+	if( ! master_filename.empty() ) master = new IndexFileMaster(master_filename);
+
+	Pool pool(threads);
+	std::vector<Rendition*> renditions;
+	Segmenter::Mpts *mpts = NULL; // At most one input can be an MPTS
+	for( size_t i = 0; i < in_filenames.size(); i++ ) {
+		Input::Input *in = open_input(in_filenames[i]);
+		std::string label = in_filenames[i].empty() ? "stdin" : "\"" + in_filenames[i] + "\"";
+		std::string in_format = format;
+		if( in_format == "auto" ) {
+			in->fill(PROBE_SIZE); // Whatever there is, if the stream is shorter
+			in_format = Segmenter::detect(in->data(), in->available());
+			if( in_format.empty() ) {
+				std::cerr << "Can't tell the format of " << label << ", use --format\n";
+				exit(EX_DATAERR);
+			}
+			std::cerr << "Input " << label << " looks like " << in_format << "\n";
+		}
+
+		// An MPTS becomes a rendition per program, "p<number>-"
+		std::vector<std::string> names;
+		std::vector<Input::Input*> inputs;
+		std::vector<unsigned> programs;
+		if( in_format == "mpegts" ) programs = probe_programs(in);
+		if( programs.size() > 1 || ! selected_programs.empty() ) {
+			if( multiple || byterange_input ) {
+				std::cerr << label << " carries several programs; it can only be segmented on its own, into files\n";
+				exit(EX_USAGE);
+			}
+			if( ! selected_programs.empty() ) {
+				for( size_t j = 0; j < selected_programs.size(); j++ ) {
+					if( std::find(programs.begin(), programs.end(), selected_programs[j]) == programs.end() ) {
+						std::cerr << "Program " << selected_programs[j] << " is not in the PAT of " << label << "\n";
+						exit(EX_DATAERR);
+					}
+				}
+				programs = selected_programs;
+			}
+			mpts = new Segmenter::Mpts(in);
+			for( size_t j = 0; j < programs.size(); j++ ) {
+				std::ostringstream n;
+				n << "p" << programs[j];
+				names.push_back(n.str());
+				inputs.push_back(mpts->program(programs[j]));
+			}
 		} else {
-			index->AddSegment(rounded_duration, out_filename);
+			std::ostringstream n;
+			if( multiple ) n << "r" << i;
+			names.push_back(n.str());
+			inputs.push_back(in);
+		}
+
+		for( size_t j = 0; j < inputs.size(); j++ ) {
+			const std::string &name = names[j];
+			std::string out_pattern = out_file_pattern, idx_filename = index_filename, br_filename = byterange_filename;
+			if( ! name.empty() ) {
+				out_pattern = prefixed_name(out_pattern, name);
+				idx_filename = prefixed_name(idx_filename, name);
+				if( ! br_filename.empty() ) br_filename = prefixed_name(br_filename, name);
+			}
+
+			IndexFile *index;
+			if( live ) index = new IndexFileLive(idx_filename, duration, live, true);
+			else index = new IndexFile(idx_filename, duration);
+			index->setUriPrefix(uri_prefix);
+			index->setUriSuffix(uri_suffix);
+			index->setKeyPrefix(key_prefix);
+			index->setKeySuffix(key_suffix);
+			index->setByteRange(byterange_input || ! br_filename.empty());
+
+			FileArray::FileArray *out_filenames;
+			if( out_timestamp ) out_filenames = new FileArray::Timestamp(out_pattern, '?');
+			else out_filenames = new FileArray::Sequence(out_pattern, '?');
+
+			Rendition *r = new Rendition(name, inputs[j], Segmenter::create(in_format, duration, extra_options), index, out_filenames);
+			if( byterange_input ) r->setByteRangeInput(in_filenames[i]);
+			else if( ! br_filename.empty() ) r->setByteRangeFile(br_filename);
+			if( crypto ) r->setCrypto(keys, crypto_engine);
+			if( master ) r->setMaster(master, master->AddVariant(idx_filename));
+			if( stats ) r->setStatsLog(stats);
+			if( monitor ) r->setMonitor(monitor->Add(name));
+			r->setPipeline(pipeline);
+			r->setUring(uring);
+
+			r->Begin();
+			renditions.push_back(r);
+			if( parallel ) {
+				if( r->Parallel(threads) ) continue;
+				std::cerr << "Can't segment " << label << " in parallel, doing it sequentially\n";
+			}
+			pool.Add(r);
 		}
-	} while( duration > 0 );
-	index->End();
+	}
+
+	pool.Run();
+
+	if( master ) master->End();
+	for( size_t i = 0; i < renditions.size(); i++ ) delete renditions[i];
+	delete mpts; // After the program inputs, in the renditions
+	delete master;
+	delete monitor;
+	delete stats;
+	delete keys;
 
 	return EX_OK;
 }
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <sysexits.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "Monitor.hpp"
+#include "Clock.hpp"
+
+/* Shows the live counters of all running segmenters, like top(1)
+ *
+ * Rates are over the last interval, so the first screen comes after one.
+ */
+
+static const char SHM_DIR[] = "/dev/shm/";
+
+struct Sample {
+	unsigned long long at_ns;
+	unsigned long long bytes_in, bytes_out, encrypt_bytes, encrypt_ns;
+};
+
+static std::vector<std::string> channels() {
+	/* Paths of the regions of running segmenters */
+	std::vector<std::string> ret;
+	DIR *dir = opendir(SHM_DIR);
+	if( dir == NULL ) return ret;
+	struct dirent *e;
+	while( (e = readdir(dir)) != NULL ) {
+		if( strncmp(e->d_name, Monitor::SHM_PREFIX, strlen(Monitor::SHM_PREFIX)) != 0 ) continue;
+		ret.push_back(std::string(SHM_DIR) + e->d_name);
+	}
+	closedir(dir);
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+static std::string rate(double bytes, double seconds) {
+	/* In Mbit/s */
+	std::ostringstream s;
+	s << std::fixed << std::setprecision(2) << bytes * 8 / seconds / 1e6;
+	return s.str();
+}
+
+static void show(std::map<std::string, Sample> &last, bool first) {
+	std::ostringstream out;
+	out << std::left << std::setw(16) << "CHANNEL" << std::setw(10) << "RENDITION" << std::right
+	    << std::setw(8) << "PID" << std::setw(8) << "SEQ" << std::setw(7) << "AGE"
+	    << std::setw(10) << "IN Mb/s" << std::setw(10) << "OUT Mb/s" << std::setw(10) << "AES MB/s"
+	    << std::setw(5) << "QC" << std::setw(5) << "QW" << std::setw(8) << "RESYNC" << "\n";
+
+	std::map<std::string, Sample> now;
+	std::vector<std::string> paths = channels();
+	for( size_t i = 0; i < paths.size(); i++ ) {
+		const Monitor::Region *region = Monitor::Monitor::Attach(paths[i]);
+		if( region == NULL ) continue;
+		if( kill(region->pid, 0) != 0 && errno == ESRCH ) { // Left behind by a crash
+			Monitor::Monitor::Detach(region);
+			continue;
+		}
+
+		unsigned renditions = __atomic_load_n(&region->renditions, __ATOMIC_ACQUIRE);
+		if( renditions > Monitor::MAX_RENDITIONS ) renditions = Monitor::MAX_RENDITIONS;
+		for( unsigned n = 0; n < renditions; n++ ) {
+			const Monitor::Counters *c = &region->rendition[n];
+			Sample s;
+			s.at_ns = monotonic_ns();
+			s.bytes_in = Monitor::peek(&c->bytes_in);
+			s.bytes_out = Monitor::peek(&c->bytes_out);
+			s.encrypt_bytes = Monitor::peek(&c->encrypt_bytes);
+			s.encrypt_ns = Monitor::peek(&c->encrypt_ns);
+			std::ostringstream key;
+			key << paths[i] << "/" << n;
+			now[key.str()] = s;
+
+			std::map<std::string, Sample>::const_iterator prev = last.find(key.str());
+			if( first || prev == last.end() ) continue;
+			const Sample &p = prev->second;
+			double seconds = (s.at_ns - p.at_ns) / 1e9;
+			unsigned long long start = Monitor::peek(&c->segment_start_ns);
+
+			out << std::left << std::setw(16) << region->channel
+			    << std::setw(10) << (c->name[0] ? c->name : "-") << std::right
+			    << std::setw(8) << region->pid
+			    << std::setw(8) << Monitor::peek(&c->sequence)
+			    << std::setw(7) << std::fixed << std::setprecision(1) << (start ? (s.at_ns - start) / 1e9 : 0.0)
+			    << std::setw(10) << rate(s.bytes_in - p.bytes_in, seconds)
+			    << std::setw(10) << rate(s.bytes_out - p.bytes_out, seconds);
+			if( s.encrypt_ns > p.encrypt_ns ) { // How fast the cipher runs, not how much there was to do
+				out << std::setw(10) << std::setprecision(0) << (s.encrypt_bytes - p.encrypt_bytes) * 1e3 / (s.encrypt_ns - p.encrypt_ns);
+			} else {
+				out << std::setw(10) << "-";
+			}
+			out << std::setw(5) << Monitor::peek(&c->crypto_queue)
+			    << std::setw(5) << Monitor::peek(&c->write_queue)
+			    << std::setw(8) << Monitor::peek(&c->resyncs) << "\n";
+		}
+		Monitor::Monitor::Detach(region);
+	}
+	last = now;
+	if( first ) return;
+
+	if( isatty(STDOUT_FILENO) ) std::cout << "\033[H\033[2J"; // Clear the screen
+	std::cout << out.str() << std::flush;
+}
+
+int main(int argc, char *argv[]) {
+	double delay = 1;
+	long iterations = 0; // Forever
+
+	static const struct option long_opts[] = {
+		/* name, arg, flag, val */
+		{"help",        no_argument,            NULL, '?'},
+		{"delay",       required_argument,      NULL, 'd'},
+		{"iterations",  required_argument,      NULL, 'n'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int option;
+	char *tmp;
+	while( -1 != (option = getopt_long(argc, argv, "?d:n:", long_opts, NULL)) ) { switch(option) {
+		case '?': /* help */
+			std::cerr << "Usage: " << argv[0] << " [options]\n"
+			          << "\n"
+			          << "Shows the counters of all segmenters running with --monitor\n"
+			          << "\n"
+			          << "Options are:\n"
+			          << "  -d --delay f       Seconds between screens, default 1\n"
+			          << "  -n --iterations i  Stop after i screens, default never\n"
+			          << "\n"
+			          << "Columns: input and output bitrate, AES throughput while encrypting,\n"
+			          << "messages waiting for the crypto (QC) and write (QW) stages, and the\n"
+			          << "age of the segment being made\n";
+			exit(EX_USAGE);
+			break; // will never be reached
+
+		case 'd': /* delay */
+			delay = strtod(optarg, &tmp);
+			if( tmp == optarg || delay <= 0 ) {
+				std::cerr << "Invalid delay \"" << optarg << "\"\n";
+				exit(EX_USAGE);
+			}
+			break;
+		case 'n': /* iterations */
+			iterations = strtol(optarg, &tmp, 10);
+			if( tmp == optarg || iterations < 1 ) {
+				std::cerr << "Invalid number of iterations \"" << optarg << "\"\n";
+				exit(EX_USAGE);
+			}
+			break;
+	}}
+
+	std::map<std::string, Sample> last;
+	show(last, true);
+	for( long i = 0; iterations == 0 || i < iterations; i++ ) {
+		usleep(delay * 1000000);
+		show(last, false);
+	}
+
+	return EX_OK;
+}
+
+/* vim: set ts=4 sw=4: */
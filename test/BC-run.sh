@@ -2,7 +2,7 @@
 
 set -e # exit immediately
 
-dd if=/dev/zero bs=100 count=10 | ../src/ByteCount -e 100 -l 2
+dd if=/dev/zero bs=100 count=10 | ../src/segmenter -f bytecount -e 100 -l 2
 
 if [ ! -e "out-00001.ts" ] ||
 	[ ! -e "out-00002.ts" ] ||
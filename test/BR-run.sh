@@ -0,0 +1,23 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+dd if=/dev/zero bs=100 count=10 of=br.in
+
+../src/segmenter -f bytecount -e 100 -l 2 -i br.in -I br.m3u8 -o "br-?????.ts" -B
+
+if [ -e "br-00001.ts" ]; then
+	echo "Found output files in byterange-input mode"
+	exit 1
+fi
+
+grep -q "^#EXT-X-VERSION:4$" br.m3u8
+grep -q "^#EXT-X-BYTERANGE:200@0$" br.m3u8
+grep -q "^#EXT-X-BYTERANGE:200@800$" br.m3u8
+
+../src/segmenter -f bytecount -e 100 -l 2 -i br.in -I br.m3u8 -b br.ts
+
+diff br.in br.ts
+grep -q "^#EXT-X-BYTERANGE:200@400$" br.m3u8
+
+rm br.in br.ts br.m3u8
@@ -0,0 +1,188 @@
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "../src/Crypto/CryptoAes128cbc.hpp"
+#include "../src/Crypto/CryptoAes128cbcNi.hpp"
+#include "../src/Crypto/CryptoMultiBuffer.hpp"
+#include "../src/Crypto/aes.h"
+
+/* Known-answer tests for the AES-128-CBC modules (NIST SP 800-38A F.2.1),
+ * plus a cross-check of every module against the PolarSSL implementation,
+ * and more threads than lanes sharing one multi-buffer engine
+ */
+
+static const unsigned char kat_key[16] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const unsigned char kat_iv[16] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+static const unsigned char kat_plain[64] = {
+	0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+	0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+	0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+	0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+static const unsigned char kat_cipher[64] = {
+	0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+	0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+	0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+	0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7 };
+
+static int failures = 0;
+
+static void check(const char *what, const char *name, const void *got, const void *expected, size_t len) {
+	if( memcmp(got, expected, len) != 0 ) {
+		std::cerr << "FAIL: " << name << ": " << what << "\n";
+		failures++;
+	}
+}
+
+template<class Module>
+static void test(const char *name) {
+	char key[16], iv[16], out[64];
+	memcpy(key, kat_key, 16);
+	memcpy(iv, kat_iv, 16);
+
+	{ // Block by block
+		Module m(key, iv);
+		for( int i = 0; i < 64; i += 16 ) m.encrypt(reinterpret_cast<const char*>(kat_plain) + i, out + i);
+		check("encrypt()", name, out, kat_cipher, 64);
+	}
+	{ // In one go
+		Module m(key, iv);
+		m.encryptBlocks(reinterpret_cast<const char*>(kat_plain), out, 64);
+		check("encryptBlocks()", name, out, kat_cipher, 64);
+	}
+	{
+		Module m(key, iv);
+		for( int i = 0; i < 64; i += 16 ) m.decrypt(reinterpret_cast<const char*>(kat_cipher) + i, out + i);
+		check("decrypt()", name, out, kat_plain, 64);
+	}
+
+	// Random keys and data against PolarSSL
+	srand(1);
+	for( int round = 0; round < 100; round++ ) {
+		unsigned char plain[4096], expected[4096], ref_iv[16];
+		char got[4096];
+		size_t len = 16 * (1 + rand() % 256);
+		for( int i = 0; i < 16; i++ ) { key[i] = rand(); iv[i] = rand(); }
+		for( size_t i = 0; i < len; i++ ) plain[i] = rand();
+
+		aes_context ctx;
+		aes_setkey_enc(&ctx, reinterpret_cast<unsigned char*>(key), 128);
+		memcpy(ref_iv, iv, 16);
+		aes_crypt_cbc(&ctx, AES_ENCRYPT, len, ref_iv, plain, expected);
+
+		Module m(key, iv);
+		m.encryptBlocks(reinterpret_cast<const char*>(plain), got, len);
+		check("random data vs PolarSSL", name, got, expected, len);
+	}
+}
+
+class KeySchedule : public CryptoAes128cbcNi {
+public:
+	KeySchedule(char key[16], char iv[16]) : CryptoAes128cbcNi(key, iv) {}
+	void dump(unsigned char out[11][16]) { memcpy(out, m_enc_key, sizeof(m_enc_key)); }
+};
+/* Borrows the key schedule of a regular AES-NI module
+ */
+
+static void test_lanes() {
+	// Independent streams of different lengths, encrypted interleaved
+	srand(2);
+	char key[CRYPTO_MB_MAX_LANES][16], iv[CRYPTO_MB_MAX_LANES][16];
+	unsigned char plain[CRYPTO_MB_MAX_LANES][4096], expected[CRYPTO_MB_MAX_LANES][4096];
+	char got[CRYPTO_MB_MAX_LANES][4096];
+	CryptoMultiBuffer::Job job[CRYPTO_MB_MAX_LANES], *jobs[CRYPTO_MB_MAX_LANES];
+	unsigned char round_keys[CRYPTO_MB_MAX_LANES][11][16];
+
+	for( int l = 0; l < CRYPTO_MB_MAX_LANES; l++ ) {
+		size_t len = 16 * (1 + rand() % 256);
+		for( int i = 0; i < 16; i++ ) { key[l][i] = rand(); iv[l][i] = rand(); }
+		for( size_t i = 0; i < len; i++ ) plain[l][i] = rand();
+
+		aes_context ctx;
+		unsigned char ref_iv[16];
+		aes_setkey_enc(&ctx, reinterpret_cast<unsigned char*>(key[l]), 128);
+		memcpy(ref_iv, iv[l], 16);
+		aes_crypt_cbc(&ctx, AES_ENCRYPT, len, ref_iv, plain[l], expected[l]);
+
+		KeySchedule(key[l], iv[l]).dump(round_keys[l]);
+
+		job[l].key = round_keys[l];
+		job[l].iv = reinterpret_cast<unsigned char*>(iv[l]);
+		job[l].in = reinterpret_cast<const char*>(plain[l]);
+		job[l].out = got[l];
+		job[l].length = len;
+		jobs[l] = &job[l];
+	}
+
+	CryptoMultiBuffer::encryptLanes(jobs, CRYPTO_MB_MAX_LANES);
+	for( int l = 0; l < CRYPTO_MB_MAX_LANES; l++ ) {
+		check("interleaved lanes vs PolarSSL", "aesni-mb", got[l], expected[l], job[l].length);
+	}
+}
+
+#define SHARED_THREADS 12
+#define SHARED_JOBS 200
+
+struct SharedWorker {
+	CryptoMultiBuffer *engine;
+	unsigned seed;
+	unsigned finished; // Jobs that came back right
+};
+
+static void *shared_worker(void *arg) {
+	SharedWorker *w = static_cast<SharedWorker*>(arg);
+	char key[16], iv[16];
+	unsigned char ref_iv[16], plain[1024], expected[1024];
+	char got[1024];
+	for( int i = 0; i < 16; i++ ) { key[i] = rand_r(&w->seed); iv[i] = rand_r(&w->seed); }
+	aes_context ctx;
+	aes_setkey_enc(&ctx, reinterpret_cast<unsigned char*>(key), 128);
+	memcpy(ref_iv, iv, 16);
+	CryptoAes128cbcMb m(key, iv, *w->engine);
+	for( int j = 0; j < SHARED_JOBS; j++ ) {
+		size_t len = 16 * (1 + rand_r(&w->seed) % 64);
+		for( size_t i = 0; i < len; i++ ) plain[i] = rand_r(&w->seed);
+		aes_crypt_cbc(&ctx, AES_ENCRYPT, len, ref_iv, plain, expected);
+		m.encryptBlocks(reinterpret_cast<const char*>(plain), got, len);
+		if( memcmp(got, expected, len) == 0 ) w->finished++;
+	}
+	return NULL;
+}
+
+static void test_shared() {
+	// Every job comes back, and right, however the threads get combined
+	CryptoMultiBuffer engine;
+	pthread_t thread[SHARED_THREADS];
+	SharedWorker worker[SHARED_THREADS];
+	for( int t = 0; t < SHARED_THREADS; t++ ) {
+		worker[t].engine = &engine;
+		worker[t].seed = t;
+		worker[t].finished = 0;
+		pthread_create(&thread[t], NULL, shared_worker, &worker[t]);
+	}
+	for( int t = 0; t < SHARED_THREADS; t++ ) {
+		pthread_join(thread[t], NULL);
+		if( worker[t].finished != SHARED_JOBS ) {
+			std::cerr << "FAIL: aesni-mb: thread " << t << " got " << worker[t].finished << " of " << SHARED_JOBS << " jobs right\n";
+			failures++;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	test<CryptoAes128cbc>("openssl");
+	if( CryptoAes128cbcNi::supported() ) {
+		test<CryptoAes128cbcNi>("aesni");
+		test<CryptoAes128cbcMb>("aesni-mb");
+		test_lanes();
+		test_shared();
+	} else {
+		std::cerr << "CPU lacks AES-NI, not testing it\n";
+	}
+	return failures ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4: */
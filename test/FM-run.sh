@@ -0,0 +1,29 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+# 430 frames of silent-ish AAC (16 bytes each, 1024 samples at 44.1kHz), about 10 seconds
+for i in $(seq 430); do printf '\xff\xf1\x50\x80\x02\x1f\xfc\0\0\0\0\0\0\0\0\0'; done > fm.aac
+
+../src/segmenter -l 2 -i fm.aac -o "fm-?????.aac" -I fm.m3u8 2> fm.log
+grep -q 'looks like adts' fm.log
+test $(grep -c '^fm-' fm.m3u8) -eq 5
+
+# The same with 2064 byte frames: the 13 bit frame length has bit 11 set
+rm fm-*
+for i in $(seq 430); do printf '\xff\xf1\x50\x81\x02\x1f\xfc'; head -c 2057 /dev/zero; done > fm.aac
+../src/segmenter -l 2 -i fm.aac -o "fm-?????.aac" -I fm.m3u8 2> fm.log
+grep -q 'looks like adts' fm.log
+test $(grep -c 'Lost sync' fm.log) -eq 0
+test $(grep -c '^fm-' fm.m3u8) -eq 5
+test $(cat fm-*.aac | wc -c) -eq $(( 430 * 2064 ))
+
+# Zeroes are nothing in particular
+dd if=/dev/zero bs=100 count=10 of=fm.in
+set +e
+../src/segmenter -l 2 -i fm.in -o "fm-?????.ts" -I fm.m3u8 2> fm.log
+test $? -eq 65 || exit 1 # EX_DATAERR
+set -e
+grep -q 'use --format' fm.log
+
+rm fm-* fm.aac fm.in fm.m3u8 fm.log
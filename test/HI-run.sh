@@ -0,0 +1,14 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+# Install into a scratch root, and compile every installed header on its own,
+# the way a program embedding the library would include it
+rm -rf hi-root
+MAKEFLAGS= make -s -C ../src install DESTDIR="$PWD/hi-root" > /dev/null
+dir=$(dirname $(find hi-root -name PushSegmenter.hpp))
+for h in $(cd "$dir" && find . -name '*.hpp' | sed 's,^\./,,'); do
+	echo "#include <$(basename "$dir")/$h>" | ${CXX:-c++} -fsyntax-only -I "$dir/.." -x c++ - || { echo "$h doesn't compile on its own"; exit 1; }
+done
+
+rm -rf hi-root
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+dd if=/dev/zero bs=100 count=10 of=ml.in0
+dd if=/dev/zero bs=100 count=6 of=ml.in1
+
+../src/segmenter -f bytecount -e 100 -l 2 -i ml.in0 -i ml.in1 -o "ml-?????.ts" -I ml.m3u8 -M ml-master.m3u8 -j 2
+
+for f in r0-ml-0000{1,2,3,4,5}.ts r1-ml-0000{1,2,3}.ts; do
+	if [ ! -e "$f" ]; then
+		echo "Did not find $f"
+		exit 1
+	fi
+done
+
+grep -q "^r0-ml.m3u8$" ml-master.m3u8
+grep -q "^r1-ml.m3u8$" ml-master.m3u8
+grep -q "^r0-ml-00005.ts$" r0-ml.m3u8
+grep -q "^r1-ml-00003.ts$" r1-ml.m3u8
+! grep -q "r0-" r1-ml.m3u8
+
+rm r0-ml* r1-ml* ml.in0 ml.in1 ml-master.m3u8
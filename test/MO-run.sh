@@ -0,0 +1,21 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+test -d /dev/shm || exit 77 # skip
+
+CHANNEL="mo-test-$$"
+dd if=/dev/zero bs=100 count=10 of=mo.in
+
+# Keep the input open for a while, so there's something to look at
+( cat mo.in; sleep 2 ) | ../src/segmenter -f bytecount -e 100 -l 2 -o "mo-?????.ts" -I mo.m3u8 -m "$CHANNEL" &
+SEGMENTER=$!
+
+sleep 0.5
+../src/segtop -d 0.5 -n 1 > mo.out
+grep -q "^$CHANNEL  *- *$SEGMENTER  *[0-9]" mo.out
+
+wait $SEGMENTER
+test ! -e "/dev/shm/segmenter.$CHANNEL" # Removed on exit
+
+rm mo-* mo.in mo.m3u8 mo.out
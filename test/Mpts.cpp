@@ -0,0 +1,103 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdlib.h>
+
+#include "../src/Segmenter/Mpts.hpp"
+#include "../src/Segmenter/Formats.hpp"
+#include "../src/Input/Memory.hpp"
+#include "../src/Pool.hpp"
+#include "../bench/Streams.hpp"
+
+/* Segments every program of a synthetic MPTS through Mpts, several at a
+ * time on a Pool, and checks that each comes out exactly like segmenting
+ * the stream of that program alone
+ */
+
+typedef std::vector<std::string> Segments;
+
+static int failures = 0;
+
+static void segment(Segmenter::Segmenter *seg, Input::Input *in, Segments &out) {
+	while( 1 ) {
+		std::ostringstream s;
+		float duration = seg->copy_segment(in, &s);
+		out.push_back(s.str());
+		if( duration <= 0 ) break;
+	}
+}
+
+class ProgramTask : public Pool::Task {
+public:
+	Segmenter::Segmenter *seg;
+	Input::Input *in;
+	Segments segments;
+
+	virtual bool Step() {
+		std::ostringstream s;
+		float duration = seg->copy_segment(in, &s);
+		segments.push_back(s.str());
+		return duration > 0;
+	}
+};
+
+static void test(unsigned programs, const std::vector<unsigned> &selected, unsigned threads) {
+	unsigned long count;
+	std::string mpts = stream_mpts_h264(20, 25, programs, 1, count);
+
+	std::vector<ProgramTask> tasks(selected.size());
+	Segmenter::Mpts demux(new Input::Memory(mpts.data(), mpts.data() + mpts.size()));
+	Pool pool(threads);
+	for( size_t i = 0; i < selected.size(); i++ ) {
+		tasks[i].seg = Segmenter::create("mpegts", 2, "");
+		tasks[i].in = demux.program(selected[i]);
+		pool.Add(&tasks[i]);
+	}
+	pool.Run();
+
+	for( size_t i = 0; i < selected.size(); i++ ) {
+		std::string alone = stream_mpts_h264(20, 25, programs, 1, count, selected[i] - 1);
+		Segments expected;
+		Input::Memory in(alone.data(), alone.data() + alone.size());
+		Segmenter::Segmenter *seg = Segmenter::create("mpegts", 2, "");
+		segment(seg, &in, expected);
+		delete seg;
+
+		if( tasks[i].segments != expected ) {
+			std::cerr << "FAIL: program " << selected[i] << " of " << programs << " on " << threads << " threads: "
+			          << tasks[i].segments.size() << " segments, expected " << expected.size() << "\n";
+			failures++;
+		}
+		delete tasks[i].in;
+		delete tasks[i].seg;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<unsigned> selected;
+	selected.push_back(1);
+	test(1, selected, 1);
+
+	for( unsigned p = 2; p <= 4; p++ ) selected.push_back(p);
+	test(4, selected, 1);
+	test(4, selected, 4);
+	test(6, selected, 2);
+
+	selected.clear();
+	selected.push_back(5);
+	selected.push_back(2);
+	test(6, selected, 2);
+
+	unsigned long count;
+	std::string mpts = stream_mpts_h264(1, 25, 3, 1, count);
+	std::vector<unsigned> found = Segmenter::Mpts::programs(mpts.data(), mpts.size());
+	if( found.size() != 3 || found[0] != 1 || found[2] != 3 ) {
+		std::cerr << "FAIL: found " << found.size() << " programs in the PAT, expected 3\n";
+		failures++;
+	}
+
+	return failures ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4: */
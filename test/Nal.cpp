@@ -0,0 +1,215 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#include "../src/Segmenter/Nal.hpp"
+#include "../src/Segmenter/Psi.hpp"
+#include "../src/Segmenter/Formats.hpp"
+#include "../src/Input/Memory.hpp"
+
+/* Checks the start code scanners against each other, tells H.264 and HEVC
+ * access units apart fed in pieces of every size, and segments streams whose
+ * IDR frames come after SEI, with 3 byte start codes, in PES packets that
+ * start with most of a TS packet of adaptation field
+ */
+
+#define TS_PACKET_SIZE 188
+#define FPS 25
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what) {
+	if( ok ) return;
+	std::cerr << "FAIL: " << what << "\n";
+	failures++;
+}
+
+static std::string bytes(const char *s, size_t n) { return std::string(s, n); }
+
+static std::string slice(bool idr, bool hevc = false) {
+	std::string s = bytes("\x00\x00\x01", 3);
+	if( hevc ) s += idr ? bytes("\x26\x01", 2) : bytes("\x02\x01", 2); // IDR_W_RADL, TRAIL_R
+	else s += idr ? '\x65' : '\x41';
+	for( int i = 0; i < 400; i++ ) s += static_cast<char>(rand() % 255 + 1); // No start codes
+	return s;
+}
+
+static std::string sei(unsigned type, const std::string &payload, size_t size) {
+	// size is without the emulation prevention bytes in payload
+	std::string s = bytes("\x00\x00\x00\x01\x06", 5);
+	s += static_cast<char>(type);
+	s += static_cast<char>(size);
+	s += payload;
+	s += '\x80';
+	return s;
+}
+
+static const std::string aud = bytes("\x00\x00\x00\x01\x09\xf0", 6);
+static const std::string sps = bytes("\x00\x00\x01\x67\x42\x00\x1e\xab", 8);
+static const std::string pps = bytes("\x00\x00\x01\x68\xce\x38\x80", 7);
+
+static const std::string hevc_aud = bytes("\x00\x00\x00\x01\x46\x01\x50", 7);
+static const std::string hevc_vps = bytes("\x00\x00\x01\x40\x01\x0c\x01\xff\xff", 9);
+static const std::string hevc_sps = bytes("\x00\x00\x01\x42\x01\x01\x01\x60\x00", 9);
+static const std::string hevc_pps = bytes("\x00\x00\x01\x44\x01\xc1\x72\xb4", 8);
+static const std::string hevc_sei = bytes("\x00\x00\x01\x4e\x01\x05\x04\x00\x00\x03\x01\x00\x80", 13);
+
+static std::string hevc_slice(unsigned type) {
+	return bytes("\x00\x00\x01", 3) + static_cast<char>(type << 1) + '\x01' + slice(false).substr(4);
+}
+
+static Segmenter::AccessUnitScanner::Result classify(const std::string &au, size_t piece, Segmenter::AccessUnitScanner::Codec codec) {
+	Segmenter::AccessUnitScanner scanner(codec);
+	for( size_t off = 0; off < au.size(); off += piece ) {
+		size_t n = au.size() - off < piece ? au.size() - off : piece;
+		Segmenter::AccessUnitScanner::Result r = scanner.push(au.data() + off, n);
+		if( r != Segmenter::AccessUnitScanner::UNDECIDED ) return r;
+	}
+	return Segmenter::AccessUnitScanner::UNDECIDED;
+}
+
+static void check_au(const std::string &name, const std::string &au, Segmenter::AccessUnitScanner::Result expected,
+                     Segmenter::AccessUnitScanner::Codec codec = Segmenter::AccessUnitScanner::H264) {
+	for( size_t piece = 1; piece <= au.size(); piece++ ) {
+		if( classify(au, piece, codec) != expected ) {
+			check(false, name + " fed in pieces of " + std::string(1, '0' + piece % 10) + "...");
+			return;
+		}
+	}
+}
+
+static void packet(std::string &ts, unsigned pid, unsigned &cc, bool start, const std::string &payload, size_t adaptation = 0) {
+	// payload must fit after the adaptation field, which is stuffed to fill the packet otherwise
+	std::string pkt(4, '\0');
+	pkt[0] = 0x47;
+	pkt[1] = (start ? 0x40 : 0x00) | (pid >> 8);
+	pkt[2] = pid & 0xff;
+	size_t room = TS_PACKET_SIZE - 4;
+	if( adaptation == 0 && payload.size() < room ) adaptation = room - payload.size();
+	pkt[3] = (adaptation ? 0x30 : 0x10) | (cc++ & 0x0f);
+	if( adaptation ) {
+		pkt += static_cast<char>(adaptation - 1);
+		if( adaptation > 1 ) pkt += '\0'; // No flags
+		if( adaptation > 2 ) pkt += std::string(adaptation - 2, '\xff');
+	}
+	pkt += payload;
+	pkt.append(TS_PACKET_SIZE - pkt.size(), '\xff'); // Only for sections
+	ts += pkt;
+}
+
+static void section(std::string &ts, unsigned pid, unsigned &cc, const std::string &body) {
+	std::string s = body;
+	uint32_t crc = Segmenter::crc32_mpeg(reinterpret_cast<const unsigned char*>(s.data()), s.size());
+	for( int i = 3; i >= 0; i-- ) s += static_cast<char>(crc >> (8*i));
+	packet(ts, pid, cc, true, std::string(1, '\0') + s, 1);
+}
+
+static std::string pes_header(long long pts) {
+	std::string h = bytes("\x00\x00\x01\xe0\x00\x00\x80\x80\x05", 9);
+	h += static_cast<char>(0x21 | ((pts >> 29) & 0x0e));
+	h += static_cast<char>(pts >> 22);
+	h += static_cast<char>(((pts >> 14) & 0xfe) | 1);
+	h += static_cast<char>(pts >> 7);
+	h += static_cast<char>(((pts << 1) & 0xfe) | 1);
+	return h;
+}
+
+static std::string stream(unsigned seconds, bool hevc = false) {
+	std::string ts;
+	unsigned pat_cc = 0, pmt_cc = 0, video_cc = 0, audio_cc = 0;
+	for( unsigned f = 0; f < seconds * FPS; f++ ) {
+		long long pts = 10000 + f * (90000 / FPS);
+		if( f % FPS == 0 ) {
+			section(ts, 0x0000, pat_cc, bytes("\x00\xb0\x0d\x00\x01\xc1\x00\x00\x00\x01\xf0\x00", 12));
+			std::string pmt = bytes("\x02\xb0\x17\x00\x01\xc1\x00\x00\xe1\x00\xf0\x00"
+			                        "\x1b\xe1\x00\xf0\x00\x0f\xe1\x01\xf0\x00", 22);
+			if( hevc ) pmt[12] = 0x24;
+			section(ts, 0x1000, pmt_cc, pmt);
+		}
+		bool idr = f % FPS == 0;
+		std::string pes = pes_header(pts);
+		if( hevc ) {
+			pes += hevc_aud;
+			if( idr ) pes += hevc_vps + hevc_sps + hevc_pps + hevc_sei;
+		} else {
+			pes += aud;
+			if( idr ) pes += sps + pps + sei(5, std::string(100, '\x42'), 100) + sei(1, bytes("\x00\x00\x03\x01", 4), 3);
+		}
+		pes += slice(idr, hevc);
+
+		// The first packet has room for 8 bytes, less than the PES header
+		packet(ts, 0x100, video_cc, true, pes.substr(0, 8), TS_PACKET_SIZE - 4 - 8);
+		for( size_t off = 8; off < pes.size(); off += 184 ) {
+			packet(ts, 0x100, video_cc, false, pes.substr(off, 184));
+			if( off == 8 ) packet(ts, 0x101, audio_cc, true, pes_header(pts).replace(3, 1, "\xc0") + std::string(100, '\x11'));
+		}
+	}
+	return ts;
+}
+
+static void segment(const std::string &ts, const std::string &what) {
+	// Segments start at every IDR frame, once a second
+	Segmenter::Segmenter *seg = Segmenter::create("mpegts", 1, "");
+	Input::Memory in(ts.data(), ts.data() + ts.size());
+	std::vector<float> durations;
+	while( 1 ) {
+		durations.push_back(seg->copy_segment(&in, NULL));
+		if( durations.back() <= 0 ) break;
+	}
+	delete seg;
+	bool ok = durations.size() == 4 && durations.back() == -1.0f;
+	for( size_t i = 0; ok && i + 1 < durations.size(); i++ ) ok = durations[i] == 1.0f;
+	check(ok, "segmenting " + what + " in the second packet of their PES");
+
+	std::vector<Segmenter::Span> spans;
+	seg = Segmenter::create("mpegts", 1, "");
+	check(seg->split(ts.data(), ts.size(), 2, spans) && spans.size() == durations.size(), "split() finds the same " + what);
+	delete seg;
+}
+
+int main(int argc, char *argv[]) {
+	srand(1);
+	std::string buf;
+	for( int i = 0; i < 4096; i++ ) buf += static_cast<char>(rand() % 3); // Lots of zeros and ones
+	for( size_t from = 0; from < 64; from++ ) {
+		for( size_t len = 0; from + len <= buf.size(); len += 1 + len / 8 ) {
+			size_t s = Segmenter::start_code_scan_scalar(buf.data() + from, len);
+			if( Segmenter::start_code_scan_sse2(buf.data() + from, len) != s
+			 || Segmenter::start_code_scan_avx2(buf.data() + from, len) != s ) {
+				check(false, "start code scanners disagree");
+				from = 64;
+				break;
+			}
+		}
+	}
+	check(Segmenter::start_code_scan("\x00\x00\x00\x00\x01", 5) == 2, "start code after zeros");
+	check(Segmenter::start_code_scan("\x01\x00\x00", 3) == 1, "no start code");
+
+	typedef Segmenter::AccessUnitScanner S;
+	check_au("IDR", aud + sps + pps + slice(true), S::RANDOM_ACCESS);
+	check_au("non-IDR", aud + slice(false), S::OTHER);
+	check_au("IDR after SEI", aud + sei(5, std::string(200, '\x01'), 200) + slice(true), S::RANDOM_ACCESS);
+	check_au("SPS without IDR", aud + sps + pps + slice(false), S::OTHER);
+	check_au("recovery point", aud + sei(6, bytes("\x80\x00", 2), 2) + slice(false), S::RANDOM_ACCESS);
+	check_au("recovery point later", aud + sei(6, bytes("\x48\x00", 2), 2) + slice(false), S::OTHER);
+	check_au("recovery point after another SEI", aud + bytes("\x00\x00\x01\x06\x01\x03\x00\x00\x03\x00\x06\x01\x80\x80", 14) + slice(false), S::RANDOM_ACCESS);
+	check_au("no slice", aud + sps + pps, S::UNDECIDED);
+
+	std::string hevc_params = hevc_aud + hevc_vps + hevc_sps + hevc_pps;
+	check_au("HEVC IDR_W_RADL", hevc_params + hevc_slice(19), S::RANDOM_ACCESS, S::HEVC);
+	check_au("HEVC IDR_N_LP after SEI", hevc_params + hevc_sei + hevc_slice(20), S::RANDOM_ACCESS, S::HEVC);
+	check_au("HEVC CRA", hevc_params + hevc_slice(21), S::RANDOM_ACCESS, S::HEVC);
+	check_au("HEVC BLA_W_LP", hevc_aud + hevc_slice(16), S::RANDOM_ACCESS, S::HEVC);
+	check_au("HEVC TRAIL_R", hevc_aud + hevc_sei + hevc_slice(1), S::OTHER, S::HEVC);
+	check_au("HEVC RASL_N", hevc_aud + hevc_slice(8), S::OTHER, S::HEVC);
+	check_au("HEVC no slice", hevc_params, S::UNDECIDED, S::HEVC);
+	check_au("H.264 IDR read as HEVC", aud + slice(true), S::OTHER, S::HEVC);
+
+	segment(stream(4), "IDR frames");
+	segment(stream(4, true), "HEVC IDR frames");
+
+	return failures ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4: */
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+dd if=/dev/urandom bs=100 count=10 of=pl.in
+
+../src/segmenter -f bytecount -e 100 -l 2 -i pl.in -o "pl-?????.ts" -I pl.m3u8 -P 2
+
+cat pl-0000{1,2,3,4,5}.ts | diff - pl.in
+grep -q "^pl-00005.ts$" pl.m3u8
+
+# Encrypted, through the crypto stage
+../src/segmenter -f bytecount -e 100 -l 2 -i pl.in -o "pl-?????.ts" -I pl.m3u8 -k "pl-????.key" -c 2 -P 2
+
+for i in 1 2 3 4 5; do
+	key=pl-000$(( (i-1)/2*2+1 )).key
+	openssl aes-128-cbc -d -K $(od -An -tx1 $key | tr -d ' \n') -iv 0000000000000000000000000000000$i -in pl-0000$i.ts
+done | diff - pl.in
+
+# Same, written through io_uring where there is one
+../src/segmenter -f bytecount -e 100 -l 2 -i pl.in -o "pl-?????.ts" -I pl.m3u8 -k "pl-????.key" -c 2 -P 2 -U
+
+for i in 1 2 3 4 5; do
+	key=pl-000$(( (i-1)/2*2+1 )).key
+	openssl aes-128-cbc -d -K $(od -An -tx1 $key | tr -d ' \n') -iv 0000000000000000000000000000000$i -in pl-0000$i.ts
+done | diff - pl.in
+
+rm pl-* pl.in pl.m3u8
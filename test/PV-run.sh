@@ -0,0 +1,36 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+# Segments in parallel (-p) and sequentially, in directories of their own,
+# and checks that both come up with the same playlist and the same bytes
+compare() {
+	rm -rf pv-seq pv-par
+	mkdir pv-seq pv-par
+	( cd pv-seq && ../../src/segmenter -l 2 -i ../pv.ts -o "pv-?????.ts" -I pv.m3u8 2> pv.log )
+	( cd pv-par && ../../src/segmenter -l 2 -i ../pv.ts -o "pv-?????.ts" -I pv.m3u8 -p -j 4 2> pv.log )
+	if grep -q "sequentially" pv-par/pv.log; then exit 1; fi
+	diff <(grep -v '^#EXT-X-PROGRAM-DATE' pv-seq/pv.m3u8) <(grep -v '^#EXT-X-PROGRAM-DATE' pv-par/pv.m3u8)
+	test $(ls pv-seq/pv-*.ts | wc -l) -eq $(ls pv-par/pv-*.ts | wc -l)
+	for f in pv-seq/pv-*.ts; do cmp "$f" pv-par/$(basename "$f"); done
+}
+
+# 60 seconds with an IDR frame every 37 pictures, so cuts don't fall on whole seconds
+./Generate ts 60 37 > pv.ts
+compare
+test $(grep -c '^pv-' pv-seq/pv.m3u8) -gt 20
+
+# Junk in the middle of packets, some of it looking like sync bytes
+size=$(stat -c %s pv.ts)
+{
+	head -c $(( size / 3 + 50 )) pv.ts
+	yes 'G junk' | head -c 777
+	tail -c +$(( size / 3 + 51 )) pv.ts | head -c $(( size / 3 ))
+	head -c 1000 /dev/zero
+	tail -c +$(( 2 * size / 3 + 51 )) pv.ts
+} > pv-bad.ts
+mv pv-bad.ts pv.ts
+compare
+grep -q 'Lost TS-sync' pv-seq/pv.log
+
+rm -rf pv-seq pv-par pv.ts
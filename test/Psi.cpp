@@ -0,0 +1,148 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/Segmenter/Psi.hpp"
+
+/* Checks the CRC against known values, and puts sections back together
+ * from packets cut up in all the ways the standard allows
+ */
+
+#define TS_PACKET_SIZE 188
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	if( ok ) return;
+	std::cerr << "FAIL: " << what << "\n";
+	failures++;
+}
+
+static std::string section(unsigned char table_id, unsigned extension, unsigned version, size_t body) {
+	/* A long-form section with `body` bytes of payload and a valid CRC */
+	std::string s;
+	s += static_cast<char>(table_id);
+	s += static_cast<char>(0xb0 | ((5 + body + 4) >> 8));
+	s += static_cast<char>((5 + body + 4) & 0xff);
+	s += static_cast<char>(extension >> 8);
+	s += static_cast<char>(extension);
+	s += static_cast<char>(0xc1 | version << 1);
+	s += std::string("\x00\x00", 2);
+	for( size_t i = 0; i < body; i++ ) s += static_cast<char>(rand());
+	uint32_t crc = Segmenter::crc32_mpeg(reinterpret_cast<const unsigned char*>(s.data()), s.size());
+	for( int i = 3; i >= 0; i-- ) s += static_cast<char>(crc >> (8*i));
+	return s;
+}
+
+static std::vector<std::string> packetize(const std::string &payload, const std::vector<size_t> &starts, unsigned cc = 0) {
+	/* Cuts a run of sections into packets; starts are the offsets where
+	 * sections begin. The rest of the last packet is stuffing
+	 */
+	std::vector<std::string> ret;
+	size_t done = 0;
+	while( done < payload.size() ) {
+		std::string pkt("\x47\x00\x00", 3);
+		pkt += static_cast<char>(0x10 | (cc++ & 0x0f));
+		size_t next = payload.size();
+		for( size_t i = 0; i < starts.size(); i++ ) {
+			if( starts[i] >= done && starts[i] < done + 184 ) { next = starts[i]; break; }
+		}
+		if( next == done + 183 ) { // No room for it after a pointer field; shift it to the next packet
+			pkt[3] |= 0x20;
+			pkt += '\0'; // Empty adaptation field
+		} else if( next != payload.size() ) {
+			pkt[1] = 0x40;
+			pkt += static_cast<char>(next - done); // pointer field
+		}
+		size_t n = TS_PACKET_SIZE - pkt.size();
+		pkt += payload.substr(done, n);
+		done += n;
+		pkt.append(TS_PACKET_SIZE - pkt.size(), static_cast<char>(0xff));
+		ret.push_back(pkt);
+	}
+	return ret;
+}
+
+static std::vector<std::string> assemble(const std::vector<std::string> &packets) {
+	Segmenter::SectionAssembler a;
+	std::vector<std::string> ret;
+	for( size_t i = 0; i < packets.size(); i++ ) {
+		const std::vector<Segmenter::SectionAssembler::Section> &s = a.push(packets[i].data());
+		for( size_t j = 0; j < s.size(); j++ ) ret.push_back(s[j].data);
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	const unsigned char check_string[] = "123456789";
+	check(Segmenter::crc32_mpeg(check_string, 9) == 0x0376e6e7, "CRC of \"123456789\"");
+	srand(1);
+	for( size_t length = 0; length < 300; length++ ) {
+		std::vector<unsigned char> data(length);
+		for( size_t i = 0; i < length; i++ ) data[i] = rand();
+		const unsigned char *p = length ? &data[0] : check_string;
+		if( Segmenter::crc32_mpeg(p, length) != Segmenter::crc32_mpeg_bitwise(p, length) ) {
+			check(false, "slice-by-8 CRC differs from the bitwise one");
+			break;
+		}
+	}
+
+	// One section per packet
+	std::string pat = section(0x00, 1, 3, 4);
+	std::vector<size_t> starts(1, 0);
+	std::vector<std::string> got = assemble(packetize(pat, starts));
+	check(got.size() == 1 && got[0] == pat, "single-packet section");
+
+	// A PMT over three packets
+	std::string pmt = section(0x02, 1, 0, 450);
+	got = assemble(packetize(pmt, starts));
+	check(got.size() == 1 && got[0] == pmt, "section over three packets");
+
+	// Sections back to back, starting anywhere in the packets
+	std::string run;
+	std::vector<std::string> expected;
+	starts.clear();
+	for( int i = 0; i < 20; i++ ) {
+		expected.push_back(section(0x02, i, i % 32, rand() % 250));
+		starts.push_back(run.size());
+		run += expected.back();
+	}
+	std::vector<std::string> packets = packetize(run, starts);
+	got = assemble(packets);
+	check(got == expected, "sections back to back");
+
+	// A packet sent twice counts once
+	std::vector<std::string> twice = packets;
+	twice.insert(twice.begin() + 3, twice[3]);
+	check(assemble(twice) == expected, "duplicate packet");
+
+	// A lost packet loses the sections in it, not the ones after
+	std::vector<std::string> lost = packets;
+	lost.erase(lost.begin() + 3);
+	got = assemble(lost);
+	check(got.size() < expected.size() && got.back() == expected.back(), "lost packet");
+
+	// A broken CRC
+	std::string bad = pmt;
+	bad[100] ^= 0x01;
+	starts.assign(1, 0);
+	Segmenter::SectionAssembler a;
+	std::vector<std::string> bad_packets = packetize(bad, starts);
+	for( size_t i = 0; i < bad_packets.size(); i++ ) check(a.push(bad_packets[i].data()).empty(), "section with a broken CRC");
+	check(a.errors() == 1, "broken CRC counted");
+
+	// Short-form sections have no version or section number to read
+	std::string run_short = std::string("\x00\x30\x00", 3) + std::string("\x02\x30\x05\x00\x01\xc1\x00\x00", 8) + pat;
+	starts.clear();
+	starts.push_back(0);
+	starts.push_back(3);
+	starts.push_back(11);
+	got = assemble(packetize(run_short, starts));
+	check(got.size() == 1 && got[0] == pat, "short-form sections dropped");
+
+	return failures ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4: */
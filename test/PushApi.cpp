@@ -0,0 +1,119 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdlib.h>
+
+#include "../src/PushSegmenter.hpp"
+#include "../src/Segmenter/Formats.hpp"
+#include "../src/Input/Memory.hpp"
+#include "../bench/Streams.hpp"
+
+/* Feeds synthetic streams through PushSegmenter in spans of all sizes, and
+ * checks that the segments come out exactly like copy_segment() makes them
+ * from memory; and that big spans aren't copied
+ */
+
+struct Segment {
+	std::string data;
+	float duration;
+};
+
+class Collect : public PushSegmenter::Sink {
+public:
+	std::vector<Segment> segments;
+	const char *span, *span_end; // Being fed
+	unsigned long long in_place, copied; // Bytes handed over
+
+	Collect() : span(NULL), span_end(NULL), in_place(0), copied(0) {}
+
+	virtual void SegmentStart(unsigned long sequence) {
+		if( sequence != segments.size() + 1 ) {
+			std::cerr << "Segment " << sequence << " starts after " << segments.size() << "\n";
+			exit(1);
+		}
+		segments.push_back(Segment());
+	}
+	virtual void SegmentData(const char *data, size_t length) {
+		segments.back().data.append(data, length);
+		if( data >= span && data + length <= span_end ) in_place += length;
+		else copied += length;
+	}
+	virtual void SegmentEnd(unsigned long sequence, float duration) {
+		segments.back().duration = duration;
+	}
+};
+
+static int failures = 0;
+
+static std::vector<Segment> reference(const std::string &format, const std::string &stream) {
+	std::vector<Segment> ret;
+	Segmenter::Segmenter *seg = Segmenter::create(format, 2, "");
+	Input::Memory in(stream.data(), stream.data() + stream.size());
+	while( 1 ) {
+		std::ostringstream out;
+		Segment s;
+		s.duration = seg->copy_segment(&in, &out);
+		s.data = out.str();
+		ret.push_back(s);
+		if( s.duration <= 0 ) break;
+	}
+	delete seg;
+	return ret;
+}
+
+static void test(const std::string &format, const std::string &stream, size_t min_span, size_t max_span) {
+	std::vector<Segment> expected = reference(format, stream);
+
+	Collect sink;
+	srand(1);
+	{
+		PushSegmenter push(Segmenter::create(format, 2, ""), &sink);
+		for( size_t pos = 0; pos < stream.size(); ) {
+			size_t length = min_span + rand() % (max_span - min_span + 1);
+			if( length > stream.size() - pos ) length = stream.size() - pos;
+			std::string span = stream.substr(pos, length); // A buffer of its own, gone after Feed()
+			sink.span = span.data();
+			sink.span_end = span.data() + span.size();
+			push.Feed(span.data(), span.size());
+			sink.span = sink.span_end = NULL;
+			pos += length;
+		}
+		push.End();
+	}
+
+	bool same = sink.segments.size() == expected.size();
+	for( size_t i = 0; same && i < expected.size(); i++ ) {
+		same = sink.segments[i].data == expected[i].data && sink.segments[i].duration == expected[i].duration;
+	}
+	if( ! same ) {
+		std::cerr << "FAIL: " << format << " in spans of " << min_span << "-" << max_span << " bytes: "
+		          << sink.segments.size() << " segments, expected " << expected.size() << "\n";
+		failures++;
+	}
+	if( min_span >= 64*1024 && sink.copied * 100 > sink.in_place ) {
+		std::cerr << "FAIL: " << format << " in spans of " << min_span << "-" << max_span << " bytes: "
+		          << sink.copied << " bytes copied, " << sink.in_place << " not\n";
+		failures++;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long count;
+	std::string ts = stream_ts_h264(20, 25, 1, count);
+	std::string aac = stream_adts(20, 1, count);
+	std::string mp3 = stream_mp3(20, 1, count);
+
+	test("mpegts", ts, 1, 1);
+	test("mpegts", ts, 1, 1000);
+	test("mpegts", ts, 64*1024, 1024*1024);
+	test("adts", aac, 1, 10);
+	test("adts", aac, 64*1024, 256*1024);
+	test("mp3", mp3, 1, 1000);
+	test("mp3", mp3, 64*1024, 256*1024);
+	test("bytecount", ts, 1, 5000);
+
+	return failures ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4: */
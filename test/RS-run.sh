@@ -0,0 +1,29 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+# Junk between packets costs the junk, not the rest of the run: the
+# segmenter finds the packets again and cuts in the same places
+./Generate ts 30 25 > rs.ts
+../src/segmenter -l 2 -i rs.ts -o "rs-?????.ts" -I rs.m3u8 2> rs.log
+segments=$(grep -c '^rs-' rs.m3u8)
+test $segments -ge 10
+cat rs-*.ts > rs.out
+
+size=$(stat -c %s rs.ts)
+at=$(( size / 188 / 3 * 188 ))
+{
+	head -c $at rs.ts
+	head -c 500 /dev/zero | tr '\0' 'x'
+	tail -c +$(( at + 1 )) rs.ts | head -c $at
+	yes 'G junk' | head -c 777 # With bytes that look like sync bytes
+	tail -c +$(( 2 * at + 1 )) rs.ts
+} > rs.in
+rm rs-*.ts
+../src/segmenter -l 2 -i rs.in -o "rs-?????.ts" -I rs.m3u8 2> rs.log # set -e: exit status 0
+grep -q '^Lost TS-sync, skipped 500 bytes$' rs.log
+test $(grep -c '^Lost TS-sync, skipped [0-9]* bytes$' rs.log) -eq 2
+test $(grep -c '^rs-' rs.m3u8) -eq $segments
+cat rs-*.ts | cmp - rs.out # Not a packet lost
+
+rm rs-* rs.ts rs.in rs.out rs.m3u8 rs.log
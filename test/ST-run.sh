@@ -0,0 +1,14 @@
+#!/bin/bash
+
+set -e # exit immediately
+
+dd if=/dev/zero bs=100 count=10 of=st.in
+
+../src/segmenter -f bytecount -e 100 -l 2 -i st.in -o "st-?????.ts" -I st.m3u8 -J st.json -R st.prom
+
+# One line per segment, including the empty one closed at the end
+test $(wc -l < st.json) -eq 6
+grep -q '^{"time":[0-9.]*,"rendition":"","sequence":5,"file":"st-00005.ts",.*"bytes_out":200,' st.json
+grep -q '^segmenter_output_bytes_total{rendition=""} 1000$' st.prom
+
+rm st-* st.in st.m3u8 st.json st.prom
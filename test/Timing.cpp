@@ -0,0 +1,98 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#include "../src/Segmenter/Formats.hpp"
+#include "../src/Input/Memory.hpp"
+#include "../bench/Streams.hpp"
+
+/* Segments a synthetic stream with its timestamps moved up to the 33 bit
+ * wraparound, and with its PCRs taken out, and checks that segments last
+ * exactly as long as their pictures, with copy_segment() and split() alike,
+ * and that the statistics see the pictures of each segment span less
+ */
+
+#define TS_PACKET_SIZE 188
+
+static int failures = 0;
+
+static void retime(std::string &ts, long long offset, bool keep_pcr) {
+	for( size_t off = 0; off + TS_PACKET_SIZE <= ts.size(); off += TS_PACKET_SIZE ) {
+		unsigned char *p = reinterpret_cast<unsigned char*>(&ts[off]);
+		unsigned char *pes = p + 4;
+		if( p[3] & 0x20 ) {
+			if( p[4] && ! keep_pcr ) p[5] &= ~0x10;
+			pes += 1 + p[4];
+		}
+		if( ! (p[1] & 0x40) || pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01 ) continue;
+		unsigned char *t = pes + 9; // The streams only have a PTS
+		long long pts = (static_cast<long long>(t[0] & 0x0e) << 29) | (t[1] << 22) | ((t[2] & 0xfe) << 14) | (t[3] << 7) | (t[4] >> 1);
+		pts = (pts + offset) & 0x1ffffffffLL;
+		t[0] = 0x21 | ((pts >> 29) & 0x0e);
+		t[1] = pts >> 22;
+		t[2] = ((pts >> 14) & 0xfe) | 1;
+		t[3] = pts >> 7;
+		t[4] = ((pts << 1) & 0xfe) | 1;
+	}
+}
+
+static void test(long long offset, bool keep_pcr) {
+	unsigned long packets;
+	std::string ts = stream_ts_h264(20, 25, 1, packets);
+	retime(ts, offset, keep_pcr);
+
+	std::vector<float> durations;
+	Segmenter::Segmenter *seg = Segmenter::create("mpegts", 2, "");
+	Segmenter::Stats stats;
+	seg->setStats(&stats);
+	Input::Memory in(ts.data(), ts.data() + ts.size());
+	bool spans_ok = true;
+	while( 1 ) {
+		stats.clear();
+		durations.push_back(seg->copy_segment(&in, NULL));
+		if( durations.back() <= 0 ) break;
+		double span = ((stats.last_pts - stats.first_pts) & 0x1ffffffffLL) / 90000.0;
+		if( stats.first_pts == -1 || span >= durations.back() ) spans_ok = false;
+	}
+	delete seg;
+	if( ! spans_ok ) {
+		std::cerr << "FAIL: offset " << offset << ": PTS span of a segment in the stats\n";
+		failures++;
+	}
+
+	// An IDR frame every second, and the last picture and audio end at 20s
+	bool ok = durations.size() == 10 && durations.back() == -2.0f;
+	for( size_t i = 0; ok && i + 1 < durations.size(); i++ ) ok = durations[i] == 2.0f;
+	if( ! ok ) {
+		std::cerr << "FAIL: offset " << offset << (keep_pcr ? "" : " without PCR") << ":";
+		for( size_t i = 0; i < durations.size(); i++ ) std::cerr << " " << durations[i];
+		std::cerr << "\n";
+		failures++;
+	}
+
+	std::vector<Segmenter::Span> spans;
+	seg = Segmenter::create("mpegts", 2, "");
+	if( ! seg->split(ts.data(), ts.size(), 2, spans) ) {
+		std::cerr << "FAIL: offset " << offset << ": can't split\n";
+		failures++;
+	} else {
+		ok = spans.size() == durations.size();
+		for( size_t i = 0; ok && i < spans.size(); i++ ) ok = spans[i].duration == durations[i];
+		if( ! ok ) {
+			std::cerr << "FAIL: offset " << offset << ": split() times segments differently\n";
+			failures++;
+		}
+	}
+	delete seg;
+}
+
+int main(int argc, char *argv[]) {
+	test(0, true);
+	test(0, false);
+	test(0x200000000LL - 7 * 90000, true); // Wraps around in the fourth segment
+	test(0x200000000LL - 6 * 90000 - 10000, false); // Right at a cut
+	return failures ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4: */